@@ -17,6 +17,7 @@
 
 
 static const int MAX_EXTERNAL_INTERRUPTS = 3;
+static const uint8_t MAX_DIGITAL_PORTS = 12; // PORTA..PORTL
 
 struct InterruptHandler {
     IOInterruptFunction func;
@@ -37,7 +38,7 @@ static uint8_t InterruptModeToArduino(IO::Interrupt::Mode mode) {
     return CHANGE;
 }
 
-class ArduinoIO : public IO {
+class ArduinoIO MICROFLO_IO_FINAL : public IO {
 public:
 
     // ... Arduino interrupt API is stupid and does not provide the callback with context
@@ -104,6 +105,55 @@ public:
     virtual bool DigitalRead(MicroFlo::PinId pin) {
         return digitalRead(pin);
     }
+#ifdef __AVR__
+    // Bits are collected per port, then each port register is written once
+    // Note: unlike digitalWrite(), does not turn off PWM on the pins
+    virtual void DigitalWriteMany(const MicroFlo::PinId *pins, uint8_t count, uint32_t values) {
+        volatile uint8_t *registers[MAX_DIGITAL_PORTS];
+        uint8_t set[MAX_DIGITAL_PORTS];
+        uint8_t clear[MAX_DIGITAL_PORTS];
+        uint8_t nRegisters = 0;
+        for (uint8_t i=0; i<count && i<32; i++) {
+            const uint8_t port = digitalPinToPort(pins[i]);
+            if (port == NOT_A_PIN) {
+                continue;
+            }
+            volatile uint8_t *reg = portOutputRegister(port);
+            uint8_t r = 0;
+            while (r < nRegisters && registers[r] != reg) {
+                r++;
+            }
+            if (r == nRegisters) {
+                registers[r] = reg;
+                set[r] = 0;
+                clear[r] = 0;
+                nRegisters++;
+            }
+            const uint8_t bit = digitalPinToBitMask(pins[i]);
+            if ((values >> i) & 1) {
+                set[r] |= bit;
+            } else {
+                clear[r] |= bit;
+            }
+        }
+        const uint8_t oldSREG = SREG;
+        cli();
+        for (uint8_t r=0; r<nRegisters; r++) {
+            *registers[r] = (*registers[r] & ~clear[r]) | set[r];
+        }
+        SREG = oldSREG;
+    }
+    virtual uint32_t DigitalReadMany(const MicroFlo::PinId *pins, uint8_t count) {
+        uint32_t values = 0;
+        for (uint8_t i=0; i<count && i<32; i++) {
+            const uint8_t port = digitalPinToPort(pins[i]);
+            if (port != NOT_A_PIN && (*portInputRegister(port) & digitalPinToBitMask(pins[i]))) {
+                values |= ((uint32_t)1 << i);
+            }
+        }
+        return values;
+    }
+#endif
 
     // Analog
     virtual long AnalogRead(MicroFlo::PinId pin) {
@@ -11,18 +11,15 @@
 
 #ifdef MICROFLO_GRAPH_PROGMEM
 #include <avr/pgmspace.h>
+static uint8_t readProgMem(const uint8_t *address) {
+    return pgm_read_byte_near(address);
+}
 void loadFromProgMem(HostCommunication *controller) {
-    for (unsigned int i=0; i<sizeof(graph); i++) {
-        unsigned char c = pgm_read_byte_near(graph+i);
-        controller->parseByte(c);
-    }
+    controller->loadGraphStream(graph, sizeof(graph), readProgMem);
 }
 #else
 void loadFromProgMem(HostCommunication *controller) {
-        for (unsigned int i=0; i<sizeof(graph); i++) {
-        unsigned char c = graph[i];
-        controller->parseByte(c);
-    }
+    controller->loadGraphStream(graph, sizeof(graph));
 }
 #endif
 
@@ -16,6 +16,9 @@ enum GraphCmd {
     GraphCmdDisconnectNodes = 23,
     GraphCmdRemoveNode = 24,
     GraphCmdGetNetworkStatus = 25,
+    GraphCmdSetProtocolVersion = 26,
+    GraphCmdLoadGraphImage = 27,
+    GraphCmdGetTickStatistics = 28,
     GraphCmdNetworkStopped = 100,
     GraphCmdNodeAdded = 101,
     GraphCmdNodesConnected = 102,
@@ -35,6 +38,10 @@ enum GraphCmd {
     GraphCmdNodesDisconnected = 116,
     GraphCmdNodeRemoved = 117,
     GraphCmdNetworkStatus = 118,
+    GraphCmdProtocolVersionChanged = 119,
+    GraphCmdPacketsSent = 120,
+    GraphCmdGraphImageLoaded = 121,
+    GraphCmdTickStatistics = 122,
     GraphCmdInvalid,
     GraphCmdMax = 255
 };
@@ -66,9 +73,9 @@ static const char *GraphCmd_names[] = {
     "DisconnectNodes",
     "RemoveNode",
     "GetNetworkStatus",
-    0,
-    0,
-    0,
+    "SetProtocolVersion",
+    "LoadGraphImage",
+    "GetTickStatistics",
     0,
     0,
     0,
@@ -159,10 +166,10 @@ static const char *GraphCmd_names[] = {
     "NodesDisconnected",
     "NodeRemoved",
     "NetworkStatus",
-    0,
-    0,
-    0,
-    0,
+    "ProtocolVersionChanged",
+    "PacketsSent",
+    "GraphImageLoaded",
+    "TickStatistics",
     0,
     0,
     0,
@@ -882,6 +889,18 @@ enum DebugId {
     DebugSubscribePortInvalidPort = 35,
     DebugRemoveNodeInvalidInstance = 36,
     DebugRemoveNodeInvalidParent = 37,
+    DebugSubGraphRouteLimitReached = 38,
+    DebugAddNodeAllocationFailed = 39,
+    DebugNetworkConnectInvalidPort = 40,
+    DebugFrameInvalidLength = 41,
+    DebugFrameChecksumMismatch = 42,
+    DebugProtocolVersionUnsupported = 43,
+    DebugSubscribePortInvalidMode = 44,
+    DebugSubscriptionFilterLimitReached = 45,
+    DebugGraphImageInvalid = 46,
+    DebugGraphImageChecksumMismatch = 47,
+    DebugGraphImageAllocationFailed = 48,
+    DebugTickStatisticsUnavailable = 49,
     DebugUser1 = 100,
     DebugUser2 = 101,
     DebugUser3 = 102,
@@ -930,18 +949,18 @@ static const char *DebugId_names[] = {
     "SubscribePortInvalidPort",
     "RemoveNodeInvalidInstance",
     "RemoveNodeInvalidParent",
-    0,
-    0,
-    0,
-    0,
-    0,
-    0,
-    0,
-    0,
-    0,
-    0,
-    0,
-    0,
+    "SubGraphRouteLimitReached",
+    "AddNodeAllocationFailed",
+    "NetworkConnectInvalidPort",
+    "FrameInvalidLength",
+    "FrameChecksumMismatch",
+    "ProtocolVersionUnsupported",
+    "SubscribePortInvalidMode",
+    "SubscriptionFilterLimitReached",
+    "GraphImageInvalid",
+    "GraphImageChecksumMismatch",
+    "GraphImageAllocationFailed",
+    "TickStatisticsUnavailable",
     0,
     0,
     0,
@@ -1439,3 +1458,35 @@ static const char *IoType_names[] = {
     0,
     "Max"
 };
+
+enum SubscriptionMode {
+    SubscriptionModeAll = 0,
+    SubscriptionModeEveryNth = 1,
+    SubscriptionModeMaxRate = 2,
+    SubscriptionModeOnChange = 3,
+    SubscriptionModeInvalid
+};
+
+static const char *SubscriptionMode_names[] = {
+    "All",
+    "EveryNth",
+    "MaxRate",
+    "OnChange"
+};
+
+enum TickStatistic {
+    TickStatisticCount = 0,
+    TickStatisticMin = 1,
+    TickStatisticAverage = 2,
+    TickStatisticMax = 3,
+    TickStatisticPercentile99 = 4,
+    TickStatisticInvalid
+};
+
+static const char *TickStatistic_names[] = {
+    "Count",
+    "Min",
+    "Average",
+    "Max",
+    "Percentile99"
+};
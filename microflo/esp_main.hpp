@@ -19,10 +19,7 @@
 #include <Msgflo.h>
 
 void loadFromProgMem(HostCommunication *controller) {
-        for (unsigned int i=0; i<sizeof(graph); i++) {
-        unsigned char c = graph[i];
-        controller->parseByte(c);
-    }
+    controller->loadGraphStream(graph, sizeof(graph));
 }
 
 class MqttMount : public HostCommunication {
@@ -38,8 +35,9 @@ public:
     virtual void packetSent(const Message &m, const Component *sender, MicroFlo::PortId senderPort) {
 
         const MicroFlo::NodeId senderId = sender->id();
-        const std::string data = encodePacket(m.pkg);
-        Serial.printf("sent %d %d: %s \n", senderId, senderPort, data.c_str());
+        char data[MICROFLO_PACKET_TEXT_MAX];
+        encodePacket(m.pkg, data, sizeof(data));
+        Serial.printf("sent %d %d: %s \n", senderId, senderPort, data);
 
         msgflo::OutPort *port = NULL;
         for (size_t i=0; i<graph_outports_length; i++) {
@@ -54,7 +52,7 @@ public:
             };
         }
         if (port) {
-          port->send(String(data.c_str()));
+          port->send(String(data));
         }
 
         // Chain to parent
@@ -158,10 +156,9 @@ void setup()
       MicroFlo::PortId portId = graph_inports_port[i];
       MicroFlo::NodeId nodeId = graph_inports_node[i];
       auto callback = [nodeId, portId, name](byte *data, int length) -> void {
-          const std::string in((char *)data, length);
-          const Packet pkg = decodePacket(in);
+          const Packet pkg = decodePacket((const char *)data, length);
 
-          Serial.printf("received on %s on %s: %d %d:\n", in.c_str(), name, nodeId, portId);
+          Serial.printf("received %.*s on %s: %d %d:\n", length, (const char *)data, name, nodeId, portId);
           network.sendMessageTo(nodeId, portId, pkg);
       };
 
@@ -1,3 +1,10 @@
+// IO which does nothing, for tests and hosts without hardware
+
+#ifndef MICROFLO_IO_HPP
+#define MICROFLO_IO_HPP
+
+#include "microflo.h"
+
 class NullIO : public IO {
 
 public:
@@ -64,3 +71,5 @@ public:
         MICROFLO_DEBUG(debug, DebugLevelError, DebugIoOperationNotImplemented);
     }
 };
+
+#endif // MICROFLO_IO_HPP
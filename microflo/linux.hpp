@@ -21,6 +21,13 @@
 #include <unistd.h>
 #include <pty.h>
 #include <poll.h>
+#include <sys/uio.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <vector>
+#include <set>
 
 namespace linux_serial {
 
@@ -65,23 +72,6 @@ set_interface_attribs(int fd, int speed)
 namespace {
     static const std::string SYS_GPIO_BASE = "/sys/class/gpio/";
 
-    static inline std::string &rtrim(std::string &s) {
-            s.erase(std::find_if(s.rbegin(), s.rend(), std::not1(std::ptr_fun<int, int>(std::isspace))).base(), s.end());
-            return s;
-    }
-
-    // PERFORMANCE: string-functions and file open/close for each I/O call. Consider capturing state in a class
-    std::string read_sys_file(const std::string &path) {
-        std::ifstream fs(path.c_str());
-        if (!fs){
-            return "";
-        }
-        std::string res;
-        fs >> res; 
-        fs.close();
-        return res;
-    }
-
     bool write_sys_file(const std::string &path, const std::string &value) {
         std::ofstream fs(path.c_str());
         if (!fs){
@@ -115,18 +105,42 @@ namespace {
         const int ready = ppoll(&fds[0], nfds, &tv, NULL);
         return ready > 0;
     }
+
+    // 64 bit, as a 32 bit long would wrap after about 35 minutes
+    int64_t monotonicMicros() {
+        timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        return (int64_t)now.tv_sec*1000000 + now.tv_nsec/1000;
+    }
 }
 
 
 
+#ifndef MICROFLO_LINUX_SERIAL_OUTBUFFER
+#define MICROFLO_LINUX_SERIAL_OUTBUFFER 4096
+#endif
+#ifndef MICROFLO_LINUX_SERIAL_READ_BUDGET
+#define MICROFLO_LINUX_SERIAL_READ_BUDGET 16384 // bytes per tick
+#endif
+#ifndef MICROFLO_LINUX_SERIAL_MAX_LATENCY
+#define MICROFLO_LINUX_SERIAL_MAX_LATENCY 1000 // microseconds
+#endif
+
+// Commands are queued and written without blocking from runTick(),
+// at the latest @latency microseconds after being sent
 class LinuxSerialTransport : public HostTransport {
 public:
-    LinuxSerialTransport(std::string p)
+    LinuxSerialTransport(std::string p, long latency=MICROFLO_LINUX_SERIAL_MAX_LATENCY)
         : path(p)
         , slave(-1)
         , master(-1)
         , io(NULL)
         , controller(NULL)
+        , maxLatency(latency)
+        , outStart(0)
+        , outLength(0)
+        , outSince(0)
+        , dropped(0)
     {
     }
 
@@ -135,12 +149,24 @@ public:
     virtual void runTick();
     virtual void sendCommand(const uint8_t *buf, uint8_t len);
 
+    // Commands dropped because output could not keep up
+    long droppedCommands() const { return dropped; }
+
+private:
+    void flush();
+
 private:
     std::string path;
     int slave;
     int master;
     IO *io;
     HostCommunication *controller;
+    long maxLatency;
+    uint8_t out[MICROFLO_LINUX_SERIAL_OUTBUFFER];
+    size_t outStart;
+    size_t outLength;
+    int64_t outSince; // when oldest byte in @out was queued
+    long dropped;
 };
 
 void LinuxSerialTransport::setup(IO *i, HostCommunication *c) {
@@ -170,6 +196,7 @@ void LinuxSerialTransport::setup(IO *i, HostCommunication *c) {
     /* baudrate 115200, 8 bits, no parity, 1 stop bit */
     if (master >= 0) {
         linux_serial::set_interface_attribs(master, B115200);
+        fcntl(master, F_SETFL, fcntl(master, F_GETFL) | O_NONBLOCK);
     } else {
         fprintf(stderr, "PTY master filedescriptor is invalid\n");
         return;
@@ -178,49 +205,441 @@ void LinuxSerialTransport::setup(IO *i, HostCommunication *c) {
 
 void LinuxSerialTransport::runTick() {
 
+    if (outLength && monotonicMicros()-outSince >= maxLatency) {
+        flush();
+    }
+
     const bool ready = canRead(master, 10);
     if (!ready) {
         return;
     }
 
-    const size_t cmdSize = MICROFLO_CMD_SIZE;
-    unsigned char buf[cmdSize];
-    const ssize_t bytesRead = read(master, buf, cmdSize);
-    if (bytesRead > 0) {
-        for (ssize_t i=0; i<bytesRead; i++) {
-            controller->parseByte(buf[i]);
+    // Take everything available, up to the budget
+    uint8_t buf[1024];
+    size_t budget = MICROFLO_LINUX_SERIAL_READ_BUDGET;
+    while (budget > 0) {
+        const ssize_t bytesRead = read(master, buf, std::min(budget, sizeof(buf)));
+        if (bytesRead <= 0) {
+            break; // EAGAIN, nothing more for now
         }
+        controller->parseBytes(buf, bytesRead);
+        budget -= bytesRead;
     }
 }
 
 void LinuxSerialTransport::sendCommand(const uint8_t *b, uint8_t len) {
-    // Make sure to pad to the cmd size
-    const size_t cmdSize = MICROFLO_CMD_SIZE;
-    char cmd[cmdSize];
-    for (uint8_t i=0; i<cmdSize; i++) {
-        cmd[i] = ((i < len) ?  b[i] : 0x00);
-    }
-
-    size_t written = write(master, cmd, cmdSize);
-    //if (written != cmdSize) {
-    //    printf("Error from write: %d, %d\n", wlen, errno);
-    //}
-    tcdrain(master); /* delay for output */
+    if (outLength+len > sizeof(out)) {
+        flush();
+    }
+    if (outLength+len > sizeof(out)) {
+        // Host is not reading. Drop whole command, so the stream stays in sync
+        dropped++;
+        return;
+    }
+    if (outLength == 0) {
+        outSince = monotonicMicros();
+    }
+    for (uint8_t i=0; i<len; i++) {
+        out[(outStart+outLength+i) % sizeof(out)] = b[i];
+    }
+    outLength += len;
+}
+
+// Writes as much as the PTY takes without blocking. Data that wraps around goes in one writev()
+void LinuxSerialTransport::flush() {
+    while (outLength) {
+        const size_t first = std::min(outLength, sizeof(out)-outStart);
+        struct iovec parts[2] = {
+            { out+outStart, first },
+            { out, outLength-first }
+        };
+        const ssize_t written = writev(master, parts, (outLength > first) ? 2 : 1);
+        if (written < 0 && errno == EINTR) {
+            continue;
+        }
+        if (written <= 0) {
+            // EAGAIN: PTY buffer full, try again next tick
+            break;
+        }
+        outStart = (outStart + written) % sizeof(out);
+        outLength -= written;
+    }
+    // Anything left over counts as new, so it is retried after @maxLatency instead of every tick
+    outSince = monotonicMicros();
+}
+
+
+#ifndef MICROFLO_LINUX_SOCKET_MAX_CLIENTS
+#define MICROFLO_LINUX_SOCKET_MAX_CLIENTS 8
+#endif
+#ifndef MICROFLO_LINUX_SOCKET_OUTBUFFER
+#define MICROFLO_LINUX_SOCKET_OUTBUFFER 65536 // per client. One falling further behind is disconnected
+#endif
+
+// Listens on a Unix-domain socket at @path, and optionally on loopback TCP @tcpPort
+// Several hosts can be connected at the same time. Each has its own HostCommunication,
+// so protocol version and parser state are per host, and responses go to the host that sent the request.
+// Packets on subscribed edges go only to the hosts which subscribed to that edge, other notifications
+// to all hosts. Subscription modes (sampling) are per edge, so shared by all hosts.
+// The HostCommunication given to setup() is only used for loading a graph at boot,
+// what it sends goes to all hosts
+class LinuxSocketTransport : public HostTransport, public NetworkNotificationHandler {
+public:
+    LinuxSocketTransport(std::string p, int port=-1)
+        : path(p)
+        , tcpPort(port)
+        , unixListener(-1)
+        , tcpListener(-1)
+        , io(NULL)
+        , controller(NULL)
+    {
+    }
+    ~LinuxSocketTransport();
+
+    // implements HostTransport
+    virtual void setup(IO *i, HostCommunication *c);
+    virtual void runTick();
+    virtual void sendCommand(const uint8_t *buf, uint8_t len);
+
+    // implements NetworkNotificationHandler, passing on to the HostCommunication of each client
+    virtual void packetSent(const Message &m, const Component *sender, MicroFlo::PortId senderPort);
+    virtual void messagesProcessed();
+    virtual void emitDebug(DebugLevel level, DebugId id);
+
+    size_t clientCount() const { return clients.size(); }
+
+private:
+    class Client;
+    typedef std::pair<MicroFlo::NodeId, MicroFlo::PortId> Edge;
+
+    // Protocol session of a client, telling the transport about its subscriptions
+    class Controller : public HostCommunication {
+    public:
+        Controller(Client *c) : client(c) {}
+    protected:
+        virtual void portSubscriptionChanged(MicroFlo::NodeId node, MicroFlo::PortId port, bool enable);
+    private:
+        Client *client;
+    };
+
+    // A connected host
+    class Client : public HostTransport {
+    public:
+        Client(LinuxSocketTransport *t, int f)
+            : transport(t)
+            , controller(this)
+            , fd(f)
+            , closed(false)
+        {
+        }
+        virtual ~Client() {}
+
+        // implements HostTransport
+        virtual void setup(IO *i, HostCommunication *c) {}
+        virtual void runTick() {}
+        virtual void sendCommand(const uint8_t *buf, uint8_t len) {
+            transport->queue(*this, buf, len);
+        }
+
+    public:
+        LinuxSocketTransport *transport;
+        Controller controller;
+        int fd;
+        bool closed;
+        std::string out;
+        std::set<Edge> subscriptions;
+    };
+
+    // Owns sockets, not copyable
+    LinuxSocketTransport(const LinuxSocketTransport &);
+    LinuxSocketTransport &operator=(const LinuxSocketTransport &);
+
+    int listenOn(const struct sockaddr *address, socklen_t length);
+    void acceptClients(int listener);
+    void receive(Client &c);
+    void queue(Client &c, const uint8_t *buf, size_t len);
+    void flush(Client &c);
+    void removeClosed();
+    void subscriptionChanged(Client &c, const Edge &edge, bool enable);
+    bool subscribedByOther(const Client &c, const Edge &edge) const;
+
+private:
+    std::string path;
+    int tcpPort;
+    int unixListener;
+    int tcpListener;
+    IO *io;
+    HostCommunication *controller;
+    std::vector<Client *> clients;
+};
+
+LinuxSocketTransport::~LinuxSocketTransport() {
+    for (size_t i=0; i<clients.size(); i++) {
+        close(clients[i]->fd);
+        delete clients[i];
+    }
+    if (unixListener >= 0) {
+        close(unixListener);
+        unlink(path.c_str());
+    }
+    if (tcpListener >= 0) {
+        close(tcpListener);
+    }
+}
+
+int LinuxSocketTransport::listenOn(const struct sockaddr *address, socklen_t length) {
+    const int fd = socket(address->sa_family, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    if (fd < 0) {
+        fprintf(stderr, "Failed to create socket: %s\n", strerror(errno));
+        return -1;
+    }
+    const int reuse = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+    if (bind(fd, address, length) != 0 || listen(fd, MICROFLO_LINUX_SOCKET_MAX_CLIENTS) != 0) {
+        fprintf(stderr, "Failed to listen on socket: %s\n", strerror(errno));
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+void LinuxSocketTransport::setup(IO *i, HostCommunication *c) {
+    io = i;
+    controller = c;
+
+    struct sockaddr_un unixAddress;
+    memset(&unixAddress, 0, sizeof(unixAddress));
+    unixAddress.sun_family = AF_UNIX;
+    if (path.size() >= sizeof(unixAddress.sun_path)) {
+        fprintf(stderr, "Socket path too long: %s\n", path.c_str());
+        return;
+    }
+    strncpy(unixAddress.sun_path, path.c_str(), sizeof(unixAddress.sun_path)-1);
+    unlink(path.c_str());
+    unixListener = listenOn((struct sockaddr *)&unixAddress, sizeof(unixAddress));
+
+    if (tcpPort >= 0) {
+        struct sockaddr_in tcpAddress;
+        memset(&tcpAddress, 0, sizeof(tcpAddress));
+        tcpAddress.sin_family = AF_INET;
+        tcpAddress.sin_port = htons(tcpPort);
+        tcpAddress.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        tcpListener = listenOn((struct sockaddr *)&tcpAddress, sizeof(tcpAddress));
+    }
+}
+
+void LinuxSocketTransport::acceptClients(int listener) {
+    while (listener >= 0) {
+        const int fd = accept4(listener, NULL, NULL, SOCK_NONBLOCK);
+        if (fd < 0) {
+            return; // EAGAIN, no more waiting
+        }
+        if (clients.size() >= MICROFLO_LINUX_SOCKET_MAX_CLIENTS) {
+            close(fd);
+            continue;
+        }
+        Client *c = new Client(this, fd);
+        c->controller.setup(controller->currentNetwork(), c);
+        clients.push_back(c);
+        // Replaces the one set by HostCommunication::setup(), so that every client is notified
+        controller->currentNetwork()->setNotificationHandler(this);
+    }
+}
+
+// Parses everything received from @c
+void LinuxSocketTransport::receive(Client &c) {
+    uint8_t buf[1024];
+    while (!c.closed) {
+        const ssize_t bytesRead = read(c.fd, buf, sizeof(buf));
+        if (bytesRead > 0) {
+            c.controller.parseBytes(buf, bytesRead);
+        } else {
+            if (bytesRead == 0 || (errno != EAGAIN && errno != EINTR)) {
+                c.closed = true;
+            }
+            return;
+        }
+    }
+}
+
+void LinuxSocketTransport::Controller::portSubscriptionChanged(MicroFlo::NodeId node, MicroFlo::PortId port,
+                                                               bool enable) {
+    client->transport->subscriptionChanged(*client, Edge(node, port), enable);
+}
+
+void LinuxSocketTransport::subscriptionChanged(Client &c, const Edge &edge, bool enable) {
+    if (enable) {
+        c.subscriptions.insert(edge);
+    } else {
+        c.subscriptions.erase(edge);
+        if (subscribedByOther(c, edge)) {
+            // Network only has one flag per edge, keep it for the others
+            controller->currentNetwork()->subscribeToPort(edge.first, edge.second, true);
+        }
+    }
+}
+
+bool LinuxSocketTransport::subscribedByOther(const Client &c, const Edge &edge) const {
+    for (size_t i=0; i<clients.size(); i++) {
+        if (clients[i] != &c && !clients[i]->closed && clients[i]->subscriptions.count(edge)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void LinuxSocketTransport::removeClosed() {
+    for (int i=(int)clients.size()-1; i>=0; i--) {
+        if (!clients[i]->closed) {
+            continue;
+        }
+        // Unsubscribe what nobody else is watching
+        const std::set<Edge> &subscriptions = clients[i]->subscriptions;
+        for (std::set<Edge>::const_iterator it = subscriptions.begin(); it != subscriptions.end(); ++it) {
+            if (!subscribedByOther(*clients[i], *it)) {
+                controller->currentNetwork()->subscribeToPort(it->first, it->second, false);
+            }
+        }
+        close(clients[i]->fd);
+        delete clients[i];
+        clients.erase(clients.begin()+i);
+    }
 }
 
+void LinuxSocketTransport::runTick() {
+    removeClosed();
+
+    struct pollfd fds[2+MICROFLO_LINUX_SOCKET_MAX_CLIENTS];
+    nfds_t nfds = 0;
+    fds[nfds].fd = unixListener;
+    fds[nfds++].events = POLLIN;
+    fds[nfds].fd = tcpListener;
+    fds[nfds++].events = POLLIN;
+    for (size_t i=0; i<clients.size(); i++) {
+        fds[nfds].fd = clients[i]->fd;
+        fds[nfds++].events = POLLIN | (clients[i]->out.empty() ? 0 : POLLOUT);
+    }
+    struct timespec tv = { 0, 10*1000 };
+    const int ready = ppoll(fds, nfds, &tv, NULL);
+    if (ready <= 0) {
+        return;
+    }
+
+    // Indices of fds and clients match until new clients are accepted
+    for (size_t i=0; i<clients.size(); i++) {
+        const short events = fds[2+i].revents;
+        if (events & POLLOUT) {
+            flush(*clients[i]);
+        }
+        if (events & (POLLIN | POLLHUP | POLLERR)) {
+            receive(*clients[i]);
+        }
+    }
+    removeClosed();
+
+    if (fds[0].revents & POLLIN) {
+        acceptClients(unixListener);
+    }
+    if (fds[1].revents & POLLIN) {
+        acceptClients(tcpListener);
+    }
+}
+
+void LinuxSocketTransport::sendCommand(const uint8_t *buf, uint8_t len) {
+    for (size_t i=0; i<clients.size(); i++) {
+        queue(*clients[i], buf, len);
+    }
+}
+
+void LinuxSocketTransport::packetSent(const Message &m, const Component *sender, MicroFlo::PortId senderPort) {
+    if (!sender) {
+        return;
+    }
+    const Edge edge(sender->id(), senderPort);
+    for (size_t i=0; i<clients.size(); i++) {
+        if (clients[i]->subscriptions.count(edge)) {
+            clients[i]->controller.packetSent(m, sender, senderPort);
+        }
+    }
+}
+
+void LinuxSocketTransport::messagesProcessed() {
+    for (size_t i=0; i<clients.size(); i++) {
+        clients[i]->controller.messagesProcessed();
+    }
+}
+
+void LinuxSocketTransport::emitDebug(DebugLevel level, DebugId id) {
+    for (size_t i=0; i<clients.size(); i++) {
+        clients[i]->controller.emitDebug(level, id);
+    }
+}
+
+void LinuxSocketTransport::queue(Client &c, const uint8_t *buf, size_t len) {
+    if (c.closed) {
+        return;
+    }
+    if (c.out.size()+len > MICROFLO_LINUX_SOCKET_OUTBUFFER) {
+        c.closed = true;
+        return;
+    }
+    c.out.append((const char *)buf, len);
+    flush(c);
+}
+
+void LinuxSocketTransport::flush(Client &c) {
+    while (!c.out.empty()) {
+        const ssize_t written = send(c.fd, c.out.data(), c.out.size(), MSG_DONTWAIT | MSG_NOSIGNAL);
+        if (written < 0) {
+            if (errno != EAGAIN && errno != EINTR) {
+                c.closed = true;
+            }
+            if (errno != EINTR) {
+                return;
+            }
+            continue;
+        }
+        c.out.erase(0, written);
+    }
+}
+
+
+#ifndef MICROFLO_LINUX_MAX_PINS
+#define MICROFLO_LINUX_MAX_PINS 128
+#endif
 
 /**
  * I/O backend for embedded Linux boards/SOCs, like Raspberry PI, BeagleBone Black etc
 */
-class LinuxIO : public IO {
+class LinuxIO MICROFLO_IO_FINAL : public IO {
 
 public:
-    LinuxIO() {
+    // @gpioRoot is where sysfs GPIO lives. Can be pointed to a plain directory for testing
+    LinuxIO(const std::string &gpioRoot=defaultGpioRoot())
+        : gpioBase(gpioRoot)
+    {
         if (clock_gettime(CLOCK_MONOTONIC, &start_time) != 0) {
             MICROFLO_DEBUG(debug, DebugLevelError, DebugIoFailure);
         }
+        for (int i=0; i<MICROFLO_LINUX_MAX_PINS; i++) {
+            valueFds[i] = -1;
+            interruptHandlers[i].func = NULL;
+            interruptHandlers[i].user = NULL;
+        }
+    }
+    ~LinuxIO() {
+        for (int i=0; i<MICROFLO_LINUX_MAX_PINS; i++) {
+            if (valueFds[i] >= 0) {
+                close(valueFds[i]);
+            }
+        }
+    }
+
+    // Defaults to /sys/class/gpio/, overridable with MICROFLO_GPIO_SYSFS environment variable
+    static std::string defaultGpioRoot() {
+        const char *env = getenv("MICROFLO_GPIO_SYSFS");
+        return (env && env[0]) ? std::string(env) + "/" : SYS_GPIO_BASE;
     }
-    ~LinuxIO() {}
 
     // Serial
     // TODO: support serial
@@ -240,23 +659,33 @@ public:
     }
 
     // Pin config
+    // Value file is opened here and kept open, so reads and writes are a single syscall
     virtual void PinSetMode(MicroFlo::PinId pin, IO::PinMode mode) {
-        if (!write_sys_file(SYS_GPIO_BASE+"export", std::to_string(pin))) {
+        if (pin < 0 || pin >= MICROFLO_LINUX_MAX_PINS) {
             MICROFLO_DEBUG(debug, DebugLevelError, DebugIoFailure);
             return;
         }
+        // Fails if already exported, which is fine
+        write_sys_file(gpioBase+"export", std::to_string(pin));
 
+        const std::string direction = gpioBase+"gpio"+std::to_string(pin)+"/direction";
         if (mode == IO::InputPin) {
-            if (!write_sys_file(SYS_GPIO_BASE+"gpio"+std::to_string(pin)+"/direction", "in")) {
+            if (!write_sys_file(direction, "in")) {
                 MICROFLO_DEBUG(debug, DebugLevelError, DebugIoFailure);
             }
         } else if (mode == IO::OutputPin) {
-            if (write_sys_file(SYS_GPIO_BASE+"gpio"+std::to_string(pin)+"/direction", "out")) {
+            if (!write_sys_file(direction, "out")) {
                 MICROFLO_DEBUG(debug, DebugLevelError, DebugIoFailure);
             }
         } else {
             MICROFLO_DEBUG(debug, DebugLevelError, DebugIoOperationNotImplemented);
+            return;
         }
+
+        if (valueFds[pin] >= 0) {
+            close(valueFds[pin]);
+        }
+        valueFds[pin] = openValue(pin);
     }
     virtual void PinSetPullup(MicroFlo::PinId pin, IO::PullupMode mode) {
         // TODO: support pullup/pulldown config on common boards like RPi
@@ -272,6 +701,20 @@ public:
     virtual bool DigitalRead(MicroFlo::PinId pin) {
         return gpio_read(pin);
     }
+    virtual void DigitalWriteMany(const MicroFlo::PinId *pins, uint8_t count, uint32_t values) {
+        for (uint8_t i=0; i<count && i<32; i++) {
+            gpio_write(pins[i], (values >> i) & 1);
+        }
+    }
+    virtual uint32_t DigitalReadMany(const MicroFlo::PinId *pins, uint8_t count) {
+        uint32_t values = 0;
+        for (uint8_t i=0; i<count && i<32; i++) {
+            if (gpio_read(pins[i])) {
+                values |= ((uint32_t)1 << i);
+            }
+        }
+        return values;
+    }
 
     // Analog
     virtual long AnalogRead(MicroFlo::PinId pin) {
@@ -291,31 +734,149 @@ public:
         timespec since_start = timespec_diff(start_time, current_time);
         return (since_start.tv_sec*1000)+(since_start.tv_nsec/1000000);
     }
+    virtual long TimerCurrentMicros() {
+        return TimerCurrentNanos()/1000;
+    }
+    // Not part of IO. For measuring, like in TickStatistics
+    int64_t TimerCurrentNanos() {
+        timespec current_time;
+        if (clock_gettime(CLOCK_MONOTONIC, &current_time) != 0) {
+            MICROFLO_DEBUG(debug, DebugLevelError, DebugIoFailure);
+        }
+        timespec since_start = timespec_diff(start_time, current_time);
+        return (since_start.tv_sec*(int64_t)1000000000)+since_start.tv_nsec;
+    }
 
+    // @interrupt is the GPIO number. Pin must be set up as input first
+    // Only edges are supported by sysfs. Handlers are called from pollInterrupts()
     virtual void AttachExternalInterrupt(uint8_t interrupt, IO::Interrupt::Mode mode,
                                         IOInterruptFunction func, void *user) {
-        MICROFLO_DEBUG(debug, DebugLevelError, DebugIoOperationNotImplemented);
+        const char *edge = NULL;
+        if (mode == IO::Interrupt::OnRisingEdge) {
+            edge = "rising";
+        } else if (mode == IO::Interrupt::OnFallingEdge) {
+            edge = "falling";
+        } else if (mode == IO::Interrupt::OnChange) {
+            edge = "both";
+        } else {
+            MICROFLO_DEBUG(debug, DebugLevelError, DebugIoOperationNotImplemented);
+            return;
+        }
+        const int fd = valueFd(interrupt);
+        if (fd < 0) {
+            return;
+        }
+        if (!write_sys_file(gpioBase+"gpio"+std::to_string(interrupt)+"/edge", func ? edge : "none")) {
+            MICROFLO_DEBUG(debug, DebugLevelError, DebugIoFailure);
+            return;
+        }
+        // Reading clears any edge which happened before
+        char value;
+        if (pread(fd, &value, 1, 0) != 1) {
+            MICROFLO_DEBUG(debug, DebugLevelError, DebugIoFailure);
+            return;
+        }
+        interruptHandlers[interrupt].func = func;
+        interruptHandlers[interrupt].user = user;
+    }
+
+    // Waits up to @timeoutMicros for edges on pins with interrupts attached, and calls their handlers
+    // Meant to be called from the main loop, between network ticks, so handlers may send packets
+    // Returns number of handlers called
+    int pollInterrupts(long timeoutMicros) {
+        struct pollfd fds[MICROFLO_LINUX_MAX_PINS];
+        int pins[MICROFLO_LINUX_MAX_PINS];
+        nfds_t nfds = 0;
+        for (int pin=0; pin<MICROFLO_LINUX_MAX_PINS; pin++) {
+            if (interruptHandlers[pin].func && valueFds[pin] >= 0) {
+                fds[nfds].fd = valueFds[pin];
+                fds[nfds].events = POLLPRI | POLLERR;
+                fds[nfds].revents = 0;
+                pins[nfds++] = pin;
+            }
+        }
+        struct timespec timeout = { timeoutMicros/1000000, (timeoutMicros%1000000)*1000 };
+        const int ready = ppoll(fds, nfds, &timeout, NULL);
+        if (ready <= 0) {
+            return 0;
+        }
+        int called = 0;
+        for (nfds_t i=0; i<nfds; i++) {
+            if (fds[i].revents & (POLLPRI | POLLERR)) {
+                called += handleEdge(pins[i]) ? 1 : 0;
+            }
+        }
+        return called;
+    }
+
+    // Acknowledges an edge on @pin and calls its handler, as pollInterrupts() does for each edge it sees
+    // Returns whether a handler was called
+    bool handleEdge(MicroFlo::PinId pin) {
+        if (pin < 0 || pin >= MICROFLO_LINUX_MAX_PINS || valueFds[pin] < 0) {
+            return false;
+        }
+        char value;
+        if (pread(valueFds[pin], &value, 1, 0) != 1) {
+            MICROFLO_DEBUG(debug, DebugLevelError, DebugIoFailure);
+        }
+        const InterruptHandler &handler = interruptHandlers[pin];
+        if (!handler.func) {
+            return false;
+        }
+        handler.func(handler.user);
+        return true;
     }
 
 private:
+    int openValue(int number) {
+        const std::string path = gpioBase + "gpio" + std::to_string(number) + "/value";
+        const int fd = open(path.c_str(), O_RDWR);
+        if (fd < 0) {
+            MICROFLO_DEBUG(debug, DebugLevelError, DebugIoFailure);
+        }
+        return fd;
+    }
+
+    // Pins used without PinSetMode are opened on first use
+    int valueFd(int number) {
+        if (number < 0 || number >= MICROFLO_LINUX_MAX_PINS) {
+            return -1;
+        }
+        if (valueFds[number] < 0) {
+            valueFds[number] = openValue(number);
+        }
+        return valueFds[number];
+    }
+
     // Assumes GPIO is set up as input
     bool gpio_read(int number){
-        std::string path = SYS_GPIO_BASE + "gpio" + std::to_string(number) + "/value";
-        std::string res = read_sys_file(path);
-        if (res.empty()) {
+        char value = '0';
+        if (pread(valueFd(number), &value, 1, 0) != 1) {
             MICROFLO_DEBUG(debug, DebugLevelError, DebugIoFailure);
         }
-        res = rtrim(res);
-        return res == "1";
+        return value == '1';
     }
 
     // Assumes GPIO is set up as output
     void gpio_write(int number, bool value){
-        std::string path = SYS_GPIO_BASE + "gpio" + std::to_string(number) + "/value";
-        if (!write_sys_file(path, value ? "1" : "0")) {
+        const char c = value ? '1' : '0';
+        if (pwrite(valueFd(number), &c, 1, 0) != 1) {
             MICROFLO_DEBUG(debug, DebugLevelError, DebugIoFailure);
         }
     }
+
+    // Owns file descriptors, not copyable
+    LinuxIO(const LinuxIO &);
+    LinuxIO &operator=(const LinuxIO &);
+
 private:
+    struct InterruptHandler {
+        IOInterruptFunction func;
+        void *user;
+    };
+
+    std::string gpioBase;
+    int valueFds[MICROFLO_LINUX_MAX_PINS]; // -1 if not opened
+    InterruptHandler interruptHandlers[MICROFLO_LINUX_MAX_PINS];
     struct timespec start_time;
 };
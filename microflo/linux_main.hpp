@@ -5,34 +5,107 @@
 
 #include "microflo.h"
 #include "linux.hpp"
+#include "recordio.hpp"
 #include <unistd.h>
 
 int main(int argc, char *argv[]) {
-    LinuxIO io;
+    LinuxIO linuxIO;
+    ComponentIO *io = &linuxIO;
+    ReplayIO *replay = NULL;
+    FILE *recording = NULL;
+#ifndef MICROFLO_IO_TYPE
+    // Record all IO to a trace file, or run against a recorded trace instead of hardware
+    std::vector<uint8_t> trace;
+    const char *replayPath = getenv("MICROFLO_IO_REPLAY");
+    const char *recordPath = getenv("MICROFLO_IO_RECORD");
+    if (replayPath) {
+        std::ifstream file(replayPath, std::ios::binary);
+        trace.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+        replay = new ReplayIO(trace.empty() ? NULL : &trace[0], trace.size());
+        if (!replay->valid()) {
+            fprintf(stderr, "Not a valid IO trace: %s\n", replayPath);
+            return 1;
+        }
+        io = replay;
+    } else if (recordPath) {
+        recording = fopen(recordPath, "wb");
+        if (!recording) {
+            fprintf(stderr, "Could not open %s: %s\n", recordPath, strerror(errno));
+            return 1;
+        }
+        io = new RecordingIO(&linuxIO, recording);
+    }
+#endif
     FixedMessageQueue queue;
-    Network network(&io, &queue);
+    Network network(io, &queue);
+#ifdef MICROFLO_ENABLE_TICK_STATISTICS
+    // Readable over host protocol with GetTickStatistics
+    TickStatistics tickStatistics;
+    network.setTickStatistics(&tickStatistics);
+#endif
     HostCommunication controller;
     HostTransport *transport;
 
     NullHostTransport null;
     LinuxSerialTransport serial("default.microflo");
 
+    const std::string socketPrefix = "socket:";
     if (argc >= 1) {
         const std::string path = argv[1];
-        serial = LinuxSerialTransport(path);
-        transport = &serial;
+        if (path.compare(0, socketPrefix.size(), socketPrefix) == 0) {
+            // socket:PATH, optionally also loopback TCP on port given as next argument
+            const int tcpPort = (argc >= 3) ? atoi(argv[2]) : -1;
+            transport = new LinuxSocketTransport(path.substr(socketPrefix.size()), tcpPort);
+        } else {
+            serial = LinuxSerialTransport(path);
+            transport = &serial;
+        }
     } else {
         transport = &null;
     }
 
-    transport->setup(&io, &controller);
+    transport->setup(io, &controller);
     controller.setup(&network, transport);
-    MICROFLO_LOAD_STATIC_GRAPH((&controller), graph);
-    while (1) {
+#ifdef MICROFLO_EMBED_GRAPH
+    const long bootStart = linuxIO.TimerCurrentMicros();
+    const MicroFlo::Error bootError = controller.loadGraphStream(graph, sizeof(graph));
+    fprintf(stderr, "Graph loaded in %ld us, status %d\n", linuxIO.TimerCurrentMicros()-bootStart, (int)bootError);
+#endif
+    const long runStart = linuxIO.TimerCurrentMicros();
+    // Replay gives up when the graph stops consuming the trace, like when it diverged or has no graph
+    const unsigned long replayStallTicks = 10000;
+    unsigned long stalledTicks = 0;
+    size_t replayRemaining = replay ? replay->remaining() : 0;
+    unsigned long replayDivergences = 0;
+    for (unsigned long tick = 0; ; tick++) {
         transport->runTick();
         network.runTick();
+        if (replay) {
+            // As fast as possible
+            if (replay->divergences() != replayDivergences) {
+                replayDivergences = replay->divergences();
+                fprintf(stderr, "Diverged from trace at %lu us, tick %lu\n", replay->traceMicros(), tick);
+            }
+            stalledTicks = (replay->remaining() == replayRemaining) ? stalledTicks+1 : 0;
+            replayRemaining = replay->remaining();
+            if (stalledTicks >= replayStallTicks) {
+                fprintf(stderr, "Replay stalled at %lu us, %lu bytes of trace left, %lu divergences\n",
+                        replay->traceMicros(), (unsigned long)replayRemaining, replay->divergences());
+                return 2;
+            }
+            if (replay->finished()) {
+                fprintf(stderr, "Replayed %lu us of IO in %ld us, %lu ticks, %lu divergences\n",
+                        replay->traceMicros(), linuxIO.TimerCurrentMicros()-runStart, tick+1, replay->divergences());
+                return replay->divergences() ? 2 : 0;
+            }
+            continue;
+        }
+        if (recording && (tick % 1024) == 0) {
+            fflush(recording);
+        }
+        // Handles GPIO edges, else sleeps a little
         // HACK: do some sane scheduling instead
-        usleep(1);
+        linuxIO.pollInterrupts(1);
     }
 }
 
@@ -3,89 +3,43 @@
  * MicroFlo may be freely distributed under the MIT license
  */
 
-// Embedded Linux support for MQTT and MsgFlo.org
+// Embedded Linux support for MQTT and MsgFlo.org, using libmosquitto
 
-#include "./mqtt.hpp"
+#include "./mqttmount.hpp"
 
 #include <mosquitto.h>
 
 #include <string>
-#include <vector>
 
 #include <stdlib.h>
 #include <stdint.h>
 #include <stdbool.h>
 #include <stdio.h>
-#include <unistd.h>
 #include <string.h>
-#include <assert.h>
 #include <err.h>
 
-#ifdef MICROFLO_LINUX_DEBUG
-#define LOG(...) do { printf(__VA_ARGS__); } while (0)
-#else
-#define LOG(...)
-#endif
-
-
-struct MqttOptions {
-    int brokerPort;
-    char * brokerHostname;
-    int keepaliveSeconds;
-    char * clientId;
-    ParticipantInfo info;
-    int discoveryInterval; // seconds
-};
-
-class MqttMount;
-
-
-// FIXME: write automated test
-class MqttMount : public HostCommunication {
-
+// MqttClient using libmosquitto, with its network loop on a mosquitto thread
+class MosquittoClient : public MqttClient {
 public:
-    static bool runForever(MqttMount *mount) {
-        const int timeoutMs = 10;
-
-        while(1){
-            const int status = mosquitto_loop(mount->connection, timeoutMs, 1);
-            if (status == MOSQ_ERR_CONN_LOST) {
-                mount->connect();
-            } else if (status == MOSQ_ERR_SUCCESS) {
-                // Run MicroFlo network
-                for (int i=0; i<20; i++) {
-                    mount->network->runTick();
-                }
-            } else {
-                LOG("mosquitto loop error: %s\n", mosquitto_strerror(status));
-                return false;
-            }
-
-            mount->checkSendDiscovery();
-        }
-        return true;
-    }
-
-public:
-    MqttMount(Network *net, const MqttOptions &o)
-        : HostCommunication()
-        , network(net)
-        , options(o)
+    MosquittoClient(const MqttOptions &o)
+        : options(o)
         , connection(NULL)
-        , discoveryMessageSent(0)
+        , handler(NULL)
     {
-        network->setNotificationHandler(this);
-        microfloReceiveTopic = options.info.role + "/microflo/receive";
-        microfloSendTopic = options.info.role + "/microflo/send";
     }
 
-    ~MqttMount() {
+    ~MosquittoClient() {
         mosquitto_destroy(this->connection);
         this->connection = NULL;
         (void)mosquitto_lib_cleanup();
     }
 
-    bool connect() {
+    // implements MqttClient
+    virtual void setHandler(MqttClientHandler *h) {
+        handler = h;
+    }
+
+    virtual bool connect() {
         struct mosquitto *m = mosquitto_new(options.clientId, true, this);
         this->connection = m;
 
@@ -98,137 +52,47 @@ public:
                                           options.keepaliveSeconds);
         return res == MOSQ_ERR_SUCCESS;
     }
-    void disconnect() {} // TODO: implement
 
-public:
-    // Not really public, used by C trampolines
-    void onConnect(int status) {
-        const bool connected = status == 0;
-        if (connected) {
-            subscribePorts();
-            subscribeHostTransport();
-            checkSendDiscovery();
+    virtual bool start() {
+        const int status = mosquitto_loop_start(this->connection);
+        if (status != MOSQ_ERR_SUCCESS) {
+            LOG("mosquitto loop error: %s\n", mosquitto_strerror(status));
         }
+        return status == MOSQ_ERR_SUCCESS;
     }
 
-    void onMessage(const struct mosquitto_message *msg) {
-        char *payloadStr = strndup((const char *)msg->payload, msg->payloadlen);
-        const Packet pkg = decodePacket(std::string(payloadStr));
-        LOG("got MQTT message on topic %s: %s\n", msg->topic, payloadStr);
-        free(payloadStr);
-
-        if (msg->topic == microfloReceiveTopic) {
-            // XXX: does not go via Transport
-            const char * payload = (const char *)msg->payload;
-            for (int i=0; i<msg->payloadlen; i++) {
-                this->parseByte(payload[i]);
-            }
-            return;
-        }
-
-        const Port *port = findPortByTopic(options.info.inports, msg->topic);
-        if (port) {
-            LOG("sending to %d %d \n", port->node, port->port);
-            network->sendMessageTo(port->node, port->port, pkg);
-        } else {
-            LOG("Failed to find port for MQTT topic: %s\n", msg->topic);
-        }
+    virtual void stop() {
+        mosquitto_loop_stop(this->connection, true);
     }
 
-    // implements NetworkNotificationHandler
-    virtual void packetSent(const Message &m, const Component *sender, MicroFlo::PortId senderPort) {
-        HostCommunication::packetSent(m, sender, senderPort);
-
-        const MicroFlo::NodeId senderId = sender->id();
-        //LOG("packet sent %d\n", senderId);
-
-        const Port * port = findPortByEdge(options.info.outports, senderId, senderPort);
-        if (port) {
-            const char *outTopic = port->topic.c_str();
-
-            const std::string data = encodePacket(m.pkg);
-            const int res = mosquitto_publish(this->connection, NULL, outTopic,
-                                              data.size(), data.c_str(), 0, false);
-            LOG("sending on MQTT topic %s: %s\n", outTopic, data.c_str());
-
-            if (res != MOSQ_ERR_SUCCESS) {
-                //die("publish\n");
-            }
-        } else {
-            LOG("no MQTT topic associated\n");
-        }
+    virtual bool subscribe(const char *topic, int qos) {
+        return mosquitto_subscribe(this->connection, NULL, topic, qos) == MOSQ_ERR_SUCCESS;
     }
 
-    void sendToHost(const uint8_t *buf, uint8_t len) {
+    virtual bool publish(const char *topic, const void *payload, size_t length, int qos) {
         if (!this->connection) {
-            return;
-        }
-        const int res = mosquitto_publish(this->connection, NULL,
-                            microfloSendTopic.c_str(), len, buf, 0, false);
-        
-        if (res != MOSQ_ERR_SUCCESS) {
-            LOG("failed to send microflo command on MQTT\n"); 
-        }
-    }
-
-private:
-    void subscribePorts() {
-        for (std::vector<Port>::iterator it = options.info.inports.begin() ; it != options.info.inports.end(); ++it) {
-            const Port &port = *it;
-            const char *pattern = port.topic.c_str();
-            mosquitto_subscribe(this->connection, NULL, pattern, 0);
-            LOG("subscribed inport to MQTT topic: %s\n", pattern);
-        }
-        for (std::vector<Port>::iterator it = options.info.outports.begin() ; it != options.info.outports.end(); ++it) {
-            const Port &port = *it;
-            network->subscribeToPort(port.node, port.port, true);
-            LOG("setup outport to MQTT topic: %s\n", port.topic.c_str());
-        }
-    }
-
-    void subscribeHostTransport() {
-        const char *pattern = microfloReceiveTopic.c_str();
-        mosquitto_subscribe(this->connection, NULL, pattern, 0);
-        LOG("subscribed host to MQTT topic: %s\n", pattern);
-    }
-
-    void checkSendDiscovery() {
-        const float sendInterval = options.discoveryInterval/2.5f;
-        const float secondsSinceLast = difftime(time(NULL), discoveryMessageSent); 
-        if (secondsSinceLast >= sendInterval) {
-            discoveryMessageSent = time(NULL);
-            sendDiscovery();
-        }
-    }
-
-    void sendDiscovery() {
-        const std::string msgfloDiscoveryTopic = "fbp";
-        publish(msgfloDiscoveryTopic, msgfloDiscoveryMessage(&options.info));
-        LOG("sent MsgFlo discovery message\n");
-    }
-
-    void publish(std::string topic, std::string payload) {
-        const int res = mosquitto_publish(this->connection, NULL,
-                                          topic.c_str(), payload.size(), payload.c_str(), 0, false);
-        if (res != MOSQ_ERR_SUCCESS) {
-            //die("publish\n");
+            return false;
         }
+        const int res = mosquitto_publish(this->connection, NULL, topic, length, payload, qos, false);
+        return res == MOSQ_ERR_SUCCESS;
     }
 
 private:
     // mosquitto callback trampolines
     static void on_connect(struct mosquitto *m, void *udata, int res) {
-        MqttMount *self = (MqttMount *)udata;
-        self->onConnect(res);
+        MosquittoClient *self = (MosquittoClient *)udata;
+        if (res == 0 && self->handler) {
+            self->handler->mqttConnected();
+        }
     }
 
     static void on_message(struct mosquitto *m, void *udata,
                            const struct mosquitto_message *msg) {
-        if (msg == NULL) {
+        MosquittoClient *self = (MosquittoClient *)udata;
+        if (msg == NULL || !self->handler) {
             return;
         }
-        MqttMount *self = (MqttMount *)udata;
-        self->onMessage(msg);
+        self->handler->mqttMessage(msg->topic, (const uint8_t *)msg->payload, msg->payloadlen);
     }
 
     static void on_subscribe(struct mosquitto *m, void *udata, int mid,
@@ -241,12 +105,9 @@ private:
     }
 
 private:
-    Network *network;
     MqttOptions options;
     struct mosquitto *connection;
-    time_t discoveryMessageSent;
-    std::string microfloReceiveTopic;
-    std::string microfloSendTopic;
+    MqttClientHandler *handler;
 };
 
 bool parse_brokerurl(MqttOptions *options, const char *url) {
@@ -267,15 +128,8 @@ bool parse_brokerurl(MqttOptions *options, const char *url) {
 
 bool mqttParseOptions(MqttOptions *options, int argc, char **argv) {
 
-    // defaults
+    mqttDefaultOptions(options);
     options->brokerHostname = strndup("localhost", 99);
-    options->brokerPort = 1883;
-    options->keepaliveSeconds = 60;
-    options->discoveryInterval = 60;
-    options->clientId = NULL; // MQTT will autogenerate
-    options->info.role = "micro";
-    options->info.component = "MicroFloDevice";
-    options->info.icon = "lightbulb-o";
 
     if (argc > 1) {
         options->info.role = std::string(argv[1]);
@@ -283,33 +137,43 @@ bool mqttParseOptions(MqttOptions *options, int argc, char **argv) {
 
     options->info.id = options->info.role + std::to_string(rand());
 
-    char* broker = getenv("MSGFLO_BROKER");
-    return parse_brokerurl(options, broker);
-}
-
-class LinuxMqttHostTransport : public HostTransport {
-public:
-    LinuxMqttHostTransport() {
-        
+    // Port settings, each a comma-separated list of exported port names, or "*" for all
+    const char *binaryPorts = getenv("MICROFLO_MQTT_BINARY_PORTS");
+    if (binaryPorts) {
+        options->binaryPorts = binaryPorts;
     }
-
-    // implements HostTransport
-    virtual void setup(IO *i, HostCommunication *c) {
-        mount = dynamic_cast<MqttMount *>(c);
+    const char *qos1Ports = getenv("MICROFLO_MQTT_QOS1_PORTS");
+    if (qos1Ports) {
+        options->qos1Ports = qos1Ports;
     }
-    virtual void runTick() {
-        // no-op, everything happens event-oriented
+    const char *qos2Ports = getenv("MICROFLO_MQTT_QOS2_PORTS");
+    if (qos2Ports) {
+        options->qos2Ports = qos2Ports;
+    }
+    const char *coalescePorts = getenv("MICROFLO_MQTT_COALESCE_PORTS");
+    if (coalescePorts) {
+        options->coalescePorts = coalescePorts;
     }
-    virtual void sendCommand(const uint8_t *buf, uint8_t len) {
-        // Pad to a whole command
-        uint8_t cmd[MICROFLO_CMD_SIZE];
-        for (uint8_t i=0; i<MICROFLO_CMD_SIZE; i++) {
-            cmd[i] = (i < len) ?  buf[i] : 0x00;
-        }
 
-        mount->sendToHost(cmd, MICROFLO_CMD_SIZE);
+    const char *queueLength = getenv("MICROFLO_MQTT_OUTBOUND_QUEUE");
+    if (queueLength) {
+        options->outboundQueueLength = atoi(queueLength);
+        if (options->outboundQueueLength <= 0) {
+            return false;
+        }
+    }
+    const char *dropPolicy = getenv("MICROFLO_MQTT_OUTBOUND_DROP");
+    if (dropPolicy) {
+        if (strcmp(dropPolicy, "oldest") == 0) {
+            options->outboundDropPolicy = MqttDropOldest;
+        } else if (strcmp(dropPolicy, "newest") == 0) {
+            options->outboundDropPolicy = MqttDropNewest;
+        } else {
+            return false;
+        }
     }
 
-private:
-    MqttMount *mount;
-};
+    char* broker = getenv("MSGFLO_BROKER");
+    return parse_brokerurl(options, broker);
+}
+
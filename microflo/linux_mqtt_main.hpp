@@ -5,6 +5,7 @@
 
 #include "microflo.h"
 #include "linux_mqtt.hpp"
+#include "mqttgraphports.hpp"
 
 #include "microflo.hpp"
 #include "linux.hpp"
@@ -15,31 +16,6 @@ static void die(const char *msg) {
     exit(1);
 }
 
-// TODO: introspect from Network/cmdstream instead of graph metadata
-bool findPorts(ParticipantInfo *info) {
-    // FIXME: don't assume graph data is in 'graph_*'
-
-    // Exported ports
-    for (size_t i=0; i<graph_inports_length; i++) {
-        const char *name = graph_inports_name[i];
-        MicroFlo::PortId portId = graph_inports_port[i];
-        MicroFlo::NodeId nodeId = graph_inports_node[i];
-        info->addInport(name, nodeId, portId);
-    }
-    for (size_t i=0; i<graph_outports_length; i++) {
-        const char *name = graph_outports_name[i];
-        MicroFlo::PortId portId = graph_outports_port[i];
-        MicroFlo::NodeId nodeId = graph_outports_node[i];
-        info->addOutport(name, nodeId, portId);
-    }
-
-    // Graph name
-    // TODO: replace with command stream command for graph name
-    info->component = graph_name;
-
-    return true;
-}
-
 int main(int argc, char **argv) {
     LinuxIO io;
     LinuxMqttHostTransport transport;
@@ -54,13 +30,19 @@ int main(int argc, char **argv) {
     }
 
     findPorts(&options.info);
+    mqttConfigurePorts(&options);
 
-    MqttMount mount(&network, options);
+    MosquittoClient client(options);
+    MqttMount mount(&network, &client, options);
 
     transport.setup(&io, &mount);
     mount.setup(&network, &transport);
 
-    MICROFLO_LOAD_STATIC_GRAPH((&mount), graph);
+#ifdef MICROFLO_EMBED_GRAPH
+    const long bootStart = io.TimerCurrentMicros();
+    const MicroFlo::Error bootError = mount.loadGraphStream(graph, sizeof(graph));
+    fprintf(stderr, "Graph loaded in %ld us, status %d\n", io.TimerCurrentMicros()-bootStart, (int)bootError);
+#endif
 
     const bool connected = mount.connect();
     if (connected) {
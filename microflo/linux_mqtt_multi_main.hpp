@@ -0,0 +1,99 @@
+/* MicroFlo - Flow-Based Programming for microcontrollers
+ * Copyright (c) 2013 Jon Nordby <jononor@gmail.com>
+ * MicroFlo may be freely distributed under the MIT license
+ */
+
+/* Runs many instances of the embedded graph as MsgFlo participants, in one process.
+ * Usage: firmware ROLEPREFIX INSTANCES
+ * Instance i has role ROLEPREFIX+i. All share one MQTT connection,
+ * and run on MICROFLO_MQTT_WORKERS threads (default: one per CPU) */
+
+#include "microflo.h"
+#include "linux_mqtt.hpp"
+#include "mqtthost.hpp"
+#include "mqttgraphports.hpp"
+
+#include "microflo.hpp"
+#include "linux.hpp"
+
+#ifndef MICROFLO_EMBED_GRAPH
+#error "linux-mqtt-multi needs the graph embedded, see microflo generate"
+#endif
+
+/* Fail with an error message. */
+static void die(const char *msg) {
+    fprintf(stderr, "%s", msg);
+    exit(1);
+}
+
+// One graph instance, with everything that is per-Network
+struct Tenant {
+    Tenant(MqttClient *client, const MqttOptions &options)
+        : network(&io, &queue)
+        , mount(&network, client, options)
+    {
+        transport.setup(&io, &mount);
+        mount.setup(&network, &transport);
+    }
+
+    LinuxIO io;
+    FixedMessageQueue queue;
+    Network network;
+    LinuxMqttHostTransport transport;
+    MqttMount mount;
+};
+
+int main(int argc, char **argv) {
+    MqttOptions options;
+    const bool parsed = mqttParseOptions(&options, argc, argv);
+    if (!parsed) {
+        die("options parsing error\n");
+    }
+    const std::string rolePrefix = options.info.role;
+    const int instances = (argc > 2) ? atoi(argv[2]) : 1;
+    if (instances <= 0) {
+        die("number of instances must be positive\n");
+    }
+    const char *workersEnv = getenv("MICROFLO_MQTT_WORKERS");
+    const int workers = workersEnv ? atoi(workersEnv) : (int)std::thread::hardware_concurrency();
+
+    MosquittoClient client(options);
+    MqttClientMux mux(&client);
+    MqttTenantHost host(workers, options.idleWaitMicros);
+    std::vector<Tenant *> tenants;
+
+    LinuxIO clock;
+    const long bootStart = clock.TimerCurrentMicros();
+    for (int i=0; i<instances; i++) {
+        MqttOptions tenantOptions = options;
+        tenantOptions.info.role = rolePrefix + std::to_string(i);
+        tenantOptions.info.id = tenantOptions.info.role + std::to_string(rand());
+        findPorts(&tenantOptions.info);
+        mqttConfigurePorts(&tenantOptions);
+
+        Tenant *tenant = new Tenant(mux.createChannel(), tenantOptions);
+        const MicroFlo::Error loadError = tenant->mount.loadGraphStream(graph, sizeof(graph));
+        if (loadError != MICROFLO_OK) {
+            fprintf(stderr, "Graph instance %d failed to load, status %d\n", i, (int)loadError);
+            die("graph load failure\n");
+        }
+        host.add(&tenant->mount);
+        tenant->mount.connect();
+        tenants.push_back(tenant);
+    }
+    fprintf(stderr, "%d graph instances loaded in %ld us\n", instances, clock.TimerCurrentMicros()-bootStart);
+
+    if (mux.connect() && mux.start()) {
+        printf("Connected to %s:%d\n", options.brokerHostname, options.brokerPort);
+        fflush(stdout);
+    } else {
+        die("connect() failure\n");
+    }
+
+    host.run();
+    mux.stop();
+    for (size_t i=0; i<tenants.size(); i++) {
+        delete tenants[i];
+    }
+    return 0;
+}
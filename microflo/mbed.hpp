@@ -8,19 +8,74 @@
 #include <mbed.h>
 
 
-class MbedIO : public IO {
+class MbedIO MICROFLO_IO_FINAL : public IO {
 public:
 
 
+private:
+    // Pins of a BusOut/BusIn, unused ones are NC
+    struct BusPins {
+        PinName names[16];
+
+        void set(const MicroFlo::PinId *pins, uint8_t count) {
+            for (uint8_t i=0; i<16; i++) {
+                names[i] = (i < count) ? (PinName)pins[i] : NC;
+            }
+        }
+        bool matches(const MicroFlo::PinId *pins, uint8_t count) const {
+            for (uint8_t i=0; i<16; i++) {
+                if (names[i] != ((i < count) ? (PinName)pins[i] : NC)) {
+                    return false;
+                }
+            }
+            return true;
+        }
+    };
+
+    // Buses are kept for the last pin list used, and only rebuilt when it changes
+    BusOut *busOut(const MicroFlo::PinId *pins, uint8_t count) {
+        if (!outBus || !outBusPins.matches(pins, count)) {
+            delete outBus;
+            outBusPins.set(pins, count);
+            outBus = new BusOut(outBusPins.names);
+        }
+        return outBus;
+    }
+    BusIn *busIn(const MicroFlo::PinId *pins, uint8_t count) {
+        if (!inBus || !inBusPins.matches(pins, count)) {
+            delete inBus;
+            inBusPins.set(pins, count);
+            inBus = new BusIn(inBusPins.names);
+        }
+        return inBus;
+    }
+
 private:
     Timer timer;
     Serial usbSerial;
+    BusOut *outBus;
+    BusPins outBusPins;
+    BusIn *inBus;
+    BusPins inBusPins;
 public:
     MbedIO()
         : usbSerial(USBTX, USBRX)
+        , outBus(NULL)
+        , inBus(NULL)
     {
         timer.start();
     }
+    ~MbedIO() {
+        delete outBus;
+        delete inBus;
+    }
+
+private:
+    // Owns buses, not copyable
+    MbedIO(const MbedIO &);
+    MbedIO &operator=(const MbedIO &);
+
+public:
 
     // Serial
     virtual void SerialBegin(uint8_t serialDevice, int baudrate) {
@@ -64,6 +119,19 @@ public:
     virtual bool DigitalRead(MicroFlo::PinId pin) {
         return DigitalIn((PinName)pin).read();
     }
+    // Up to 16 pins through one BusOut/BusIn, which mbed writes per port
+    virtual void DigitalWriteMany(const MicroFlo::PinId *pins, uint8_t count, uint32_t values) {
+        if (count > 16) {
+            return IO::DigitalWriteMany(pins, count, values);
+        }
+        busOut(pins, count)->write(values & 0xFFFF);
+    }
+    virtual uint32_t DigitalReadMany(const MicroFlo::PinId *pins, uint8_t count) {
+        if (count > 16) {
+            return IO::DigitalReadMany(pins, count);
+        }
+        return busIn(pins, count)->read();
+    }
 
     // Analog
     // FIXME: implement
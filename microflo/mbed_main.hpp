@@ -27,6 +27,14 @@ void operator delete(void * p, size_t n)
 {
   free(p);
 }
+void *operator new[](size_t n)
+{
+  return malloc(n);
+}
+void operator delete[](void * p)
+{
+  free(p);
+}
 
 extern "C"
 {
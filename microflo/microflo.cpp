@@ -10,7 +10,7 @@
 
 
 #define MICROFLO_VALID_NODEID(id) \
-   (id >= Network::firstNodeId && id <= lastAddedNodeIndex)
+   (id >= Network::firstNodeId && id < lastAddedNodeIndex)
 
 #ifdef HOST_BUILD
 #include <cstring>
@@ -69,8 +69,24 @@ HostCommunication::HostCommunication()
     , currentByte(0)
     , state(LookForHeader)
     , debugLevel(DebugLevelError)
+    , protocolVersion(1)
+    , frameLength(0)
+    , frameCrc(0)
+    , batchLength(0)
+    , batchOverflows(0)
+    , image(0)
+    , imageLength(0)
+    , imageReceived(0)
+    , imageRequestId(0)
+    , imageReturnState(LookForHeader)
+    , silent(false)
+    , silentError(MICROFLO_OK)
 {}
 
+HostCommunication::~HostCommunication() {
+    delete[] image;
+}
+
 void HostCommunication::setup(Network *net, HostTransport *t) {
     network = net;
     transport = t;
@@ -85,14 +101,135 @@ bool HostCommunication::checkRespondMagic() {
     const uint8_t requestId = buffer[MICROFLO_CMD_SIZE-1];
     if (matches) {
         MICROFLO_DEBUG(this, DebugLevelDetailed, DebugMagicMatched);
-        const uint8_t cmd[] = { requestId, GraphCmdCommunicationOpen };
-        transport->sendCommand(cmd, sizeof(cmd));
+        // Always starts out in version 1, host can then request a newer one
+        resetProtocolVersion();
+        const uint8_t cmd[] = { requestId, GraphCmdCommunicationOpen,
+                                MICROFLO_PROTOCOL_VERSION, MICROFLO_HOST_WINDOW,
+                                MICROFLO_FEATURE_GRAPH_IMAGE };
+        send(cmd, sizeof(cmd));
     }
     return matches;
 }
 
+// CRC-8, polynomial 0x07
+static uint8_t crc8Update(uint8_t crc, uint8_t data) {
+    crc ^= data;
+    for (uint8_t i=0; i<8; i++) {
+        crc = (crc & 0x80) ? (uint8_t)((crc << 1) ^ 0x07) : (uint8_t)(crc << 1);
+    }
+    return crc;
+}
+
+void HostCommunication::send(const uint8_t *cmd, uint8_t len) {
+    if (silent) {
+        if (len >= 3 && cmd[1] == GraphCmdError && silentError == MICROFLO_OK) {
+            silentError = (MicroFlo::Error)cmd[2];
+        }
+        return;
+    }
+
+    if (protocolVersion >= 2) {
+        if (len > MICROFLO_FRAME_MAXSIZE) {
+            len = MICROFLO_FRAME_MAXSIZE;
+        }
+        uint8_t frame[MICROFLO_FRAME_MAXSIZE+3];
+        frame[0] = MICROFLO_FRAME_START;
+        frame[1] = len;
+        uint8_t crc = crc8Update(0, len);
+        for (uint8_t i=0; i<len; i++) {
+            frame[2+i] = cmd[i];
+            crc = crc8Update(crc, cmd[i]);
+        }
+        frame[2+len] = crc;
+        transport->sendCommand(frame, len+3);
+    } else {
+        // Make sure to pad to the cmd size
+        uint8_t padded[MICROFLO_CMD_SIZE];
+        for (uint8_t i=0; i<MICROFLO_CMD_SIZE; i++) {
+            padded[i] = (i < len) ? cmd[i] : 0x00;
+        }
+        transport->sendCommand(padded, MICROFLO_CMD_SIZE);
+    }
+}
+
+void HostCommunication::parseFrameByte(uint8_t b) {
+
+    if (state == LookForFrame) {
+        if (b == MICROFLO_FRAME_START) {
+            state = ParseFrameLength;
+        } else if (b == (uint8_t)MICROFLO_GRAPH_MAGIC[0]) {
+            // Host reconnecting, starts over in version 1
+            state = ParseHeader;
+            buffer[0] = b;
+            currentByte = 1;
+        }
+    } else if (state == ParseFrameLength) {
+        if (b < 2 || b > MICROFLO_FRAME_MAXSIZE) {
+            MICROFLO_DEBUG(this, DebugLevelError, DebugFrameInvalidLength);
+            state = LookForFrame;
+            return;
+        }
+        frameLength = b;
+        frameCrc = crc8Update(0, b);
+        currentByte = 0;
+        state = ParseFrameCmd;
+    } else if (state == ParseFrameCmd) {
+        buffer[currentByte++] = b;
+        frameCrc = crc8Update(frameCrc, b);
+        if (currentByte == frameLength) {
+            state = ParseFrameCrc;
+        }
+    } else if (state == ParseFrameCrc) {
+        state = LookForFrame;
+        if (b == frameCrc) {
+            // Commands shorter than MICROFLO_CMD_SIZE have implicit trailing zeros
+            for (uint8_t i=frameLength; i<MICROFLO_FRAME_MAXSIZE; i++) {
+                buffer[i] = 0;
+            }
+            parseCmd();
+        } else {
+            MICROFLO_DEBUG(this, DebugLevelError, DebugFrameChecksumMismatch);
+        }
+        currentByte = 0;
+    }
+}
+
+void HostCommunication::parseGraphImageByte(uint8_t b) {
+    if (image) {
+        image[imageReceived] = b;
+    }
+    imageReceived++;
+    if (imageReceived < imageLength) {
+        return;
+    }
+
+    state = imageReturnState;
+    currentByte = 0;
+    const uint8_t requestId = imageRequestId;
+    const MicroFlo::Error e = image ? loadGraphImage(image, imageLength) : DebugGraphImageAllocationFailed;
+    if (e == MICROFLO_OK) {
+        const uint8_t response[] = { requestId, GraphCmdGraphImageLoaded, image[4], image[5], image[6] };
+        send(response, sizeof(response));
+    } else {
+        const uint8_t err[] = { requestId, GraphCmdError, (uint8_t)e };
+        send(err, sizeof(err));
+    }
+    delete[] image;
+    image = NULL;
+}
+
 void HostCommunication::parseByte(char b) {
 
+    if (state == ParseGraphImage) {
+        parseGraphImageByte((uint8_t)b);
+        return;
+    }
+
+    if (state >= LookForFrame) {
+        parseFrameByte((uint8_t)b);
+        return;
+    }
+
     buffer[currentByte++] = b;
 
     if (state == ParseHeader) {
@@ -130,7 +267,7 @@ void HostCommunication::parseByte(char b) {
         MICROFLO_DEBUG(this, DebugLevelError, DebugParserInvalidState);
         // try to recover
         currentByte = 0;
-        state = LookForHeader;
+        state = (protocolVersion >= 2) ? LookForFrame : LookForHeader;
     } else {
         MICROFLO_DEBUG(this, DebugLevelError,DebugParserUnknownState);
         // try to recover
@@ -139,6 +276,34 @@ void HostCommunication::parseByte(char b) {
     }
 }
 
+void HostCommunication::parseBytes(const uint8_t *buf, size_t length) {
+    size_t i = 0;
+    while (i < length) {
+        const size_t remaining = length-i;
+        if (state == ParseGraphImage && image) {
+            // Last byte goes through parseGraphImageByte(), which then loads the image
+            const size_t missing = imageLength-imageReceived-1;
+            const size_t n = (remaining < missing) ? remaining : missing;
+            if (n > 0) {
+                memcpy(image+imageReceived, buf+i, n);
+                imageReceived += n;
+                i += n;
+            } else {
+                parseGraphImageByte(buf[i++]);
+            }
+        } else if (state == ParseCmd && currentByte == 0 && remaining >= MICROFLO_CMD_SIZE) {
+            MICROFLO_DEBUG(this, DebugLevelVeryDetailed, DebugParseCommand);
+            memcpy(buffer, buf+i, MICROFLO_CMD_SIZE);
+            i += MICROFLO_CMD_SIZE;
+            if (!checkRespondMagic()) {
+                parseCmd();
+            }
+        } else {
+            parseByte(buf[i++]);
+        }
+    }
+}
+
 void HostCommunication::respondStartStop(uint8_t requestId) {
     const Network::State state = network->currentState();
     uint8_t status;
@@ -148,7 +313,7 @@ void HostCommunication::respondStartStop(uint8_t requestId) {
         status = GraphCmdNetworkStopped;
     }
     uint8_t cmd[] = { requestId, status };
-    transport->sendCommand(cmd, sizeof(cmd));
+    send(cmd, sizeof(cmd));
 }
 
 
@@ -180,7 +345,7 @@ do { \
     const MicroFlo::Error e = (expr);\
     if (e != 0) { \
         const uint8_t err[] = { requestId, GraphCmdError, (uint8_t)e }; \
-        transport->sendCommand(err, sizeof(err)); \
+        send(err, sizeof(err)); \
         return; \
     } \
 } while(0)
@@ -194,13 +359,27 @@ void HostCommunication::parseCmd() {
     if (cmd == GraphCmdEnd) {
         MICROFLO_DEBUG(this, DebugLevelDetailed, DebugEndOfTransmission);
         const uint8_t response[] = { requestId, GraphCmdTransmissionEnded };
-        transport->sendCommand(response, sizeof(response));
+        send(response, sizeof(response));
         state = LookForHeader;
+        resetProtocolVersion();
+
+    } else if (cmd == GraphCmdSetProtocolVersion) {
+        const uint8_t version = args[0];
+        CHECK_ERROR((version >= 1 && version <= MICROFLO_PROTOCOL_VERSION) ? MICROFLO_OK : DebugProtocolVersionUnsupported);
+        // Response is sent using the old version, everything after using the new
+        const uint8_t response[] = { requestId, GraphCmdProtocolVersionChanged, version };
+        send(response, sizeof(response));
+        if (version < 2) {
+            resetProtocolVersion();
+        } else {
+            protocolVersion = version;
+        }
+        state = (version >= 2) ? LookForFrame : ParseCmd;
 
     } else if (cmd == GraphCmdClearNodes) {
         CHECK_ERROR(network->clearNodes());
         const uint8_t response[] = { requestId, GraphCmdNodesCleared };
-        transport->sendCommand(response, sizeof(response));
+        send(response, sizeof(response));
 
     } else if (cmd == GraphCmdStopNetwork) {
         CHECK_ERROR(network->stop());
@@ -210,28 +389,43 @@ void HostCommunication::parseCmd() {
         CHECK_ERROR(network->start());
         respondStartStop(requestId);
 
+    } else if (cmd == GraphCmdGetTickStatistics) {
+        // args: series, statistic, reset after reading
+        uint32_t value = 0;
+        CHECK_ERROR(network->getTickStatistic(args[0], args[1], &value));
+        if (args[2]) {
+            network->resetTickStatistics();
+        }
+        const uint8_t response[] = { requestId, GraphCmdTickStatistics, args[0], args[1],
+                    (uint8_t)(value & 0xFF), (uint8_t)((value >> 8) & 0xFF),
+                    (uint8_t)((value >> 16) & 0xFF), (uint8_t)((value >> 24) & 0xFF) };
+        send(response, sizeof(response));
+
     } else if (cmd == GraphCmdGetNetworkStatus) {
         const uint8_t running = network->currentState() == Network::Running ? 1 : 0;
         const uint8_t response[] = { requestId, GraphCmdNetworkStatus, running };
-        transport->sendCommand(response, sizeof(response));
+        send(response, sizeof(response));
 
     } else if (cmd == GraphCmdCreateComponent) {
         const MicroFlo::ComponentId componentId = (MicroFlo::ComponentId)args[0];
         const MicroFlo::NodeId parentId = args[1];
+        // Number of ports in use. Lets subgraphs and components with many ports use less memory
+        const MicroFlo::PortId inPorts = args[2];
+        const MicroFlo::PortId outPorts = args[3];
 
         MICROFLO_DEBUG(this, DebugLevelDetailed, DebugComponentCreateStart);
         Component *c = createComponent(componentId);
         MICROFLO_DEBUG(this, DebugLevelDetailed, DebugComponentCreateEnd);
 
-        CHECK_ERROR(network->addNode(c, parentId, NULL));
+        CHECK_ERROR(network->addNode(c, parentId, NULL, inPorts, outPorts));
         const uint8_t response[] = { requestId, GraphCmdNodeAdded, c->component(), c->id(), parentId };
-        transport->sendCommand(response, sizeof(response));
+        send(response, sizeof(response));
 
     } else if (cmd == GraphCmdRemoveNode) {
         const MicroFlo::NodeId nodeId = args[0];
         CHECK_ERROR(network->removeNode(nodeId));
         const uint8_t response[] = { requestId, GraphCmdNodeRemoved, nodeId };
-        transport->sendCommand(response, sizeof(response));
+        send(response, sizeof(response));
 
     } else if (cmd == GraphCmdConnectNodes) {
         const MicroFlo::NodeId srcId = args[0];
@@ -242,7 +436,7 @@ void HostCommunication::parseCmd() {
         CHECK_ERROR(network->connect(srcId, srcPort, targetId, targetPort));
         const uint8_t response[] = { requestId, GraphCmdNodesConnected,
                                      srcId, (uint8_t)srcPort, targetId, (uint8_t)targetPort };
-        transport->sendCommand(response, sizeof(response));
+        send(response, sizeof(response));
 
     } else if (cmd == GraphCmdDisconnectNodes) {
         const MicroFlo::NodeId srcId = args[0];
@@ -252,7 +446,7 @@ void HostCommunication::parseCmd() {
         CHECK_ERROR(network->disconnect(srcId, srcPort, targetId, targetPort));
         const uint8_t response[] = { requestId, GraphCmdNodesDisconnected,
                                     srcId, (uint8_t)srcPort, targetId, (uint8_t)targetPort };
-        transport->sendCommand(response, sizeof(response));
+        send(response, sizeof(response));
 
     } else if (cmd == GraphCmdSendPacket) {
         const MicroFlo::NodeId node = args[0];
@@ -260,20 +454,24 @@ void HostCommunication::parseCmd() {
         const Packet pkg = parsePacket(args+2);
         CHECK_ERROR(network->sendMessageTo(node, port, pkg));
         const uint8_t response[] = { requestId, GraphCmdSendPacketDone, node, (uint8_t)port, (uint8_t)pkg.type() };
-        transport->sendCommand(response, sizeof(response));
+        send(response, sizeof(response));
 
     } else if (cmd == GraphCmdConfigureDebug) {
         debugLevel = (DebugLevel)args[0];
         const uint8_t response[] = { requestId, GraphCmdDebugChanged, (uint8_t)debugLevel};
-        transport->sendCommand(response, sizeof(response));
+        send(response, sizeof(response));
 
     } else if (cmd == GraphCmdSubscribeToPort) {
         const MicroFlo::NodeId nodeId = args[0];
         const MicroFlo::PortId portId = args[1];
         const bool enable = (bool)args[2];
-        CHECK_ERROR(network->subscribeToPort(nodeId, portId, enable));
+        // Optional, 0 means notify every packet
+        const SubscriptionMode mode = (SubscriptionMode)args[3];
+        const uint16_t parameter = args[4] + ((uint16_t)args[5]<<8);
+        CHECK_ERROR(network->subscribeToPort(nodeId, portId, enable, mode, parameter));
+        portSubscriptionChanged(nodeId, portId, enable);
         const uint8_t response[] = { requestId, GraphCmdPortSubscriptionChanged, nodeId, (uint8_t)portId, enable};
-        transport->sendCommand(response, sizeof(response));
+        send(response, sizeof(response));
 
     } else if (cmd == GraphCmdConnectSubgraphPort) {
 #ifdef MICROFLO_ENABLE_SUBGRAPHS
@@ -286,15 +484,26 @@ void HostCommunication::parseCmd() {
         CHECK_ERROR(network->connectSubgraph(isOutput, subgraphNode, subgraphPort, childNode, childPort));
         const uint8_t response[] = { requestId, GraphCmdSubgraphPortConnected,
                 isOutput, subgraphNode, (uint8_t)subgraphPort, childNode, (uint8_t)childPort };
-        transport->sendCommand(response, sizeof(response));
+        send(response, sizeof(response));
 #else
         MICROFLO_DEBUG(this, DebugLevelError, DebugNotSupported);
 #endif
 
+    } else if (cmd == GraphCmdLoadGraphImage) {
+        // Image follows as raw bytes. They are always consumed, so an error does not desync the parser
+        const uint16_t length = args[0] + ((uint16_t)args[1]<<8);
+        CHECK_ERROR((length > 0) ? MICROFLO_OK : DebugGraphImageInvalid);
+        image = new uint8_t[length];
+        imageLength = length;
+        imageReceived = 0;
+        imageRequestId = requestId;
+        imageReturnState = (protocolVersion >= 2) ? LookForFrame : ParseCmd;
+        state = ParseGraphImage;
+
     } else if (cmd == GraphCmdPing) {
         const uint8_t response[] = { requestId, GraphCmdPong,
                     args[0], args[1], args[2], args[3], args[4], args[5], args[6], args[7] };
-        transport->sendCommand(response, sizeof(response));
+        send(response, sizeof(response));
 
     } else if (cmd == GraphCmdSetIoValue) {
         network->setIoValue(args, MICROFLO_CMD_SIZE-2);
@@ -310,10 +519,178 @@ void HostCommunication::parseCmd() {
 
 #undef CHECK_ERROR
 
+static uint8_t readRam(const uint8_t *address) {
+    return *address;
+}
+
+MicroFlo::Error HostCommunication::loadGraphStream(const uint8_t *stream, size_t length,
+                                                  MicroFloReadByteFunction read) {
+    if (!read) {
+        read = readRam;
+    }
+    silent = true;
+    silentError = MICROFLO_OK;
+    state = ParseCmd;
+    resetProtocolVersion();
+
+    size_t offset = 0;
+    while (offset < length && silentError == MICROFLO_OK) {
+        if (state == ParseGraphImage) {
+            parseGraphImageByte(read(stream+offset));
+            offset++;
+            continue;
+        }
+        if (offset+MICROFLO_CMD_SIZE > length) {
+            silentError = DebugParserInvalidCommand;
+            break;
+        }
+        for (uint8_t i=0; i<MICROFLO_CMD_SIZE; i++) {
+            buffer[i] = read(stream+offset+i);
+        }
+        offset += MICROFLO_CMD_SIZE;
+        // Magic only opens communication with host, not needed here
+        if (memcmp(buffer, MICROFLO_GRAPH_MAGIC, sizeof(MICROFLO_GRAPH_MAGIC)) != 0) {
+            parseCmd();
+        }
+    }
+
+    if (state == ParseGraphImage) {
+        delete[] image;
+        image = NULL;
+        if (silentError == MICROFLO_OK) {
+            silentError = DebugGraphImageInvalid;
+        }
+    }
+    // Host must still open communication with the magic
+    state = LookForHeader;
+    resetProtocolVersion();
+    currentByte = 0;
+    silent = false;
+    return silentError;
+}
+
+MicroFlo::Error HostCommunication::loadGraphImage(const uint8_t *img, uint16_t length) {
+    MICROFLO_RETURN_VAL_IF_FAIL(length >= MICROFLO_GRAPH_IMAGE_HEADER_SIZE, DebugGraphImageInvalid);
+    MICROFLO_RETURN_VAL_IF_FAIL(img[0] == 'M' && img[1] == 'G' && img[2] == MICROFLO_GRAPH_IMAGE_VERSION,
+                                DebugGraphImageInvalid);
+    const uint8_t flags = img[3];
+    const uint8_t nodeCount = img[4];
+    const uint8_t edgeCount = img[5];
+    const uint8_t iipCount = img[6];
+    const uint8_t *nodes = img + MICROFLO_GRAPH_IMAGE_HEADER_SIZE;
+    const uint8_t *edges = nodes + nodeCount*MICROFLO_GRAPH_IMAGE_NODE_SIZE;
+    const uint8_t *iips = edges + edgeCount*MICROFLO_GRAPH_IMAGE_EDGE_SIZE;
+    const uint8_t *end = iips + iipCount*MICROFLO_GRAPH_IMAGE_IIP_SIZE;
+    MICROFLO_RETURN_VAL_IF_FAIL(end == img+length, DebugGraphImageInvalid);
+
+    uint8_t crc = 0;
+    for (const uint8_t *p = nodes; p < end; p++) {
+        crc = crc8Update(crc, *p);
+    }
+    MICROFLO_RETURN_VAL_IF_FAIL(crc == img[7], DebugGraphImageChecksumMismatch);
+
+    // Validate references up front, so a bad image never leaves a half-built graph
+    const MicroFlo::NodeId firstId = Network::firstNodeId;
+    MICROFLO_RETURN_VAL_IF_FAIL(firstId+nodeCount <= MICROFLO_MAX_NODES, DebugGraphImageInvalid);
+    for (uint8_t i=0; i<nodeCount; i++) {
+        const MicroFlo::NodeId parentId = nodes[i*MICROFLO_GRAPH_IMAGE_NODE_SIZE+1];
+        MICROFLO_RETURN_VAL_IF_FAIL(parentId == 0 || (parentId >= firstId && parentId < firstId+i),
+                                    DebugGraphImageInvalid);
+    }
+    for (uint8_t i=0; i<edgeCount; i++) {
+        const uint8_t *e = edges + i*MICROFLO_GRAPH_IMAGE_EDGE_SIZE;
+        MICROFLO_RETURN_VAL_IF_FAIL(e[0] >= firstId && e[0] < firstId+nodeCount, DebugGraphImageInvalid);
+        MICROFLO_RETURN_VAL_IF_FAIL(e[1] >= firstId && e[1] < firstId+nodeCount, DebugGraphImageInvalid);
+        MICROFLO_RETURN_VAL_IF_FAIL(e[3] < MICROFLO_MAX_PORTS, DebugGraphImageInvalid);
+    }
+    for (uint8_t i=0; i<iipCount; i++) {
+        const uint8_t *p = iips + i*MICROFLO_GRAPH_IMAGE_IIP_SIZE;
+        MICROFLO_RETURN_VAL_IF_FAIL(p[0] >= firstId && p[0] < firstId+nodeCount, DebugGraphImageInvalid);
+        MICROFLO_RETURN_VAL_IF_FAIL(p[1] < MICROFLO_MAX_PORTS, DebugGraphImageInvalid);
+    }
+
+    // Components are created before the current graph is cleared, as unknown ids and
+    // ports only show up then. Anything not handed over to Network is deleted on error
+    Component *created[MICROFLO_MAX_NODES] = { NULL };
+    MicroFlo::Error err = MICROFLO_OK;
+    for (uint8_t i=0; i<nodeCount; i++) {
+        const MicroFlo::ComponentId component = nodes[i*MICROFLO_GRAPH_IMAGE_NODE_SIZE];
+        created[i] = (err == MICROFLO_OK) ? createComponent(component) : NULL;
+        if (!created[i]) {
+            err = DebugGraphImageInvalid;
+        }
+    }
+    for (uint8_t i=0; err == MICROFLO_OK && i<edgeCount; i++) {
+        const uint8_t *e = edges + i*MICROFLO_GRAPH_IMAGE_EDGE_SIZE;
+        if (e[2] >= created[e[0]-firstId]->outPorts()) {
+            err = DebugGraphImageInvalid;
+        }
+    }
+    if (err != MICROFLO_OK) {
+        for (uint8_t i=0; i<nodeCount; i++) {
+            delete created[i];
+        }
+        return err;
+    }
+
+    network->stop();
+    err = network->clearNodes();
+    uint8_t added = 0;
+    while (err == MICROFLO_OK && added<nodeCount) {
+        const uint8_t *n = nodes + added*MICROFLO_GRAPH_IMAGE_NODE_SIZE;
+        err = network->addNode(created[added], n[1], NULL, n[2], n[3]);
+        if (err == MICROFLO_OK) {
+            added++;
+        }
+    }
+    for (uint8_t i=added; i<nodeCount; i++) {
+        delete created[i];
+    }
+    for (uint8_t i=0; err == MICROFLO_OK && i<edgeCount; i++) {
+        const uint8_t *e = edges + i*MICROFLO_GRAPH_IMAGE_EDGE_SIZE;
+        err = network->connect(e[0], e[2], e[1], e[3]);
+    }
+    for (uint8_t i=0; err == MICROFLO_OK && i<iipCount; i++) {
+        const uint8_t *p = iips + i*MICROFLO_GRAPH_IMAGE_IIP_SIZE;
+        err = network->sendMessageTo(p[0], p[1], parsePacket(p+2));
+    }
+    if (err != MICROFLO_OK) {
+        // For instance out of memory. Do not leave a partial graph behind
+        network->clearNodes();
+        return err;
+    }
+
+    if (flags & MICROFLO_GRAPH_IMAGE_START) {
+        err = network->start();
+    }
+    return err;
+}
+
+Component::~Component() {
+    if (ownsConnections) {
+        delete[] connections;
+    }
+}
+
 void Component::setComponentId(MicroFlo::ComponentId id) {
     componentId = id;
 }
 
+bool Component::allocateConnections(MicroFlo::PortId usedPorts) {
+    if (connections || ownsConnections) {
+        return true; // fixed set of ports, or already allocated
+    }
+    if (usedPorts > 0 && usedPorts < nPorts) {
+        nPorts = usedPorts;
+    }
+    if (nPorts <= 0) {
+        return true;
+    }
+    connections = new Connection[nPorts];
+    ownsConnections = true;
+    return connections != NULL;
+}
+
 void Component::send(Packet out, MicroFlo::PortId port) {
     MICROFLO_ASSERT(port < nPorts,
                     network->notificationHandler, DebugLevelError, DebugComponentSendInvalidPort);
@@ -330,9 +707,10 @@ void Component::disconnect(MicroFlo::PortId outPort, Component *target, MicroFlo
     connections[outPort].target = NULL;
     connections[outPort].targetPort = -2;
     connections[outPort].subscribed = false;
+    network->removeSubscriptionFilters(nodeId, outPort);
 }
 
-void Component::setNetwork(Network *net, int n, IO *i) {
+void Component::setNetwork(Network *net, int n, ComponentIO *i) {
     parentNodeId = 0; // no parent
     network = net;
     nodeId = n;
@@ -344,33 +722,45 @@ void Component::setNetwork(Network *net, int n, IO *i) {
     }
 }
 
-Network::Network(IO *io, MessageQueue *m)
+Network::Network(ComponentIO *io, MessageQueue *m)
     : lastAddedNodeIndex(Network::firstNodeId)
     , messageQueue(m)
     , notificationHandler(0)
     , io(io)
     , state(Reset)
+    , messagesPending(false)
+    , wakeupRequested(false)
+    , wakeupTimeMs(0)
+#ifdef MICROFLO_ENABLE_TICK_STATISTICS
+    , tickStatistics(0)
+#endif
 {
     for (int i=0; i<MICROFLO_MAX_NODES; i++) {
         nodes[i] = 0;
     }
+#ifdef MICROFLO_ENABLE_SUBGRAPHS
+    removeSubgraphRoutes(NULL, -1);
+#endif
+    removeSubscriptionFilters(0, -1);
 }
 
 void Network::setNotificationHandler(NetworkNotificationHandler *handler) {
     notificationHandler = handler;
-    io->debug = handler;
+    io->setDebugHandler(handler);
 }
 
 void Network::processMessages() {
     Message msg;
     messageQueue->newTick();
+    messagesPending = false;
 
     while (messageQueue->pop(msg)) {
         Component *sender = 0;
         MicroFlo::PortId senderPort = resolveMessageTarget(msg, &sender);
 
         // send notification first, so we can listen also to ports for which there is no connections. For testing/MQTT etc
-        const bool sendNotification = sender ? sender->connections[senderPort].subscribed : false;
+        const bool subscribed = sender ? sender->connections[senderPort].subscribed : false;
+        const bool sendNotification = subscribed && subscriptionFilterPasses(sender, senderPort, msg.pkg);
         if (sendNotification && notificationHandler) {
             notificationHandler->packetSent(msg, sender, senderPort);
         }
@@ -385,34 +775,10 @@ void Network::processMessages() {
 
         target->process(msg.pkg, msg.port);
     }
-}
 
-void Network::resolveMessageSubgraph(Message &msg, const Component *sender)
-{
-#ifdef MICROFLO_ENABLE_SUBGRAPHS
-    // Note: Assumes msg is target referred
-    Component *target = nodes[msg.node];
-    MicroFlo::PortId targetPort = msg.port;
-    const bool senderIsChild = sender && sender->parentNodeId >= Network::firstNodeId;
-    if (senderIsChild) {
-        SubGraph *parent = (SubGraph *)nodes[sender->parentNodeId];
-        if (target == parent) {
-            // Redirect output message from child outport, emit message on the parent outport
-            // FIXME: should we change @sender / @senderPort, for debugging?
-            msg.node = parent->outputConnections[targetPort].target->id();
-            msg.port = parent->outputConnections[targetPort].targetPort;
-        }
-    }
-
-    const bool targetIsSubGraph = target->componentId == MicroFlo::IdSubGraph;
-    if (targetIsSubGraph) {
-        SubGraph *targetSubGraph = (SubGraph *)target;
-        // Redirect input message from, send to desired port on child
-        // FIXME: should we change @sender / @senderPort, for debugging?
-        msg.node = targetSubGraph->inputConnections[targetPort].target->id();
-        msg.port = targetSubGraph->inputConnections[targetPort].targetPort;
+    if (notificationHandler) {
+        notificationHandler->messagesProcessed();
     }
-#endif
 }
 
 MicroFlo::PortId
@@ -422,6 +788,7 @@ Network::resolveMessageTarget(Message &msg, Component **out_sender)
     if (!msg.targetReferred) {
         *out_sender = nodes[msg.node];
         senderPort = msg.port;
+        // Note: subgraph boundaries are resolved on connect, so target is always a leaf node
         Connection &conn = (*out_sender)->connections[msg.port];
         if (conn.target) {
             msg.node = conn.target->id();
@@ -429,12 +796,89 @@ Network::resolveMessageTarget(Message &msg, Component **out_sender)
             msg.targetReferred = true;
         }
     }
-    if (msg.targetReferred) {
-        resolveMessageSubgraph(msg, *out_sender);
-    }
     return senderPort;
 }
 
+#ifdef MICROFLO_ENABLE_SUBGRAPHS
+// Follow @target across subgraph boundaries until reaching a normal node.
+// Returns NULL if the route ends in a subgraph port that is not connected.
+Component *
+Network::resolveSubgraphTarget(const Component *sender, Component *target, MicroFlo::PortId *port)
+{
+    // Bounded, in case the subgraph connections form a cycle
+    for (int depth=0; depth<MICROFLO_MAX_NODES; depth++) {
+        if (!target || target->componentId != MicroFlo::IdSubGraph) {
+            return target;
+        }
+        SubGraph *subgraph = (SubGraph *)target;
+        const MicroFlo::PortId subgraphPort = *port;
+        // From a child: continue on the edge connected to the subgraph outport
+        // From outside: continue to the child which the inport is exported from
+        const bool leaving = sender && sender->parentNodeId == subgraph->id();
+        const MicroFlo::PortId ports = leaving ? subgraph->nPorts : subgraph->nInPorts;
+        if (subgraphPort < 0 || subgraphPort >= ports) {
+            return NULL;
+        }
+        const Connection &next = leaving ? subgraph->connections[subgraphPort]
+                                         : subgraph->inputConnections[subgraphPort];
+        sender = subgraph;
+        target = next.target;
+        *port = next.targetPort;
+    }
+    return NULL;
+}
+
+MicroFlo::Error Network::setSubgraphRoute(Component *src, MicroFlo::PortId srcPort,
+                                          Component *target, MicroFlo::PortId targetPort) {
+    SubGraphRoute *free = NULL;
+    for (int i=0; i<MICROFLO_MAX_SUBGRAPH_ROUTES; i++) {
+        SubGraphRoute &route = subgraphRoutes[i];
+        if (route.source == src && route.sourcePort == srcPort) {
+            free = &route; // replaces existing edge from this port
+            break;
+        } else if (!route.source && !free) {
+            free = &route;
+        }
+    }
+    MICROFLO_RETURN_VAL_IF_FAIL(free, DebugSubGraphRouteLimitReached);
+
+    free->source = src;
+    free->sourcePort = srcPort;
+    free->target = target;
+    free->targetPort = targetPort;
+    return MICROFLO_OK;
+}
+
+// Forget route from @srcPort of @node, or all routes to/from @node if @srcPort is -1
+void Network::removeSubgraphRoutes(const Component *node, MicroFlo::PortId srcPort) {
+    for (int i=0; i<MICROFLO_MAX_SUBGRAPH_ROUTES; i++) {
+        SubGraphRoute &route = subgraphRoutes[i];
+        const bool matches = (srcPort < 0) ? (!node || route.source == node || route.target == node)
+                                           : (route.source == node && route.sourcePort == srcPort);
+        if (matches) {
+            route.source = NULL;
+            route.sourcePort = -1;
+            route.target = NULL;
+            route.targetPort = -1;
+        }
+    }
+}
+
+// Point each edge that goes via subgraphs directly at its final target.
+// Called whenever connections change, so that delivering messages has no subgraph overhead
+void Network::rerouteSubgraphs() {
+    for (int i=0; i<MICROFLO_MAX_SUBGRAPH_ROUTES; i++) {
+        const SubGraphRoute &route = subgraphRoutes[i];
+        if (!route.source) {
+            continue;
+        }
+        MicroFlo::PortId port = route.targetPort;
+        Component *leaf = resolveSubgraphTarget(route.source, route.target, &port);
+        route.source->connect(route.sourcePort, leaf, leaf ? port : -1);
+    }
+}
+#endif
+
 /* Note: must be interrupt-safe */
 MicroFlo::Error Network::sendMessageFrom(Component *sender, MicroFlo::PortId senderPort, const Packet &pkg) {
     MICROFLO_RETURN_VAL_IF_FAIL(sender, DebugSendMessageInvalidNode);
@@ -445,6 +889,7 @@ MicroFlo::Error Network::sendMessageFrom(Component *sender, MicroFlo::PortId sen
     msg.node = sender->id();
     msg.port = senderPort;
     messageQueue->push(msg);
+    messagesPending = true;
 
     return MICROFLO_OK;
 }
@@ -453,12 +898,20 @@ MicroFlo::Error Network::sendMessageTo(MicroFlo::NodeId targetId, MicroFlo::Port
     MICROFLO_RETURN_VAL_IF_FAIL(MICROFLO_VALID_NODEID(targetId), DebugSendMessageInvalidNode);
     MICROFLO_RETURN_VAL_IF_FAIL(pkg.isValid(), DebugParserUnknownPacketType);
 
+#ifdef MICROFLO_ENABLE_SUBGRAPHS
+    // Sending to an exported port of a subgraph, deliver directly to the child
+    const Component *target = resolveSubgraphTarget(NULL, nodes[targetId], &targetPort);
+    MICROFLO_RETURN_VAL_IF_FAIL(target, DebugSendMessageInvalidNode);
+    targetId = target->id();
+#endif
+
     Message msg;
     msg.pkg = pkg;
     msg.targetReferred = true;
     msg.node = targetId;
     msg.port = targetPort;
     messageQueue->push(msg);
+    messagesPending = true;
 
     return MICROFLO_OK;
 }
@@ -479,11 +932,155 @@ void Network::runTick() {
 
     // TODO: consider the balance between scheduling and messaging (bounded-buffer problem)
 
+    wakeupRequested = false;
+#ifdef MICROFLO_ENABLE_TICK_STATISTICS
+    if (tickStatistics) {
+        tickStatistics->tickStarted(io->TimerCurrentMicros());
+    }
+#endif
+
     // Deliver messages
     processMessages();
 
     // Schedule
     distributePacket(Packet(MsgTick), -1);
+
+#ifdef MICROFLO_ENABLE_TICK_STATISTICS
+    if (tickStatistics) {
+        tickStatistics->tickEnded(io->TimerCurrentMicros());
+    }
+#endif
+}
+
+#ifdef MICROFLO_ENABLE_TICK_STATISTICS
+MicroFlo::Error Network::getTickStatistic(uint8_t series, uint8_t stat, uint32_t *out) {
+    MICROFLO_RETURN_VAL_IF_FAIL(tickStatistics, DebugTickStatisticsUnavailable);
+    MICROFLO_RETURN_VAL_IF_FAIL(series <= TickStatistics::Duration && stat < TickStatisticInvalid,
+                                DebugTickStatisticsUnavailable);
+    const TimeHistogram &h = (series == TickStatistics::Interval) ? tickStatistics->interval : tickStatistics->duration;
+    *out = h.statistic((TickStatistic)stat);
+    return MICROFLO_OK;
+}
+
+MicroFlo::Error Network::resetTickStatistics() {
+    MICROFLO_RETURN_VAL_IF_FAIL(tickStatistics, DebugTickStatisticsUnavailable);
+    tickStatistics->reset();
+    return MICROFLO_OK;
+}
+
+void TimeHistogram::reset() {
+    count = 0;
+    min = 0xFFFFFFFF;
+    max = 0;
+    sum = 0;
+    for (uint8_t i=0; i<bucketCount; i++) {
+        buckets[i] = 0;
+    }
+}
+
+// Values below subBuckets are exact, above that 8 buckets per power of two
+static uint8_t timeHistogramBucket(uint32_t micros) {
+    if (micros < TimeHistogram::subBuckets) {
+        return micros;
+    }
+    uint8_t exponent = 3;
+    while (exponent < 31 && (micros >> (exponent+1))) {
+        exponent++;
+    }
+    const uint16_t bucket = (exponent-2)*TimeHistogram::subBuckets + ((micros >> (exponent-3)) & 7);
+    return (bucket < TimeHistogram::bucketCount) ? bucket : TimeHistogram::bucketCount-1;
+}
+
+static uint32_t timeHistogramUpperBound(uint8_t bucket) {
+    if (bucket < TimeHistogram::subBuckets) {
+        return bucket;
+    }
+    const uint8_t exponent = bucket/TimeHistogram::subBuckets + 2;
+    const uint32_t lower = (uint32_t)(TimeHistogram::subBuckets + bucket%TimeHistogram::subBuckets) << (exponent-3);
+    return lower + ((uint32_t)1 << (exponent-3)) - 1;
+}
+
+void TimeHistogram::add(uint32_t micros) {
+    count++;
+    sum += micros;
+    if (micros < min) {
+        min = micros;
+    }
+    if (micros > max) {
+        max = micros;
+    }
+    buckets[timeHistogramBucket(micros)]++;
+}
+
+uint32_t TimeHistogram::percentile(uint8_t percent) const {
+    if (count == 0) {
+        return 0;
+    }
+    // Rank of the sample at @percent, rounded up
+    const uint32_t rank = (uint32_t)(((uint64_t)count*percent + 99) / 100);
+    uint32_t seen = 0;
+    for (uint8_t i=0; i<bucketCount; i++) {
+        seen += buckets[i];
+        if (seen >= rank) {
+            const uint32_t upper = timeHistogramUpperBound(i);
+            return (upper < max && i < bucketCount-1) ? upper : max;
+        }
+    }
+    return max;
+}
+
+uint32_t TimeHistogram::statistic(TickStatistic stat) const {
+    switch (stat) {
+    case TickStatisticCount: return count;
+    case TickStatisticMin: return count ? min : 0;
+    case TickStatisticAverage: return count ? (uint32_t)(sum/count) : 0;
+    case TickStatisticMax: return max;
+    case TickStatisticPercentile99: return percentile(99);
+    default: return 0;
+    }
+}
+
+void TickStatistics::reset() {
+    interval.reset();
+    duration.reset();
+    started = false;
+}
+
+void TickStatistics::tickStarted(long micros) {
+    if (started) {
+        interval.add((uint32_t)(micros - lastStart));
+    }
+    lastStart = micros;
+    started = true;
+}
+
+void TickStatistics::tickEnded(long micros) {
+    duration.add((uint32_t)(micros - lastStart));
+}
+#else
+// Compiled out, so host gets TickStatisticsUnavailable
+MicroFlo::Error Network::getTickStatistic(uint8_t series, uint8_t stat, uint32_t *out) {
+    return DebugTickStatisticsUnavailable;
+}
+
+MicroFlo::Error Network::resetTickStatistics() {
+    return DebugTickStatisticsUnavailable;
+}
+#endif
+
+void Network::requestWakeup(unsigned long timeMs) {
+    // Signed difference, so that it works across timer wraparound
+    if (!wakeupRequested || (long)(timeMs - wakeupTimeMs) < 0) {
+        wakeupTimeMs = timeMs;
+    }
+    wakeupRequested = true;
+}
+
+bool Network::nextWakeup(unsigned long *timeMs) const {
+    if (wakeupRequested) {
+        *timeMs = wakeupTimeMs;
+    }
+    return wakeupRequested;
 }
 
 MicroFlo::Error Network::connect(MicroFlo::NodeId srcId, MicroFlo::PortId srcPort,
@@ -496,7 +1093,22 @@ MicroFlo::Error Network::connect(MicroFlo::NodeId srcId, MicroFlo::PortId srcPor
 
 MicroFlo::Error Network::connect(Component *src, MicroFlo::PortId srcPort,
                       Component *target, MicroFlo::PortId targetPort) {
+    MICROFLO_RETURN_VAL_IF_FAIL(srcPort >= 0 && srcPort < src->nPorts, DebugNetworkConnectInvalidPort);
+#ifdef MICROFLO_ENABLE_SUBGRAPHS
+    // Edges from a subgraph outport are kept as-is, they are only used to resolve routes
+    const bool viaSubgraph = target->componentId == MicroFlo::IdSubGraph
+                                && src->componentId != MicroFlo::IdSubGraph;
+    if (viaSubgraph) {
+        const MicroFlo::Error err = setSubgraphRoute(src, srcPort, target, targetPort);
+        MICROFLO_RETURN_VAL_IF_FAIL(err == MICROFLO_OK, err);
+    } else {
+        removeSubgraphRoutes(src, srcPort);
+    }
+#endif
     src->connect(srcPort, target, targetPort);
+#ifdef MICROFLO_ENABLE_SUBGRAPHS
+    rerouteSubgraphs();
+#endif
     return MICROFLO_OK;
 }
 
@@ -510,13 +1122,30 @@ MicroFlo::Error Network::disconnect(MicroFlo::NodeId srcId, MicroFlo::PortId src
 
 MicroFlo::Error Network::disconnect(Component *src, MicroFlo::PortId srcPort,
                       Component *target, MicroFlo::PortId targetPort) {
+#ifdef MICROFLO_ENABLE_SUBGRAPHS
+    removeSubgraphRoutes(src, srcPort);
+#endif
     src->disconnect(srcPort, target, targetPort);
+#ifdef MICROFLO_ENABLE_SUBGRAPHS
+    rerouteSubgraphs();
+#endif
     return MICROFLO_OK;
 }
 
-MicroFlo::Error Network::addNode(Component *node, MicroFlo::NodeId parentId, MicroFlo::NodeId *out_id) {
+MicroFlo::Error Network::addNode(Component *node, MicroFlo::NodeId parentId, MicroFlo::NodeId *out_id,
+                                 MicroFlo::PortId inPorts, MicroFlo::PortId outPorts) {
     MICROFLO_RETURN_VAL_IF_FAIL(node, DebugAddNodeInvalidInstance);
     MICROFLO_RETURN_VAL_IF_FAIL(parentId <= lastAddedNodeIndex, DebugAddNodeInvalidParent);
+#ifdef MICROFLO_ENABLE_SUBGRAPHS
+    if (node->componentId == MicroFlo::IdSubGraph) {
+        // Ports of a subgraph are the ones it exports, so tables can be sized to those
+        SubGraph *subgraph = (SubGraph *)node;
+        MICROFLO_RETURN_VAL_IF_FAIL(subgraph->allocateConnections(outPorts), DebugAddNodeAllocationFailed);
+        MICROFLO_RETURN_VAL_IF_FAIL(subgraph->allocateInports(inPorts), DebugAddNodeAllocationFailed);
+    }
+#endif
+    // Edges may later be added to any port of a component, so it gets all of them
+    MICROFLO_RETURN_VAL_IF_FAIL(node->allocateConnections(0), DebugAddNodeAllocationFailed);
 
     const int nodeId = lastAddedNodeIndex;
     nodes[nodeId] = node;
@@ -537,8 +1166,38 @@ MicroFlo::Error Network::removeNode(MicroFlo::NodeId nodeId) {
     Component *node = nodes[nodeId];
     MICROFLO_RETURN_VAL_IF_FAIL(node, DebugRemoveNodeInvalidInstance);
 
+    // Edges to the removed node must not be followed anymore
+    for (int i=0; i<MICROFLO_MAX_NODES; i++) {
+        Component *other = nodes[i];
+        if (!other) {
+            continue;
+        }
+        for (MicroFlo::PortId port=0; port<other->nPorts; port++) {
+            if (other->connections[port].target == node) {
+                other->disconnect(port, node, -1);
+            }
+        }
+#ifdef MICROFLO_ENABLE_SUBGRAPHS
+        if (other->componentId == MicroFlo::IdSubGraph) {
+            SubGraph *subgraph = (SubGraph *)other;
+            for (MicroFlo::PortId port=0; port<subgraph->nInPorts; port++) {
+                if (subgraph->inputConnections[port].target == node) {
+                    subgraph->connectInport(port, NULL, -1);
+                }
+            }
+        }
+#endif
+    }
+#ifdef MICROFLO_ENABLE_SUBGRAPHS
+    removeSubgraphRoutes(node, -1);
+#endif
+    removeSubscriptionFilters(nodeId, -1);
+
     delete node;
     nodes[nodeId] = 0;
+#ifdef MICROFLO_ENABLE_SUBGRAPHS
+    rerouteSubgraphs();
+#endif
 
     return MICROFLO_OK;
 }
@@ -553,6 +1212,11 @@ MicroFlo::Error Network::clearNodes() {
     }
     lastAddedNodeIndex = Network::firstNodeId;
     messageQueue->clear();
+    messagesPending = false;
+#ifdef MICROFLO_ENABLE_SUBGRAPHS
+    removeSubgraphRoutes(NULL, -1);
+#endif
+    removeSubscriptionFilters(0, -1);
     return MICROFLO_OK;
 }
 
@@ -571,7 +1235,8 @@ MicroFlo::Error Network::setIoValue(const uint8_t *args, uint8_t len) {
     return MICROFLO_OK;
 }
 
-MicroFlo::Error Network::subscribeToPort(MicroFlo::NodeId nodeId, MicroFlo::PortId portId, bool enable) {
+MicroFlo::Error Network::subscribeToPort(MicroFlo::NodeId nodeId, MicroFlo::PortId portId, bool enable,
+                                         SubscriptionMode mode, uint16_t parameter) {
     MICROFLO_RETURN_VAL_IF_FAIL(MICROFLO_VALID_NODEID(nodeId),
                                 DebugSubscribePortInvalidNode);
     Component *c = nodes[nodeId];
@@ -579,11 +1244,88 @@ MicroFlo::Error Network::subscribeToPort(MicroFlo::NodeId nodeId, MicroFlo::Port
                             DebugSubscribePortInvalidNode);
     MICROFLO_RETURN_VAL_IF_FAIL(portId >= 0 && portId < c->nPorts,
                             DebugSubscribePortInvalidPort);
+    MICROFLO_RETURN_VAL_IF_FAIL(mode >= SubscriptionModeAll && mode < SubscriptionModeInvalid,
+                            DebugSubscribePortInvalidMode);
+
+    removeSubscriptionFilters(nodeId, portId);
+    if (enable && mode != SubscriptionModeAll) {
+        SubscriptionFilter *filter = NULL;
+        for (int i=0; i<MICROFLO_MAX_SUBSCRIPTION_FILTERS; i++) {
+            if (subscriptionFilters[i].node == 0) {
+                filter = &subscriptionFilters[i];
+                break;
+            }
+        }
+        MICROFLO_RETURN_VAL_IF_FAIL(filter, DebugSubscriptionFilterLimitReached);
+        filter->node = nodeId;
+        filter->port = portId;
+        filter->mode = mode;
+        filter->parameter = parameter;
+        // So that first packet is always notified
+        filter->state = (mode == SubscriptionModeMaxRate) ? io->TimerCurrentMs()-parameter : 0;
+        filter->last = Packet();
+    }
 
     c->connections[portId].subscribed = enable;
     return MICROFLO_OK;
 }
 
+// Remove filters for @port of @node. @node=0 means all nodes, @port=-1 all ports
+void Network::removeSubscriptionFilters(MicroFlo::NodeId node, MicroFlo::PortId port) {
+    for (int i=0; i<MICROFLO_MAX_SUBSCRIPTION_FILTERS; i++) {
+        SubscriptionFilter &filter = subscriptionFilters[i];
+        if ((node == 0 || filter.node == node) && (port < 0 || filter.port == port)) {
+            filter.node = 0;
+            filter.port = -1;
+        }
+    }
+}
+
+// @deadband is fixed-point, see MICROFLO_DEADBAND_ONE
+static bool packetChanged(const Packet &last, const Packet &current, uint16_t deadband) {
+    if (last.isNumber() && current.isNumber()) {
+        if (last.isFloat() || current.isFloat()) {
+            const float diff = current.asFloat() - last.asFloat();
+            return (diff < 0 ? -diff : diff) > (float)deadband / MICROFLO_DEADBAND_ONE;
+        }
+        // Integers differ by more than the deadband when by more than its integer part
+        const long diff = current.asInteger() - last.asInteger();
+        return (diff < 0 ? -diff : diff) > deadband / MICROFLO_DEADBAND_ONE;
+    }
+    return !(last == current);
+}
+
+// Whether a packet sent on a subscribed port should be notified
+bool Network::subscriptionFilterPasses(const Component *sender, MicroFlo::PortId port, const Packet &pkg) {
+    for (int i=0; i<MICROFLO_MAX_SUBSCRIPTION_FILTERS; i++) {
+        SubscriptionFilter &filter = subscriptionFilters[i];
+        if (filter.node != sender->id() || filter.port != port) {
+            continue;
+        }
+        if (filter.mode == SubscriptionModeEveryNth) {
+            filter.state++;
+            if (filter.state < filter.parameter) {
+                return false;
+            }
+            filter.state = 0;
+        } else if (filter.mode == SubscriptionModeMaxRate) {
+            const long now = io->TimerCurrentMs();
+            if (now - filter.state < filter.parameter) {
+                return false;
+            }
+            filter.state = now;
+        } else if (filter.mode == SubscriptionModeOnChange) {
+            if (filter.state && !packetChanged(filter.last, pkg, filter.parameter)) {
+                return false;
+            }
+            filter.last = pkg;
+            filter.state = 1;
+        }
+        return true;
+    }
+    return true;
+}
+
 MicroFlo::Error Network::connectSubgraph(bool isOutput,
                               MicroFlo::NodeId subgraphNode, MicroFlo::PortId subgraphPort,
                               MicroFlo::NodeId childNode, MicroFlo::PortId childPort) {
@@ -599,9 +1341,11 @@ MicroFlo::Error Network::connectSubgraph(bool isOutput,
 
     SubGraph *subgraph = (SubGraph *)comp;
     if (isOutput) {
-        subgraph->connectOutport(subgraphPort, child, childPort);
+        // Child outport is exported by connecting it to the subgraph outport
+        return connect(child, childPort, subgraph, subgraphPort);
     } else {
         subgraph->connectInport(subgraphPort, child, childPort);
+        rerouteSubgraphs();
     }
 #else
     MICROFLO_DEBUG(this, DebugLevelError, DebugNotSupported);
@@ -615,17 +1359,16 @@ void HostCommunication::packetSent(const Message &m, const Component *src, Micro
         return;
     }
 
-    uint8_t cmd[MICROFLO_CMD_SIZE] = {
-        0, GraphCmdPacketSent,
-        src->id(), (uint8_t)srcPort, (uint8_t)(m.targetReferred ? 1 : 0),
-        (uint8_t)m.pkg.type(),
-        0, 0, 0, 0 // data, 4 bytes
-    };
-    uint8_t *data = cmd + 6;
+    uint8_t data[4] = { 0, 0, 0, 0 };
+    uint8_t dataSize = 0; // only sent in full in protocol version 1
 
     if (m.pkg.isData()) {
         if (m.pkg.isBool()) {
             data[0] = m.pkg.asBool();
+            dataSize = 1;
+        } else if (m.pkg.isByte()) {
+            data[0] = m.pkg.asByte();
+            dataSize = 1;
         } else if (m.pkg.isNumber()){
             // TODO: move into writeInt32 function, take endianness into account
             const int i = m.pkg.asInteger();
@@ -633,8 +1376,10 @@ void HostCommunication::packetSent(const Message &m, const Component *src, Micro
             data[1] = i>>8;
             data[2] = i>>16;
             data[3] = i>>24;
+            dataSize = 4;
         } else if (m.pkg.isError()) {
             data[0] = (uint8_t)m.pkg.asError();
+            dataSize = 1;
         } else if (m.pkg.isVoid() || m.pkg.isStartBracket() || m.pkg.isEndBracket()) {
             // Nothing needs doing
         } else {
@@ -642,14 +1387,70 @@ void HostCommunication::packetSent(const Message &m, const Component *src, Micro
             MICROFLO_DEBUG(this, DebugLevelError, DebugNotImplemented);
         }
     }
-    transport->sendCommand(cmd, sizeof(cmd));
+
+    if (protocolVersion < 2) {
+        // One command per packet
+        const uint8_t cmd[MICROFLO_CMD_SIZE] = {
+            0, GraphCmdPacketSent,
+            src->id(), (uint8_t)srcPort, (uint8_t)(m.targetReferred ? 1 : 0),
+            (uint8_t)m.pkg.type(),
+            data[0], data[1], data[2], data[3]
+        };
+        send(cmd, 6+dataSize);
+        return;
+    }
+
+    // Collect into a PacketsSent batch, sent at end of tick by messagesProcessed()
+    const uint8_t recordSize = 3+dataSize;
+    if (batchLength+recordSize > sizeof(batch)) {
+        if (batchOverflows < 255) {
+            batchOverflows++;
+        }
+        flushPacketsSent();
+    }
+    if (batchLength == 0) {
+        batch[0] = 0;
+        batch[1] = GraphCmdPacketsSent;
+        batch[2] = 0; // number of records
+        batch[3] = 0; // overflows, set on flush
+        batchLength = 4;
+    }
+    uint8_t *record = batch+batchLength;
+    record[0] = src->id();
+    record[1] = (uint8_t)srcPort;
+    record[2] = (uint8_t)m.pkg.type() | (m.targetReferred ? 0x80 : 0x00);
+    for (uint8_t i=0; i<dataSize; i++) {
+        record[3+i] = data[i];
+    }
+    batchLength += recordSize;
+    batch[2]++;
+}
+
+void HostCommunication::messagesProcessed() {
+    flushPacketsSent();
+}
+
+// A pending PacketsSent batch is framed for version 2, so it is dropped rather than sent as version 1
+void HostCommunication::resetProtocolVersion() {
+    protocolVersion = 1;
+    batchLength = 0;
+    batchOverflows = 0;
+}
+
+void HostCommunication::flushPacketsSent() {
+    if (batchLength == 0) {
+        return;
+    }
+    batch[3] = batchOverflows;
+    send(batch, batchLength);
+    batchLength = 0;
 }
 
 void HostCommunication::emitDebug(DebugLevel level, DebugId id) {
 #ifdef MICROFLO_ENABLE_DEBUG
     if (level <= debugLevel) {
         const uint8_t cmd[] = { 0, GraphCmdDebugMessage, (uint8_t)level, (uint8_t)id };
-        transport->sendCommand(cmd, sizeof(cmd));
+        send(cmd, sizeof(cmd));
     }
 #endif
 }
@@ -657,6 +1458,8 @@ void HostCommunication::emitDebug(DebugLevel level, DebugId id) {
 SerialHostTransport::SerialHostTransport(uint8_t port, int baudRate)
     : serialPort(port)
     , serialBaudrate(baudRate)
+    , receiveStart(0)
+    , receiveLength(0)
 {
 
 }
@@ -670,39 +1473,74 @@ void SerialHostTransport::setup(IO *i, HostCommunication *c) {
 
 
 void SerialHostTransport::runTick() {
-    if (io->SerialDataAvailable(serialPort) > 0) {
-        unsigned char c = io->SerialRead(serialPort);
-        controller->parseByte(c);
+    const uint16_t size = sizeof(receiveBuffer);
+
+    // Take everything which has arrived, so that host can have a window of requests outstanding
+    while (receiveLength < size && io->SerialDataAvailable(serialPort) > 0) {
+        receiveBuffer[(receiveStart+receiveLength) % size] = io->SerialRead(serialPort);
+        receiveLength++;
+    }
+
+    // Parse in contiguous chunks, up to the budget
+    uint16_t budget = MICROFLO_HOST_PARSE_BUDGET;
+    while (receiveLength > 0 && budget > 0) {
+        uint16_t chunk = size-receiveStart;
+        if (chunk > receiveLength) {
+            chunk = receiveLength;
+        }
+        if (chunk > budget) {
+            chunk = budget;
+        }
+        const uint8_t *data = receiveBuffer+receiveStart;
+        receiveStart = (receiveStart+chunk) % size;
+        receiveLength -= chunk;
+        budget -= chunk;
+        controller->parseBytes(data, chunk);
     }
 }
 
 void SerialHostTransport::sendCommand(const uint8_t *b, uint8_t len) {
-    // Make sure to pad to the cmd size
-    for (uint8_t i=0; i<MICROFLO_CMD_SIZE; i++) {
-        io->SerialWrite(serialPort, (i < len) ?  b[i] : 0x00);
+    for (uint8_t i=0; i<len; i++) {
+        io->SerialWrite(serialPort, b[i]);
     }
 }
 
 #ifdef MICROFLO_ENABLE_SUBGRAPHS
 SubGraph::SubGraph()
-    : Component(outputConnections, MICROFLO_SUBGRAPH_MAXPORTS)
+    : Component(NULL, MICROFLO_SUBGRAPH_MAXPORTS)
+    , inputConnections(NULL)
+    , nInPorts(0)
 {
 }
 
-void SubGraph::connectInport(MicroFlo::PortId inPort, Component *child, MicroFlo::PortId childInPort) {
-    if (inPort < 0 || inPort >= MICROFLO_SUBGRAPH_MAXPORTS) {
-        return;
+SubGraph::~SubGraph() {
+    delete[] inputConnections;
+}
+
+bool SubGraph::allocateInports(MicroFlo::PortId usedPorts) {
+    if (inputConnections) {
+        return true;
     }
-    inputConnections[inPort].target = child;
-    inputConnections[inPort].targetPort = childInPort;
+    nInPorts = (usedPorts > 0) ? usedPorts : MICROFLO_SUBGRAPH_MAXPORTS;
+    inputConnections = new Connection[nInPorts];
+    if (!inputConnections) {
+        nInPorts = 0;
+        return false;
+    }
+    for (int i=0; i<nInPorts; i++) {
+        inputConnections[i].target = 0;
+        inputConnections[i].targetPort = -1;
+        inputConnections[i].subscribed = false;
+    }
+    return true;
 }
 
-void SubGraph::connectOutport(MicroFlo::PortId outPort, Component *child, MicroFlo::PortId childOutPort) {
-    if (outPort < 0 || outPort >= MICROFLO_SUBGRAPH_MAXPORTS) {
+void SubGraph::connectInport(MicroFlo::PortId inPort, Component *child, MicroFlo::PortId childInPort) {
+    if (inPort < 0 || inPort >= nInPorts) {
         return;
     }
-    outputConnections[outPort].target = child;
-    outputConnections[outPort].targetPort = childOutPort;
+    inputConnections[inPort].target = child;
+    inputConnections[inPort].targetPort = childInPort;
 }
 
 void SubGraph::process(Packet in, MicroFlo::PortId port) {
@@ -32,6 +32,26 @@ const int MICROFLO_MAX_MESSAGES = 50;
 #define MICROFLO_ENABLE_SUBGRAPHS
 #endif
 
+// Max number of edges which have a subgraph as their target
+#ifdef MICROFLO_SUBGRAPH_ROUTE_LIMIT
+const int MICROFLO_MAX_SUBGRAPH_ROUTES = MICROFLO_SUBGRAPH_ROUTE_LIMIT;
+#else
+const int MICROFLO_MAX_SUBGRAPH_ROUTES = 10;
+#endif
+
+// Max number of subscribed ports which only notify some of the packets
+#ifdef MICROFLO_SUBSCRIPTION_FILTER_LIMIT
+const int MICROFLO_MAX_SUBSCRIPTION_FILTERS = MICROFLO_SUBSCRIPTION_FILTER_LIMIT;
+#else
+const int MICROFLO_MAX_SUBSCRIPTION_FILTERS = 4;
+#endif
+
+// Timing of Network::runTick(), readable with GetTickStatistics. Default to enabled
+#ifdef MICROFLO_DISABLE_TICK_STATISTICS
+#else
+#define MICROFLO_ENABLE_TICK_STATISTICS
+#endif
+
 #ifdef MICROFLO_DISABLE_DEBUG
 #else
 #define MICROFLO_ENABLE_DEBUG
@@ -64,10 +84,7 @@ do { \
 
 #define MICROFLO_LOAD_STATIC_GRAPH(ctrl_, gr_) \
 do { \
-    for (unsigned int i=0; i<sizeof(gr_); i++) { \
-        unsigned char c = gr_[i]; \
-        ctrl_->parseByte(c); \
-    } \
+    ctrl_->loadGraphStream(gr_, sizeof(gr_)); \
 } while(0)
 
 #else
@@ -181,11 +198,99 @@ class NetworkNotificationHandler;
 class IO;
 class MessageQueue;
 
+// IO as seen by components. Defining MICROFLO_IO_TYPE to the backend class, like ArduinoIO,
+// picks it at compile time, so component calls go straight to the backend and can be inlined.
+// That backend must then be the only IO in the program, and be complete before microflo.cpp.
+// Network takes a ComponentIO, so passing any other IO is a compile error
+#ifdef MICROFLO_IO_TYPE
+class MICROFLO_IO_TYPE;
+typedef MICROFLO_IO_TYPE ComponentIO;
+#if __cplusplus >= 201103L
+#define MICROFLO_IO_FINAL final
+#endif
+#else
+typedef IO ComponentIO;
+#endif
+#ifndef MICROFLO_IO_FINAL
+#define MICROFLO_IO_FINAL
+#endif
+
+#ifdef MICROFLO_ENABLE_SUBGRAPHS
+// An edge that has a SubGraph as target, as it was connected.
+// The Connection on the source holds the resolved (leaf) target, which is what messages are delivered to
+struct SubGraphRoute {
+    Component *source;
+    MicroFlo::PortId sourcePort;
+    Component *target;
+    MicroFlo::PortId targetPort;
+};
+#endif
+
+// OnChange deadband is fixed-point with 8 fractional bits, so that float ports can use fractions.
+// A deadband of 1.0 is 256
+const uint16_t MICROFLO_DEADBAND_ONE = 256;
+
+// Limits notifications for a subscribed port.
+// Kept out of Connection, so that ports without one do not use memory for it
+struct SubscriptionFilter {
+    MicroFlo::NodeId node; // 0 if unused
+    MicroFlo::PortId port;
+    SubscriptionMode mode;
+    uint16_t parameter; // EveryNth: N, MaxRate: milliseconds, OnChange: deadband, see MICROFLO_DEADBAND_ONE
+    long state; // EveryNth: packets since last notification, MaxRate: time of last notification, OnChange: 1 if @last is set
+    Packet last;
+};
+
 class DebugHandler {
 public:
     virtual void emitDebug(DebugLevel level, DebugId id) = 0;
 };
 
+#ifdef MICROFLO_ENABLE_TICK_STATISTICS
+// Distribution of durations in microseconds.
+// Buckets are 8 per power of two, so percentiles are within 12.5%
+class TimeHistogram {
+public:
+    static const uint8_t subBuckets = 8;
+    static const uint8_t bucketCount = subBuckets*23; // up to ~8 seconds, longer go in the last bucket
+public:
+    TimeHistogram() { reset(); }
+    void reset();
+    void add(uint32_t micros);
+    // Upper bound of the bucket holding the @percent percentile
+    uint32_t percentile(uint8_t percent) const;
+    uint32_t statistic(TickStatistic stat) const;
+public:
+    uint32_t count;
+    uint32_t min;
+    uint32_t max;
+    uint64_t sum;
+private:
+    uint32_t buckets[bucketCount];
+};
+
+// Timing of Network::runTick(), to check that a graph keeps up with its tick rate.
+// Enabled with Network::setTickStatistics(), which makes each tick read the clock twice
+class TickStatistics {
+public:
+    enum Series {
+        Interval = 0, // from start of one tick to the next
+        Duration // time spent in runTick()
+    };
+public:
+    TickStatistics() : lastStart(0), started(false) {}
+    void reset();
+    void tickStarted(long micros);
+    void tickEnded(long micros);
+public:
+    TimeHistogram interval;
+    TimeHistogram duration;
+private:
+    long lastStart;
+    bool started;
+};
+#endif
+
 
 class Network  {
     // For emitting debug on notificationHandler
@@ -205,14 +310,17 @@ public:
         Running
     };
 public:
-    Network(IO *io, MessageQueue *m);
+    Network(ComponentIO *io, MessageQueue *m);
 
     State currentState() { return state; }
     MicroFlo::Error start();
     MicroFlo::Error stop();
 
     MicroFlo::Error clearNodes();
-    MicroFlo::Error addNode(Component *node, MicroFlo::NodeId parentId, MicroFlo::NodeId *out_id);
+    // @inPorts/@outPorts: number of ports in use by a SubGraph, 0=all. Other nodes always get all their
+    // ports, since edges can be added to any of them while running
+    MicroFlo::Error addNode(Component *node, MicroFlo::NodeId parentId, MicroFlo::NodeId *out_id,
+                            MicroFlo::PortId inPorts=0, MicroFlo::PortId outPorts=0);
     MicroFlo::Error removeNode(MicroFlo::NodeId nodeId);
 
     // Connect an outport of one node, to the inport of another node
@@ -233,7 +341,8 @@ public:
     MicroFlo::Error sendMessageFrom(Component *sender, MicroFlo::PortId senderPort, const Packet &pkg);
     MicroFlo::Error sendMessageTo(MicroFlo::NodeId targetId, MicroFlo::PortId targetPort, const Packet &pkg);
 
-    MicroFlo::Error subscribeToPort(MicroFlo::NodeId nodeId, MicroFlo::PortId portId, bool enable);
+    MicroFlo::Error subscribeToPort(MicroFlo::NodeId nodeId, MicroFlo::PortId portId, bool enable,
+                                    SubscriptionMode mode=SubscriptionModeAll, uint16_t parameter=0);
 
     MicroFlo::Error setIoValue(const uint8_t *buf, uint8_t len);
 
@@ -242,27 +351,63 @@ public:
 
     void runTick();
 
+    // For skipping idle time when simulating, see VirtualTimeRunner.
+    // Components waiting for a time call requestWakeup() on each tick, with time as from io->TimerCurrentMs()
+    void requestWakeup(unsigned long timeMs);
+    // Earliest wakeup requested during last tick. false if none
+    bool nextWakeup(unsigned long *timeMs) const;
+    // No messages waiting to be delivered on next tick
+    bool isIdle() const { return !messagesPending; }
+
+#ifdef MICROFLO_ENABLE_TICK_STATISTICS
+    // NULL to disable, the default
+    void setTickStatistics(TickStatistics *stats) { tickStatistics = stats; }
+#endif
+    MicroFlo::Error getTickStatistic(uint8_t series, uint8_t stat, uint32_t *out);
+    MicroFlo::Error resetTickStatistics();
+
 private:
     void distributePacket(const Packet &packet, MicroFlo::PortId port);
     void processMessages();
 
     MicroFlo::PortId resolveMessageTarget(Message &msg, Component **sender);
-    void resolveMessageSubgraph(Message &msg, const Component *out_sender);
+    bool subscriptionFilterPasses(const Component *sender, MicroFlo::PortId port, const Packet &pkg);
+    void removeSubscriptionFilters(MicroFlo::NodeId node, MicroFlo::PortId port);
+
+#ifdef MICROFLO_ENABLE_SUBGRAPHS
+    MicroFlo::Error setSubgraphRoute(Component *src, MicroFlo::PortId srcPort,
+                                     Component *target, MicroFlo::PortId targetPort);
+    void removeSubgraphRoutes(const Component *node, MicroFlo::PortId srcPort);
+    Component *resolveSubgraphTarget(const Component *sender, Component *target, MicroFlo::PortId *port);
+    void rerouteSubgraphs();
+#endif
 
 private:
     Component *nodes[MICROFLO_MAX_NODES];
     MicroFlo::NodeId lastAddedNodeIndex;
+#ifdef MICROFLO_ENABLE_SUBGRAPHS
+    SubGraphRoute subgraphRoutes[MICROFLO_MAX_SUBGRAPH_ROUTES];
+#endif
+    SubscriptionFilter subscriptionFilters[MICROFLO_MAX_SUBSCRIPTION_FILTERS];
 
     MessageQueue *messageQueue;
     NetworkNotificationHandler *notificationHandler;
-    IO *io;
+    ComponentIO *io;
 
     State state;
+    bool messagesPending;
+    bool wakeupRequested;
+    unsigned long wakeupTimeMs;
+#ifdef MICROFLO_ENABLE_TICK_STATISTICS
+    TickStatistics *tickStatistics;
+#endif
 };
 
 class NetworkNotificationHandler : public DebugHandler {
 public:
     virtual void packetSent(const Message &m, const Component *sender, MicroFlo::PortId senderPort) = 0;
+    // Called after each round of message delivery. Allows batching notifications
+    virtual void messagesProcessed() {}
 };
 
 #ifdef MICROFLO_ENABLE_DEBUG
@@ -329,12 +474,15 @@ private:
 typedef void (*IOInterruptFunction)(void *user);
 
 class IO {
-    friend class Network; // for setting up debug
 protected:
     DebugHandler *debug;
 public:
+    IO() : debug(0) {}
     virtual ~IO() {}
 
+    // Set up by Network. Wrappers around another IO override this to pass it on
+    virtual void setDebugHandler(DebugHandler *handler) { debug = handler; }
+
     // Testing
     virtual void setIoValue(const uint8_t *, uint8_t ) {
         MICROFLO_DEBUG(debug, DebugLevelError, DebugIoOperationNotImplemented);
@@ -361,6 +509,22 @@ public:
     // Digital
     virtual void DigitalWrite(MicroFlo::PinId pin, bool val) = 0;
     virtual bool DigitalRead(MicroFlo::PinId pin) = 0;
+    // Several pins at once, for bit-banging. Bit i of @values is the value of @pins[i], so at most 32 pins
+    // Backends override these to write each hardware port once, instead of one call per pin
+    virtual void DigitalWriteMany(const MicroFlo::PinId *pins, uint8_t count, uint32_t values) {
+        for (uint8_t i=0; i<count && i<32; i++) {
+            DigitalWrite(pins[i], (values >> i) & 1);
+        }
+    }
+    virtual uint32_t DigitalReadMany(const MicroFlo::PinId *pins, uint8_t count) {
+        uint32_t values = 0;
+        for (uint8_t i=0; i<count && i<32; i++) {
+            if (DigitalRead(pins[i])) {
+                values |= ((uint32_t)1 << i);
+            }
+        }
+        return values;
+    }
 
     // Analog
     // Values should be [0..1023], for now
@@ -397,30 +561,36 @@ class Component {
     friend class DummyComponent;
     friend class SubGraph;
 public:
-    Component(Connection *outPorts, int ports) : connections(outPorts), nPorts(ports) {}
-    virtual ~Component() {}
+    // Components can pass @outPorts=NULL and @ports as the maximum, to have connections allocated
+    // when added to Network. Only a SubGraph gets fewer than @ports, if it exports fewer.
+    Component(Connection *outPorts, int ports)
+        : connections(outPorts), nPorts(ports), ownsConnections(false), componentId(0) {}
+    virtual ~Component();
     virtual void process(Packet in, MicroFlo::PortId port) = 0;
 
     MicroFlo::NodeId id() const { return nodeId; }
     MicroFlo::ComponentId component() const { return componentId; }
+    MicroFlo::PortId outPorts() const { return nPorts; } // maximum, until added to Network
     void setComponentId(MicroFlo::ComponentId id); // not really public API..
 
 protected:
-    IO *io;
+    ComponentIO *io;
     Network *network;
 protected:
     void send(Packet out, MicroFlo::PortId port=0); // send packet out
 private:
+    bool allocateConnections(MicroFlo::PortId usedPorts); // Used by Network.addNode()
     void connect(MicroFlo::PortId outPort, // Used by Network.connect()
                  Component *target, MicroFlo::PortId targetPort);
     void disconnect(MicroFlo::PortId outPort, // Used by Network.disconnect()
                  Component *target, MicroFlo::PortId targetPort);
 
     void setParent(int parentId) { parentNodeId = parentId; }
-    void setNetwork(Network *net, int n, IO *io);
+    void setNetwork(Network *net, int n, ComponentIO *io);
 private:
     Connection *connections; // one per output port
     MicroFlo::PortId nPorts;
+    bool ownsConnections;
 
     MicroFlo::NodeId nodeId; // identifier in the network
     MicroFlo::ComponentId componentId; // what type of component this is
@@ -448,6 +618,7 @@ private:
 Component *createComponent(MicroFlo::ComponentId id);
 
 
+// Number of ports of a SubGraph, if not specified on creation
 #define MICROFLO_SUBGRAPH_MAXPORTS 10
 
 #ifdef MICROFLO_ENABLE_SUBGRAPHS
@@ -462,16 +633,19 @@ class SubGraph : public Component {
     friend class ::Network;
 public:
     SubGraph();
-    virtual ~SubGraph() {}
+    virtual ~SubGraph();
 
     // Implements Component
     virtual void process(Packet in, MicroFlo::PortId port);
 
     void connectInport(MicroFlo::PortId inPort, Component *child, MicroFlo::PortId childInPort);
-    void connectOutport(MicroFlo::PortId outPort, Component *child, MicroFlo::PortId childOutPort);
 private:
-    Connection inputConnections[MICROFLO_SUBGRAPH_MAXPORTS];
-    Connection outputConnections[MICROFLO_SUBGRAPH_MAXPORTS];
+    bool allocateInports(MicroFlo::PortId usedPorts); // Used by Network.addNode()
+private:
+    // Child node/port that each inport is exported from
+    // Edges from each outport, to nodes outside the subgraph, are the regular Component connections
+    Connection *inputConnections;
+    MicroFlo::PortId nInPorts;
 };
 #else
 class SubGraph : public DummyComponent {};
@@ -517,40 +691,120 @@ private:
 const size_t MICROFLO_CMD_SIZE = 10;
 static const char MICROFLO_GRAPH_MAGIC[MICROFLO_CMD_SIZE-1] = {'m','i','c','r','o','f', 'l', 'o', '1' };
 
+// Protocol version 2 sends each command as a frame: start byte, length, command, CRC-8 over length+command
+// Host opts in with SetProtocolVersion after the magic, which announces the highest version supported
+const uint8_t MICROFLO_PROTOCOL_VERSION = 2;
+const uint8_t MICROFLO_FRAME_START = 0xFE;
+#ifndef MICROFLO_FRAME_MAXSIZE
+#define MICROFLO_FRAME_MAXSIZE 32 // of the command. Must be at least MICROFLO_CMD_SIZE
+#endif
+
+// Number of requests host may send before waiting for responses. Announced on CommunicationOpen
+#ifndef MICROFLO_HOST_WINDOW
+#define MICROFLO_HOST_WINDOW 4
+#endif
+// Enough to hold a full window of commands, in either protocol version
+const size_t MICROFLO_RECEIVE_BUFFER_SIZE = MICROFLO_HOST_WINDOW*(MICROFLO_CMD_SIZE+3);
+// Bytes parsed per transport tick at most. Lower it to give the network more time between commands
+#ifndef MICROFLO_HOST_PARSE_BUDGET
+#define MICROFLO_HOST_PARSE_BUDGET MICROFLO_RECEIVE_BUFFER_SIZE
+#endif
+
+// Optional features, announced as a bitmask on CommunicationOpen
+const uint8_t MICROFLO_FEATURE_GRAPH_IMAGE = 0x01;
+
+// Graph image: a whole graph in one blob, instantiated by LoadGraphImage
+// Header: 'M', 'G', version, flags, number of nodes, edges and IIPs, CRC-8 over the tables
+// Tables follow, with records laid out like the arguments of CreateComponent, ConnectNodes and SendPacket
+// Nodes get consecutive ids in table order, starting at 1
+const uint8_t MICROFLO_GRAPH_IMAGE_VERSION = 1;
+const uint8_t MICROFLO_GRAPH_IMAGE_HEADER_SIZE = 8;
+const uint8_t MICROFLO_GRAPH_IMAGE_NODE_SIZE = 4;
+const uint8_t MICROFLO_GRAPH_IMAGE_EDGE_SIZE = 4;
+const uint8_t MICROFLO_GRAPH_IMAGE_IIP_SIZE = 7;
+const uint8_t MICROFLO_GRAPH_IMAGE_START = 0x01; // flag: start network after loading
+
 class HostTransport;
 
+// Reads the byte at @address, for instance from program memory
+typedef uint8_t (*MicroFloReadByteFunction)(const uint8_t *address);
+
 class HostCommunication : public NetworkNotificationHandler {
 public:
     HostCommunication();
+    ~HostCommunication();
     void setup(Network *net, HostTransport *t);
+    Network *currentNetwork() const { return network; }
 
     void parseByte(char b);
+    // Same as calling parseByte() for each, but whole commands and graph images are taken at once
+    void parseBytes(const uint8_t *buf, size_t length);
+
+    // Replaces current graph. Whole image is validated before anything is changed
+    MicroFlo::Error loadGraphImage(const uint8_t *image, uint16_t length);
+
+    // Builds network straight from an embedded command stream, without sending anything to host
+    // Returns the first error. @read defaults to reading from RAM
+    MicroFlo::Error loadGraphStream(const uint8_t *stream, size_t length, MicroFloReadByteFunction read=NULL);
 
     // Implements NetworkNotificationHandler
     virtual void packetSent(const Message &m, const Component *src, MicroFlo::PortId senderPort);
+    virtual void messagesProcessed();
 
     // Implements DebugHandler
     virtual void emitDebug(DebugLevel level, DebugId id);
 
+protected:
+    // Host changed subscription of an edge with SubscribeToPort. For hosts sharing a network
+    virtual void portSubscriptionChanged(MicroFlo::NodeId node, MicroFlo::PortId port, bool enable) {}
+
 private:
     void parseCmd();
-void respondStartStop(uint8_t requestId);
+    void parseFrameByte(uint8_t b);
+    void parseGraphImageByte(uint8_t b);
+    void respondStartStop(uint8_t requestId);
     bool checkRespondMagic();
+    void send(const uint8_t *cmd, uint8_t len);
+    void flushPacketsSent();
+    void resetProtocolVersion();
 
 private:
     enum State {
         Invalid = -1,
         ParseHeader,
         ParseCmd,
-        LookForHeader
+        LookForHeader,
+        // Protocol version 2
+        LookForFrame,
+        ParseFrameLength,
+        ParseFrameCmd,
+        ParseFrameCrc,
+        // Raw bytes following LoadGraphImage, in either version
+        ParseGraphImage
     };
 
     Network *network;
     HostTransport *transport;
     uint8_t currentByte;
-    unsigned char buffer[MICROFLO_CMD_SIZE];
+    unsigned char buffer[MICROFLO_FRAME_MAXSIZE];
     enum State state;
     DebugLevel debugLevel;
+    uint8_t protocolVersion;
+    uint8_t frameLength;
+    uint8_t frameCrc;
+    // PacketsSent batch, protocol version 2
+    uint8_t batch[MICROFLO_FRAME_MAXSIZE];
+    uint8_t batchLength;
+    uint8_t batchOverflows; // times batch filled up before end of tick
+    // LoadGraphImage in progress
+    uint8_t *image; // NULL if allocation failed, bytes are then discarded
+    uint16_t imageLength;
+    uint16_t imageReceived;
+    uint8_t imageRequestId;
+    enum State imageReturnState;
+    // loadGraphStream() in progress. Responses are dropped, first error kept
+    bool silent;
+    MicroFlo::Error silentError;
 };
 
 
@@ -559,6 +813,7 @@ public:
     virtual void setup(IO *i, HostCommunication *c) = 0;
     virtual void runTick() = 0;
 
+    // Write @len bytes as-is. HostCommunication takes care of padding or framing
     virtual void sendCommand(const uint8_t *buf, uint8_t len) = 0;
 };
 
@@ -585,6 +840,10 @@ private:
     HostCommunication *controller;
     int8_t serialPort;
     int serialBaudrate;
+    // Requests waiting to be parsed. Serial drivers often only buffer 64 bytes
+    uint8_t receiveBuffer[MICROFLO_RECEIVE_BUFFER_SIZE];
+    uint16_t receiveStart;
+    uint16_t receiveLength;
 };
 
 #endif // MICROFLO_H
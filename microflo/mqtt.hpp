@@ -5,20 +5,40 @@
 
 // MQTT/MsgFlo support, target-independent
 
+#ifndef MICROFLO_MQTT_HPP
+#define MICROFLO_MQTT_HPP
+
 #include <string>
 #include <vector>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <float.h>
+
+// How packets on a port are encoded in MQTT payloads
+enum PayloadFormat {
+    PayloadText = 0, // encodePacket(), readable by anything
+    PayloadMsgPack // encodePacketMsgPack(), compact and keeps exact types
+};
 
 struct Port {
     MicroFlo::NodeId node;
     MicroFlo::PortId port;
     std::string topic;
     std::string name;
+    PayloadFormat format;
+    int qos; // MQTT QoS level for publishing, 0-2
+    bool coalesce; // only publish latest of packets queued while broker was busy
 
     Port(std::string t, MicroFlo::NodeId n, MicroFlo::PortId p, std::string na)
         : node(n)
         , port(p)
         , topic(t)
         , name(na)
+        , format(PayloadText)
+        , qos(0)
+        , coalesce(false)
     {
 
     }
@@ -47,8 +67,66 @@ struct ParticipantInfo {
         outports.push_back(port);
         return this;
     }
+
+    // Setters for the ports in comma-separated @names, or all ports if "*".
+    // Return the number of ports changed
+    int setPayloadFormat(const char *names, PayloadFormat format) {
+        std::vector<Port *> ports = portsNamed(names);
+        for (size_t i=0; i<ports.size(); i++) {
+            ports[i]->format = format;
+        }
+        return ports.size();
+    }
+    int setQos(const char *names, int qos) {
+        std::vector<Port *> ports = portsNamed(names);
+        for (size_t i=0; i<ports.size(); i++) {
+            ports[i]->qos = qos;
+        }
+        return ports.size();
+    }
+    int setCoalesce(const char *names, bool coalesce) {
+        std::vector<Port *> ports = portsNamed(names);
+        for (size_t i=0; i<ports.size(); i++) {
+            ports[i]->coalesce = coalesce;
+        }
+        return ports.size();
+    }
+
+    std::vector<Port *> portsNamed(const char *names) {
+        std::vector<Port *> found;
+        std::vector<Port> *lists[2] = { &inports, &outports };
+        for (int l=0; l<2; l++) {
+            for (size_t i=0; i<lists[l]->size(); i++) {
+                Port &port = (*lists[l])[i];
+                if (strcmp(names, "*") == 0 || nameInList(names, port.name)) {
+                    found.push_back(&port);
+                }
+            }
+        }
+        return found;
+    }
+
+private:
+    static bool nameInList(const char *list, const std::string &name) {
+        const char *start = list;
+        while (true) {
+            const char *end = strchr(start, ',');
+            const size_t length = end ? (size_t)(end-start) : strlen(start);
+            if (length == name.size() && memcmp(start, name.c_str(), length) == 0) {
+                return true;
+            }
+            if (!end) {
+                return false;
+            }
+            start = end+1;
+        }
+    }
 };
 
+const char *payloadFormatName(PayloadFormat format) {
+    return (format == PayloadMsgPack) ? "msgpack" : "text";
+}
+
 #define JSON_ATTR_STRING(name, value) \
     +std::string("    \"") +name+std::string("\": \"") + value + std::string("\",\n")
 #define JSON_ATTR_ARRAY(name, value) \
@@ -68,10 +146,11 @@ std::string msgfloPorts(const std::vector<Port> &ports) {
             JSON_ATTR_STRING("id", port.name)
             JSON_ATTR_STRING("queue", port.topic)
             JSON_ATTR_STRING("type", "any")
+            JSON_ATTR_STRING("encoding", payloadFormatName(port.format))
             JSON_ATTR_ENDNULL("_")
         + "    }";
         if (i < (int)ports.size()-1) {
-            str =+ ",";
+            str += ",";
         }
     }
     return str;
@@ -107,98 +186,519 @@ std::string msgfloDiscoveryMessage(const ParticipantInfo *info) {
 }
 
 
+// Receives events from a MqttClient. Called on the client's I/O thread, one at a time
+class MqttClientHandler {
+public:
+    virtual ~MqttClientHandler() {}
+    virtual void mqttConnected() = 0;
+    virtual void mqttMessage(const char *topic, const uint8_t *payload, size_t length) = 0;
+};
+
+/* Connection to an MQTT broker, as used by MqttMount.
+ * start() runs the client I/O on a thread of its own. publish() and subscribe() can be called from any thread */
+class MqttClient {
+public:
+    virtual ~MqttClient() {}
+    virtual void setHandler(MqttClientHandler *handler) = 0;
+    virtual bool connect() = 0;
+    virtual bool start() = 0;
+    virtual void stop() = 0;
+    virtual bool subscribe(const char *topic, int qos) = 0;
+    virtual bool publish(const char *topic, const void *payload, size_t length, int qos) = 0;
+};
+
+
+// Finds exported ports by MQTT topic, or by the node and port a packet was sent from.
+// Open-addressing hash tables of indexes into the port list, so lookups do not allocate or scan.
+// Must be rebuilt if the port list changes
+class PortRouter {
+public:
+    PortRouter() : ports(NULL) {}
 
-const Port *
-findPortByTopic(const std::vector<Port> &ports, char *topic) {
-    for (std::vector<Port>::const_iterator it = ports.begin() ; it != ports.end(); ++it) {
-        const Port *port = &(*it);
-        if (port->topic == std::string(topic)) {
-            return port;
+    void build(const std::vector<Port> &p) {
+        ports = &p;
+        size_t size = 4;
+        while (size < 2*ports->size()) {
+            size *= 2;
+        }
+        byTopic.assign(size, -1);
+        byEdge.assign(size, -1);
+        topicHashes.resize(ports->size());
+        for (size_t i=0; i<ports->size(); i++) {
+            const Port &port = (*ports)[i];
+            topicHashes[i] = hashTopic(port.topic.c_str(), port.topic.size());
+            insert(byTopic, topicHashes[i], i);
+            insert(byEdge, hashEdge(port.node, port.port), i);
         }
     }
-    return NULL;
-}
 
-const Port *
-findPortByEdge(const std::vector<Port> &ports, MicroFlo::NodeId node, MicroFlo::PortId portId) {
-    for (std::vector<Port>::const_iterator it = ports.begin() ; it != ports.end(); ++it) {
-        const Port *port = &(*it);
-        if (port->node == node && port->port == portId) {
-            return port;
+    const Port *findByTopic(const char *topic) const {
+        return findByTopic(topic, strlen(topic));
+    }
+    const Port *findByTopic(const char *topic, size_t length) const {
+        if (!ports) {
+            return NULL;
+        }
+        const uint32_t hash = hashTopic(topic, length);
+        const size_t mask = byTopic.size()-1;
+        for (size_t slot = hash & mask; byTopic[slot] >= 0; slot = (slot+1) & mask) {
+            const Port &port = (*ports)[byTopic[slot]];
+            if (topicHashes[byTopic[slot]] == hash && port.topic.size() == length
+                    && memcmp(port.topic.data(), topic, length) == 0) {
+                return &port;
+            }
+        }
+        return NULL;
+    }
+
+    const Port *findByEdge(MicroFlo::NodeId node, MicroFlo::PortId portId) const {
+        if (!ports) {
+            return NULL;
         }
+        const size_t mask = byEdge.size()-1;
+        for (size_t slot = hashEdge(node, portId) & mask; byEdge[slot] >= 0; slot = (slot+1) & mask) {
+            const Port &port = (*ports)[byEdge[slot]];
+            if (port.node == node && port.port == portId) {
+                return &port;
+            }
+        }
+        return NULL;
+    }
+
+private:
+    // FNV-1a
+    static uint32_t hashTopic(const char *topic, size_t length) {
+        uint32_t hash = 2166136261u;
+        for (size_t i=0; i<length; i++) {
+            hash = (hash ^ (uint8_t)topic[i]) * 16777619u;
+        }
+        return hash;
+    }
+    static uint32_t hashEdge(MicroFlo::NodeId node, MicroFlo::PortId port) {
+        return ((uint32_t)node * 2654435761u) ^ ((uint8_t)port * 40503u);
+    }
+    static void insert(std::vector<int> &table, uint32_t hash, size_t index) {
+        const size_t mask = table.size()-1;
+        size_t slot = hash & mask;
+        while (table[slot] >= 0) {
+            slot = (slot+1) & mask;
+        }
+        table[slot] = index;
+    }
+
+private:
+    const std::vector<Port> *ports;
+    std::vector<int> byTopic;
+    std::vector<int> byEdge;
+    std::vector<uint32_t> topicHashes;
+};
+
+/* Packets as text, as used on MQTT/MsgFlo ports. Same format as commandstream dataLiteralToCommand:
+ * null, true, false, integers, floats, [ and ] for brackets, "Error: Name" for errors.
+ * Works on caller-provided buffers, so sending and receiving does not allocate */
+
+// Longest text encodePacket() produces, including the terminating 0
+#define MICROFLO_PACKET_TEXT_MAX 32
+
+static const char microfloErrorPrefix[] = "Error: ";
+
+// Writes @pkg into @buf, 0-terminated. Returns the length, or 0 if it did not fit in @size.
+// Also 0 for infinite and NaN floats, which have no JSON form
+size_t encodePacket(const Packet &pkg, char *buf, size_t size);
+// Parses one packet from @data, which does not need to be 0-terminated.
+// Leading and trailing whitespace is allowed, other trailing text gives MsgInvalid.
+// So do integers outside of long, and floats outside of float
+Packet decodePacket(const char *data, size_t length);
+
+namespace PacketText {
+    inline size_t writeLiteral(char *buf, size_t size, const char *literal) {
+        const size_t length = strlen(literal);
+        if (length+1 > size) {
+            return 0;
+        }
+        memcpy(buf, literal, length+1);
+        return length;
+    }
+
+    inline size_t writeInteger(char *buf, size_t size, long value) {
+        char digits[24];
+        size_t n = 0;
+        unsigned long v = (value < 0) ? 0UL-(unsigned long)value : (unsigned long)value;
+        do {
+            digits[n++] = '0' + (v % 10);
+            v /= 10;
+        } while (v);
+        const size_t length = n + (value < 0 ? 1 : 0);
+        if (length+1 > size) {
+            return 0;
+        }
+        char *out = buf;
+        if (value < 0) {
+            *out++ = '-';
+        }
+        while (n) {
+            *out++ = digits[--n];
+        }
+        *out = '\0';
+        return length;
+    }
+
+    // Not infinite or NaN. Comparisons, so it does not need C99 math
+    inline bool isFinite(double value) {
+        return value >= -FLT_MAX && value <= FLT_MAX;
     }
-    return NULL;
-}
 
-// C++ version of the logic in commandstream dataLiteralToCommand etc
-Packet decodePacket(const std::string &str) {
-    // TODO: handle floats
-    // MAYBE: handle hex and octal integers?
-    // TODO: handle (byte) streams sent as a single string
-    const long int10 = strtol(str.c_str(), NULL, 10);
-    if (str == "null") {
-        return Packet(); // void
-    } else if (str == "true") {
-        return Packet(true);
-    } else if (str == "false") {
-        return Packet(false);
-    } else if (str == "0") {
-        return Packet((long)0); // bad strtol error value..
-    } else if (int10 != 0) {
-        return Packet(int10);
-    } else if (str == "[") {
-        return Packet(MsgBracketStart);
-    } else if (str == "]") {
-        return Packet(MsgBracketEnd);
-
-    } else {
+    inline size_t writeFloat(char *buf, size_t size, float value) {
+        if (!isFinite(value)) {
+            return 0;
+        }
+        // 7 significant digits is what a float holds
+        const int written = snprintf(buf, size, "%.7g", (double)value);
+        if (written <= 0 || (size_t)written+1 > size) {
+            return 0;
+        }
+        size_t length = written;
+        // Keep it a float when read back, 2 must be 2.0
+        if (!strpbrk(buf, ".eE")) {
+            if (length+3 > size) {
+                return 0;
+            }
+            buf[length++] = '.';
+            buf[length++] = '0';
+            buf[length] = '\0';
+        }
+        return length;
+    }
+
+    inline size_t writeError(char *buf, size_t size, Error error) {
+        const size_t nErrors = sizeof(Error_names)/sizeof(Error_names[0]);
+        const char *name = ((size_t)error < nErrors && Error_names[error]) ? Error_names[error] : "Invalid error";
+        const size_t prefix = sizeof(microfloErrorPrefix)-1;
+        if (prefix+strlen(name)+1 > size) {
+            return 0;
+        }
+        memcpy(buf, microfloErrorPrefix, prefix);
+        return prefix + writeLiteral(buf+prefix, size-prefix, name);
+    }
+
+    inline bool isSpace(char c) {
+        return c == ' ' || c == '\t' || c == '\r' || c == '\n';
+    }
+    inline bool isDigit(char c) {
+        return c >= '0' && c <= '9';
+    }
+
+    // Token [start,end) equals @word
+    inline bool tokenIs(const char *start, const char *end, const char *word) {
+        const size_t length = strlen(word);
+        return (size_t)(end-start) == length && memcmp(start, word, length) == 0;
+    }
+
+    inline Packet parseNumber(const char *start, const char *end) {
+        const char *p = start;
+        bool negative = false;
+        if (p < end && (*p == '-' || *p == '+')) {
+            negative = (*p == '-');
+            p++;
+        }
+        // Magnitude of LONG_MIN is one more than LONG_MAX
+        const unsigned long limit = negative ? (unsigned long)LONG_MAX+1 : (unsigned long)LONG_MAX;
+        unsigned long integer = 0;
+        bool overflow = false;
+        bool digits = false;
+        for (; p < end && isDigit(*p); p++) {
+            const unsigned long digit = *p-'0';
+            overflow = overflow || integer > (limit-digit)/10;
+            integer = integer*10 + digit;
+            digits = true;
+        }
+        if (p == end) {
+            if (!digits || overflow) {
+                return Packet(MsgInvalid);
+            }
+            return Packet(negative ? (long)(0UL-integer) : (long)integer);
+        }
+
+        // Fraction and/or exponent, validate then let strtod do the conversion
+        bool isFloat = false;
+        if (*p == '.') {
+            p++;
+            for (; p < end && isDigit(*p); p++) {
+                digits = true;
+            }
+            isFloat = true;
+        }
+        if (digits && p < end && (*p == 'e' || *p == 'E')) {
+            p++;
+            if (p < end && (*p == '-' || *p == '+')) {
+                p++;
+            }
+            bool exponentDigits = false;
+            for (; p < end && isDigit(*p); p++) {
+                exponentDigits = true;
+            }
+            isFloat = exponentDigits;
+        }
+        char number[MICROFLO_PACKET_TEXT_MAX];
+        if (!isFloat || !digits || p != end || (size_t)(end-start) >= sizeof(number)) {
+            return Packet(MsgInvalid);
+        }
+        memcpy(number, start, end-start);
+        number[end-start] = '\0';
+        const double value = strtod(number, NULL);
+        if (!isFinite(value)) {
+            return Packet(MsgInvalid);
+        }
+        return Packet((float)value);
+    }
+
+    inline Packet parseError(const char *start, const char *end) {
+        // Error name is the last token, after the prefix
+        const size_t nErrors = sizeof(Error_names)/sizeof(Error_names[0]);
+        for (size_t i=0; i<nErrors; i++) {
+            if (Error_names[i] && tokenIs(start, end, Error_names[i])) {
+                return Packet((Error)i);
+            }
+        }
         return Packet(MsgInvalid);
     }
 }
 
-#ifdef ARDUINO
-#define MICROFLO_TO_STRING(v) std::string(String(v).c_str())
-#else
-#define MICROFLO_TO_STRING(v) std::to_string(v)
-#endif
-
-std::string encodePacket(const Packet &pkg) {
+size_t encodePacket(const Packet &pkg, char *buf, size_t size) {
+    using namespace PacketText;
     switch (pkg.type()) {
     case MsgVoid:
-        return "null";
+        return writeLiteral(buf, size, "null");
     case MsgBoolean:
-        return pkg.asBool() ? "true" : "false";
+        return writeLiteral(buf, size, pkg.asBool() ? "true" : "false");
     case MsgInteger:
-        return MICROFLO_TO_STRING(pkg.asInteger());
+        return writeInteger(buf, size, pkg.asInteger());
     case MsgByte:
-        return MICROFLO_TO_STRING(pkg.asByte());
+        return writeInteger(buf, size, pkg.asByte()); // comes back as integer
     case MsgFloat:
-        return MICROFLO_TO_STRING(pkg.asFloat());
+        return writeFloat(buf, size, pkg.asFloat());
     case MsgError:
-        if (Error_names[pkg.asError()]) {
-            return std::string("Error: ") + Error_names[pkg.asError()];
-        } else {
-            return "Error: Invalid error";
-        }
-
-    // TOOD: handle brackets properly
+        return writeError(buf, size, pkg.asError());
     case MsgBracketStart:
-        return "[";
+        return writeLiteral(buf, size, "[");
     case MsgBracketEnd:
-        return "]";
+        return writeLiteral(buf, size, "]");
 
     // internal types
     case MsgMax:
     case MsgMaxDefined:
     case MsgTick:
     case MsgInvalid:
-        return "Invalid MicroFlo::Packet";
+        return writeLiteral(buf, size, "Invalid MicroFlo::Packet");
     default:
-        return "Error: Unknown MicroFlo::Packet type";
+        return writeLiteral(buf, size, "Error: Unknown MicroFlo::Packet type");
     }
+}
 
-    return ""; // above should be exclusive but compiler complains...
+Packet decodePacket(const char *data, size_t length) {
+    using namespace PacketText;
+    const char *start = data;
+    const char *end = data+length;
+    while (start < end && isSpace(*start)) {
+        start++;
+    }
+    while (end > start && isSpace(*(end-1))) {
+        end--;
+    }
+    if (start == end) {
+        return Packet(MsgInvalid);
+    }
+
+    switch (*start) {
+    case 'n':
+        return tokenIs(start, end, "null") ? Packet() : Packet(MsgInvalid);
+    case 't':
+        return tokenIs(start, end, "true") ? Packet(true) : Packet(MsgInvalid);
+    case 'f':
+        return tokenIs(start, end, "false") ? Packet(false) : Packet(MsgInvalid);
+    case '[':
+        return (end-start == 1) ? Packet(MsgBracketStart) : Packet(MsgInvalid);
+    case ']':
+        return (end-start == 1) ? Packet(MsgBracketEnd) : Packet(MsgInvalid);
+    case 'E': {
+        const size_t prefix = sizeof(microfloErrorPrefix)-1;
+        if ((size_t)(end-start) > prefix && memcmp(start, microfloErrorPrefix, prefix) == 0) {
+            return parseError(start+prefix, end);
+        }
+        return Packet(MsgInvalid);
+    }
+    default:
+        return parseNumber(start, end);
+    }
 }
 
+/* Packets as MessagePack, for ports using PayloadMsgPack.
+ * null, booleans, integers and floats are plain MessagePack, so any MessagePack reader understands them.
+ * Bytes, brackets and errors use fixext 1, with the Msg as extension type and the value as data.
+ * Floats are sent as float32, so they come back exactly */
+
+// Longest payload encodePacketMsgPack() produces
+#define MICROFLO_PACKET_MSGPACK_MAX 9
+
+// Writes @pkg into @buf. Returns the length, or 0 if it did not fit in @size or has no encoding
+size_t encodePacketMsgPack(const Packet &pkg, uint8_t *buf, size_t size);
+// Parses one packet from @data. Anything but exactly one supported value gives MsgInvalid
+Packet decodePacketMsgPack(const uint8_t *data, size_t length);
+
+namespace PacketMsgPack {
+    inline size_t writeBigEndian(uint8_t *buf, size_t size, uint8_t tag, uint64_t value, size_t bytes) {
+        if (1+bytes > size) {
+            return 0;
+        }
+        buf[0] = tag;
+        for (size_t i=0; i<bytes; i++) {
+            buf[bytes-i] = (uint8_t)(value >> (8*i));
+        }
+        return 1+bytes;
+    }
+
+    inline uint64_t readBigEndian(const uint8_t *data, size_t bytes) {
+        uint64_t value = 0;
+        for (size_t i=0; i<bytes; i++) {
+            value = (value << 8) | data[i];
+        }
+        return value;
+    }
+
+    inline size_t writeInteger(uint8_t *buf, size_t size, long value) {
+        if (value >= -32 && value <= 127) {
+            return writeBigEndian(buf, size, (uint8_t)value, 0, 0); // fixint
+        } else if (value >= -128 && value <= 127) {
+            return writeBigEndian(buf, size, 0xd0, (uint64_t)value, 1);
+        } else if (value >= -32768 && value <= 32767) {
+            return writeBigEndian(buf, size, 0xd1, (uint64_t)value, 2);
+        } else if (value >= -2147483647L-1 && value <= 2147483647L) {
+            return writeBigEndian(buf, size, 0xd2, (uint64_t)value, 4);
+        }
+        return writeBigEndian(buf, size, 0xd3, (uint64_t)value, 8);
+    }
 
+    inline size_t writeExt(uint8_t *buf, size_t size, Msg type, uint8_t value) {
+        if (size < 3) {
+            return 0;
+        }
+        buf[0] = 0xd4; // fixext 1
+        buf[1] = (uint8_t)type;
+        buf[2] = value;
+        return 3;
+    }
+
+    inline Packet readExt(uint8_t type, uint8_t value) {
+        switch (type) {
+        case MsgByte:
+            return Packet((unsigned char)value);
+        case MsgBracketStart:
+        case MsgBracketEnd:
+            return Packet((Msg)type);
+        case MsgError: {
+            const size_t nErrors = sizeof(Error_names)/sizeof(Error_names[0]);
+            return (value < nErrors && Error_names[value]) ? Packet((Error)value) : Packet(MsgInvalid);
+        }
+        default:
+            return Packet(MsgInvalid);
+        }
+    }
+}
+
+size_t encodePacketMsgPack(const Packet &pkg, uint8_t *buf, size_t size) {
+    using namespace PacketMsgPack;
+    switch (pkg.type()) {
+    case MsgVoid:
+        return writeBigEndian(buf, size, 0xc0, 0, 0);
+    case MsgBoolean:
+        return writeBigEndian(buf, size, pkg.asBool() ? 0xc3 : 0xc2, 0, 0);
+    case MsgInteger:
+        return writeInteger(buf, size, pkg.asInteger());
+    case MsgFloat: {
+        const float value = pkg.asFloat();
+        uint32_t bits;
+        memcpy(&bits, &value, sizeof(bits));
+        return writeBigEndian(buf, size, 0xca, bits, 4);
+    }
+    case MsgByte:
+        return writeExt(buf, size, MsgByte, pkg.asByte());
+    case MsgError:
+        return writeExt(buf, size, MsgError, (uint8_t)pkg.asError());
+    case MsgBracketStart:
+    case MsgBracketEnd:
+        return writeExt(buf, size, pkg.type(), 0);
+    default:
+        return 0;
+    }
+}
+
+Packet decodePacketMsgPack(const uint8_t *data, size_t length) {
+    using namespace PacketMsgPack;
+    if (length == 0) {
+        return Packet(MsgInvalid);
+    }
+    const uint8_t tag = data[0];
+    const uint8_t *value = data+1;
+    const size_t valueLength = length-1;
+    if (tag <= 0x7f) {
+        return (valueLength == 0) ? Packet((long)tag) : Packet(MsgInvalid);
+    } else if (tag >= 0xe0) {
+        return (valueLength == 0) ? Packet((long)(int8_t)tag) : Packet(MsgInvalid);
+    }
+
+    size_t expected = 0;
+    switch (tag) {
+    case 0xc0: case 0xc2: case 0xc3: expected = 0; break;
+    case 0xcc: case 0xd0: expected = 1; break;
+    case 0xcd: case 0xd1: case 0xd4: expected = 2; break;
+    case 0xca: case 0xce: case 0xd2: expected = 4; break;
+    case 0xcb: case 0xcf: case 0xd3: expected = 8; break;
+    default: return Packet(MsgInvalid);
+    }
+    if (valueLength != expected) {
+        return Packet(MsgInvalid);
+    }
+
+    const uint64_t raw = readBigEndian(value, expected);
+    switch (tag) {
+    case 0xc0: return Packet();
+    case 0xc2: return Packet(false);
+    case 0xc3: return Packet(true);
+    case 0xcc: case 0xcd: case 0xce: case 0xcf: return Packet((long)raw);
+    case 0xd0: return Packet((long)(int8_t)raw);
+    case 0xd1: return Packet((long)(int16_t)raw);
+    case 0xd2: return Packet((long)(int32_t)raw);
+    case 0xd3: return Packet((long)(int64_t)raw);
+    case 0xca: {
+        const uint32_t bits = (uint32_t)raw;
+        float f;
+        memcpy(&f, &bits, sizeof(f));
+        return Packet(f);
+    }
+    case 0xcb: {
+        double d;
+        memcpy(&d, &raw, sizeof(d));
+        return Packet((float)d);
+    }
+    case 0xd4: return readExt(value[0], value[1]);
+    default: return Packet(MsgInvalid);
+    }
+}
+
+// Encode/decode in the format configured for a port. @buf should be MICROFLO_PACKET_TEXT_MAX,
+// which also fits any MessagePack encoding
+inline size_t encodePayload(PayloadFormat format, const Packet &pkg, char *buf, size_t size) {
+    if (format == PayloadMsgPack) {
+        return encodePacketMsgPack(pkg, (uint8_t *)buf, size);
+    }
+    return encodePacket(pkg, buf, size);
+}
+
+inline Packet decodePayload(PayloadFormat format, const char *data, size_t length) {
+    if (format == PayloadMsgPack) {
+        return decodePacketMsgPack((const uint8_t *)data, length);
+    }
+    return decodePacket(data, length);
+}
 
+#endif // MICROFLO_MQTT_HPP
@@ -0,0 +1,39 @@
+/* MicroFlo - Flow-Based Programming for microcontrollers
+ * Copyright (c) 2016-2017 Jon Nordby <jononor@gmail.com>
+ * MicroFlo may be freely distributed under the MIT license
+ */
+
+// MQTT ports for the exported ports of the embedded graph.
+// Uses the graph metadata from `microflo generate --enable-maps`, so include after it
+
+#ifndef MICROFLO_MQTTGRAPHPORTS_HPP
+#define MICROFLO_MQTTGRAPHPORTS_HPP
+
+#include "./mqtt.hpp"
+
+// TODO: introspect from Network/cmdstream instead of graph metadata
+inline bool findPorts(ParticipantInfo *info) {
+    // FIXME: don't assume graph data is in 'graph_*'
+
+    // Exported ports
+    for (size_t i=0; i<graph_inports_length; i++) {
+        const char *name = graph_inports_name[i];
+        MicroFlo::PortId portId = graph_inports_port[i];
+        MicroFlo::NodeId nodeId = graph_inports_node[i];
+        info->addInport(name, nodeId, portId);
+    }
+    for (size_t i=0; i<graph_outports_length; i++) {
+        const char *name = graph_outports_name[i];
+        MicroFlo::PortId portId = graph_outports_port[i];
+        MicroFlo::NodeId nodeId = graph_outports_node[i];
+        info->addOutport(name, nodeId, portId);
+    }
+
+    // Graph name
+    // TODO: replace with command stream command for graph name
+    info->component = graph_name;
+
+    return true;
+}
+
+#endif // MICROFLO_MQTTGRAPHPORTS_HPP
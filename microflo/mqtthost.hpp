@@ -0,0 +1,235 @@
+/* MicroFlo - Flow-Based Programming for microcontrollers
+ * Copyright (c) 2016-2017 Jon Nordby <jononor@gmail.com>
+ * MicroFlo may be freely distributed under the MIT license
+ */
+
+// Many MqttMount instances in one process, sharing MQTT connection and threads
+
+#ifndef MICROFLO_MQTTHOST_HPP
+#define MICROFLO_MQTTHOST_HPP
+
+#include "./mqttmount.hpp"
+
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <mutex>
+#include <thread>
+
+class MqttClientMux;
+
+// A MqttMount's view of a shared connection. Created by MqttClientMux
+class MqttChannel : public MqttClient {
+public:
+    MqttChannel(MqttClientMux *m)
+        : mux(m)
+        , handler(NULL)
+    {
+    }
+
+    MqttClientHandler *messageHandler() const { return handler; }
+
+    // implements MqttClient
+    virtual void setHandler(MqttClientHandler *h) {
+        handler = h;
+    }
+    // Connection is owned by the mux
+    virtual bool connect() {
+        return true;
+    }
+    virtual bool start() {
+        return true;
+    }
+    virtual void stop() {}
+    virtual bool subscribe(const char *topic, int qos);
+    virtual bool publish(const char *topic, const void *payload, size_t length, int qos);
+
+private:
+    MqttClientMux *mux;
+    MqttClientHandler *handler;
+};
+
+/* Shares one MqttClient between several MqttMounts, each using a MqttChannel.
+ * Messages go to the channels subscribed to the exact topic */
+class MqttClientMux : public MqttClientHandler {
+public:
+    MqttClientMux(MqttClient *c)
+        : client(c)
+    {
+        client->setHandler(this);
+    }
+
+    ~MqttClientMux() {
+        for (size_t i=0; i<channels.size(); i++) {
+            delete channels[i];
+        }
+    }
+
+    // Owned by the mux. Create all before start()
+    MqttChannel *createChannel() {
+        MqttChannel *channel = new MqttChannel(this);
+        channels.push_back(channel);
+        return channel;
+    }
+
+    bool connect() {
+        return client->connect();
+    }
+    bool start() {
+        return client->start();
+    }
+    void stop() {
+        client->stop();
+    }
+
+    // implements MqttClientHandler
+    virtual void mqttConnected() {
+        for (size_t i=0; i<channels.size(); i++) {
+            MqttClientHandler *handler = channels[i]->messageHandler();
+            if (handler) {
+                handler->mqttConnected();
+            }
+        }
+    }
+
+    virtual void mqttMessage(const char *topic, const uint8_t *payload, size_t length) {
+        topicBuffer.assign(topic);
+        // Handlers are called without the lock, so a slow one does not hold up subscribe()
+        targets.clear();
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            const std::pair<Routes::iterator, Routes::iterator> range = routes.equal_range(topicBuffer);
+            for (Routes::iterator it = range.first; it != range.second; ++it) {
+                targets.push_back(it->second);
+            }
+        }
+        for (size_t i=0; i<targets.size(); i++) {
+            MqttClientHandler *handler = targets[i]->messageHandler();
+            if (handler) {
+                handler->mqttMessage(topic, payload, length);
+            }
+        }
+    }
+
+public:
+    // Used by MqttChannel
+    bool subscribe(MqttChannel *channel, const char *topic, int qos) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            const std::pair<Routes::iterator, Routes::iterator> range = routes.equal_range(topic);
+            bool known = false;
+            for (Routes::iterator it = range.first; it != range.second; ++it) {
+                known = known || (it->second == channel);
+            }
+            if (!known) {
+                routes.insert(std::make_pair(std::string(topic), channel));
+            }
+        }
+        // Subscribed again on reconnect, broker deduplicates
+        return client->subscribe(topic, qos);
+    }
+
+    bool publish(const char *topic, const void *payload, size_t length, int qos) {
+        return client->publish(topic, payload, length, qos);
+    }
+
+private:
+    typedef std::unordered_multimap<std::string, MqttChannel *> Routes;
+
+    MqttClient *client;
+    std::vector<MqttChannel *> channels;
+    Routes routes;
+    std::string topicBuffer; // only used on client thread, avoids allocating per message
+    std::vector<MqttChannel *> targets; // likewise
+    std::mutex mutex;
+};
+
+inline bool MqttChannel::subscribe(const char *topic, int qos) {
+    return mux->subscribe(this, topic, qos);
+}
+
+inline bool MqttChannel::publish(const char *topic, const void *payload, size_t length, int qos) {
+    return mux->publish(topic, payload, length, qos);
+}
+
+/* Runs many MqttMounts on a fixed pool of worker threads.
+ * Each mount belongs to one worker, which steps its mounts in turn and publishes their output.
+ * A worker sleeps when none of its mounts has work, until an inbound message arrives or @idleWaitMicros */
+class MqttTenantHost {
+public:
+    MqttTenantHost(int workers, int idleWaitMicros=1000)
+        : idleWaitMicros(idleWaitMicros)
+        , stopRequested(false)
+    {
+        const int n = (workers > 0) ? workers : 1;
+        for (int i=0; i<n; i++) {
+            wakeups.push_back(new MqttWakeup());
+        }
+    }
+
+    ~MqttTenantHost() {
+        for (size_t i=0; i<wakeups.size(); i++) {
+            delete wakeups[i];
+        }
+    }
+
+    // Add all mounts before run(), and before connecting them
+    void add(MqttMount *mount) {
+        mount->setWakeup(wakeups[mounts.size() % wakeups.size()]);
+        mounts.push_back(mount);
+    }
+
+    size_t size() const { return mounts.size(); }
+
+    // Runs all mounts until stop()
+    void run() {
+        std::vector<std::thread> workers;
+        for (size_t i=0; i<wakeups.size(); i++) {
+            workers.push_back(std::thread(&MqttTenantHost::work, this, i));
+        }
+        for (size_t i=0; i<workers.size(); i++) {
+            workers[i].join();
+        }
+    }
+
+    // Makes run() return. Can be called from any thread
+    void stop() {
+        stopRequested.store(true);
+        for (size_t i=0; i<wakeups.size(); i++) {
+            wakeups[i]->wake(true);
+        }
+    }
+
+private:
+    void work(size_t worker) {
+        const size_t stride = wakeups.size();
+        MqttWakeup *wakeup = wakeups[worker];
+        while (!stopRequested.load()) {
+            bool busy = false;
+            for (size_t i=worker; i<mounts.size(); i+=stride) {
+                busy = mounts[i]->step() || busy;
+                mounts[i]->flushOutbound();
+            }
+            if (busy) {
+                continue;
+            }
+            wakeup->prepare();
+            bool pending = false;
+            for (size_t i=worker; i<mounts.size() && !pending; i+=stride) {
+                pending = mounts[i]->hasWork();
+            }
+            if (!pending) {
+                wakeup->wait(idleWaitMicros);
+            }
+            wakeup->done();
+        }
+    }
+
+private:
+    int idleWaitMicros;
+    std::atomic<bool> stopRequested;
+    std::vector<MqttWakeup *> wakeups;
+    std::vector<MqttMount *> mounts;
+};
+
+#endif // MICROFLO_MQTTHOST_HPP
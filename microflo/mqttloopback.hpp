@@ -0,0 +1,212 @@
+/* MicroFlo - Flow-Based Programming for microcontrollers
+ * Copyright (c) 2016-2017 Jon Nordby <jononor@gmail.com>
+ * MicroFlo may be freely distributed under the MIT license
+ */
+
+// In-process MQTT, for testing and benchmarking MqttMount without a broker
+
+#ifndef MICROFLO_MQTTLOOPBACK_HPP
+#define MICROFLO_MQTTLOOPBACK_HPP
+
+#include "./mqtt.hpp"
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+
+class LoopbackMqttClient;
+
+/* Routes messages between LoopbackMqttClient instances.
+ * Topics must match exactly, wildcards are not supported.
+ * Everything is delivered in publish order from a single thread, like a client I/O thread would */
+class LoopbackMqttBroker {
+public:
+    LoopbackMqttBroker()
+        : closed(false)
+        , deliveredCount(0)
+    {
+        thread = std::thread(&LoopbackMqttBroker::deliverLoop, this);
+    }
+
+    ~LoopbackMqttBroker() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            closed = true;
+        }
+        available.notify_all();
+        thread.join();
+    }
+
+    // Number of clients subscribed to @topic
+    int subscribers(const char *topic) {
+        std::lock_guard<std::mutex> lock(mutex);
+        int count = 0;
+        for (size_t i=0; i<subscriptions.size(); i++) {
+            count += (subscriptions[i].topic == topic) ? 1 : 0;
+        }
+        return count;
+    }
+
+    unsigned long delivered() {
+        std::lock_guard<std::mutex> lock(mutex);
+        return deliveredCount;
+    }
+
+public:
+    // Used by LoopbackMqttClient
+    void subscribe(LoopbackMqttClient *client, const char *topic) {
+        std::lock_guard<std::mutex> lock(mutex);
+        Subscription s = { client, topic };
+        subscriptions.push_back(s);
+    }
+
+    void unsubscribeAll(LoopbackMqttClient *client) {
+        std::lock_guard<std::mutex> lock(mutex);
+        for (size_t i=subscriptions.size(); i>0; i--) {
+            if (subscriptions[i-1].client == client) {
+                subscriptions.erase(subscriptions.begin()+(i-1));
+            }
+        }
+    }
+
+    // Queues a connected notification for @client. Delivered in order with messages
+    void connected(LoopbackMqttClient *client) {
+        Delivery d;
+        d.connected = client;
+        enqueue(d);
+    }
+
+    void publish(const char *topic, const void *payload, size_t length) {
+        Delivery d;
+        d.connected = NULL;
+        d.topic = topic;
+        d.payload.assign((const uint8_t *)payload, (const uint8_t *)payload+length);
+        enqueue(d);
+    }
+
+private:
+    struct Subscription {
+        LoopbackMqttClient *client;
+        std::string topic;
+    };
+    struct Delivery {
+        LoopbackMqttClient *connected; // if set, a connect notification instead of a message
+        std::string topic;
+        std::vector<uint8_t> payload;
+    };
+
+    void enqueue(const Delivery &d) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            queue.push_back(d);
+        }
+        available.notify_one();
+    }
+
+    void deliverLoop();
+
+private:
+    std::vector<Subscription> subscriptions;
+    std::deque<Delivery> queue;
+    bool closed;
+    unsigned long deliveredCount;
+    std::mutex mutex;
+    std::condition_variable available;
+    std::thread thread;
+};
+
+// MqttClient connected to a LoopbackMqttBroker. Handler is called on the broker thread.
+// Stop it before destroying, so no delivery is in progress
+class LoopbackMqttClient : public MqttClient {
+public:
+    LoopbackMqttClient(LoopbackMqttBroker *b)
+        : broker(b)
+        , handler(NULL)
+        , running(false)
+    {
+    }
+
+    ~LoopbackMqttClient() {
+        broker->unsubscribeAll(this);
+    }
+
+    MqttClientHandler *messageHandler() const { return running ? handler : NULL; }
+
+    // implements MqttClient
+    virtual void setHandler(MqttClientHandler *h) {
+        handler = h;
+    }
+    virtual bool connect() {
+        return true;
+    }
+    virtual bool start() {
+        running = true;
+        broker->connected(this);
+        return true;
+    }
+    virtual void stop() {
+        running = false;
+        broker->unsubscribeAll(this);
+    }
+    virtual bool subscribe(const char *topic, int qos) {
+        broker->subscribe(this, topic);
+        return true;
+    }
+    virtual bool publish(const char *topic, const void *payload, size_t length, int qos) {
+        broker->publish(topic, payload, length);
+        return true;
+    }
+
+private:
+    LoopbackMqttBroker *broker;
+    MqttClientHandler *handler;
+    std::atomic<bool> running;
+};
+
+inline void LoopbackMqttBroker::deliverLoop() {
+    std::vector<LoopbackMqttClient *> targets;
+    while (true) {
+        Delivery d;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            available.wait(lock, [this] { return !queue.empty() || closed; });
+            if (queue.empty()) {
+                return;
+            }
+            d.connected = queue.front().connected;
+            d.topic.swap(queue.front().topic);
+            d.payload.swap(queue.front().payload);
+            queue.pop_front();
+
+            // Handlers may subscribe or publish, so are called without the lock held
+            targets.clear();
+            for (size_t i=0; i<subscriptions.size() && !d.connected; i++) {
+                if (subscriptions[i].topic == d.topic) {
+                    targets.push_back(subscriptions[i].client);
+                }
+            }
+        }
+
+        if (d.connected) {
+            MqttClientHandler *handler = d.connected->messageHandler();
+            if (handler) {
+                handler->mqttConnected();
+            }
+            continue;
+        }
+        for (size_t i=0; i<targets.size(); i++) {
+            MqttClientHandler *handler = targets[i]->messageHandler();
+            if (handler) {
+                handler->mqttMessage(d.topic.c_str(), d.payload.empty() ? NULL : &d.payload[0], d.payload.size());
+            }
+        }
+        std::lock_guard<std::mutex> lock(mutex);
+        deliveredCount += targets.size();
+    }
+}
+
+#endif // MICROFLO_MQTTLOOPBACK_HPP
@@ -0,0 +1,418 @@
+/* MicroFlo - Flow-Based Programming for microcontrollers
+ * Copyright (c) 2016-2017 Jon Nordby <jononor@gmail.com>
+ * MicroFlo may be freely distributed under the MIT license
+ */
+
+// MsgFlo participant for a Network on Linux, independent of the MQTT client library
+
+#ifndef MICROFLO_MQTTMOUNT_HPP
+#define MICROFLO_MQTTMOUNT_HPP
+
+#include "./mqtt.hpp"
+#include "./mqttqueue.hpp"
+
+#include <string>
+#include <vector>
+#include <atomic>
+#include <thread>
+
+#include <stdint.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <string.h>
+#include <time.h>
+
+#ifdef MICROFLO_LINUX_DEBUG
+#define LOG(...) do { printf(__VA_ARGS__); } while (0)
+#else
+#define LOG(...)
+#endif
+
+struct MqttOptions {
+    int brokerPort;
+    char * brokerHostname;
+    int keepaliveSeconds;
+    char * clientId;
+    ParticipantInfo info;
+    int discoveryInterval; // seconds
+    int idleWaitMicros; // longest sleep when network has nothing to do
+    std::string binaryPorts; // names of ports using MessagePack payloads, or "*"
+    std::string qos1Ports; // names of ports publishing with QoS 1
+    std::string qos2Ports;
+    std::string coalescePorts; // names of ports where queued packets are replaced by newer
+    int outboundQueueLength; // packets waiting to be published, at most
+    MqttDropPolicy outboundDropPolicy;
+};
+
+// Everything but broker address and port names
+void mqttDefaultOptions(MqttOptions *options) {
+    options->brokerHostname = NULL;
+    options->brokerPort = 1883;
+    options->keepaliveSeconds = 60;
+    options->discoveryInterval = 60;
+    options->idleWaitMicros = 1000;
+    options->outboundQueueLength = 64;
+    options->outboundDropPolicy = MqttDropOldest;
+    options->clientId = NULL; // MQTT will autogenerate
+    options->info.role = "micro";
+    options->info.component = "MicroFloDevice";
+    options->info.icon = "lightbulb-o";
+}
+
+#ifndef MICROFLO_MQTT_INBOUND_QUEUE
+#define MICROFLO_MQTT_INBOUND_QUEUE 256 // entries, must be power of two
+#endif
+#ifndef MICROFLO_MQTT_INBOUND_PER_TICK
+#define MICROFLO_MQTT_INBOUND_PER_TICK 8
+#endif
+#ifndef MICROFLO_MQTT_HOST_CHUNK
+#define MICROFLO_MQTT_HOST_CHUNK 32
+#endif
+
+// Message received on the MQTT thread, to be handled on the network thread
+struct MqttInbound {
+    enum Kind {
+        ToPort = 0,
+        FromHost
+    };
+    uint8_t kind;
+    uint8_t length; // of bytes, when FromHost
+    MicroFlo::NodeId node;
+    MicroFlo::PortId port;
+    Packet packet;
+    uint8_t bytes[MICROFLO_MQTT_HOST_CHUNK];
+};
+
+/* Exposes a Network on MQTT, for MsgFlo. Talks to the broker via a MqttClient.
+ * MQTT I/O runs on the client thread, the network on the thread calling run().
+ * Inbound messages are passed over a lock-free queue, and wake up the network thread if sleeping.
+ * Outbound packets go via a bounded MqttOutbox to a publisher thread, so a slow broker cannot stall the graph.
+ * Everything touching the Network happens on the network thread */
+class MqttMount : public HostCommunication, public MqttClientHandler {
+
+public:
+    static bool runForever(MqttMount *mount) {
+        return mount->run();
+    }
+
+public:
+    MqttMount(Network *net, MqttClient *c, const MqttOptions &o)
+        : HostCommunication()
+        , network(net)
+        , options(o)
+        , client(c)
+        , discoveryMessageSent(0)
+        , inboundDropCount(0)
+        , wakeup(&ownWakeup)
+        , discoveryRequested(false)
+        , stopRequested(false)
+        , outbox(o.outboundQueueLength, o.outboundDropPolicy)
+    {
+        network->setNotificationHandler(this);
+        microfloReceiveTopic = options.info.role + "/microflo/receive";
+        microfloSendTopic = options.info.role + "/microflo/send";
+    }
+
+    bool connect() {
+        setupPorts();
+        client->setHandler(this);
+        return client->connect();
+    }
+    void disconnect() {} // TODO: implement
+
+    // Runs the network until stop(). Returns false if client could not be started
+    bool run() {
+        if (!client->start()) {
+            LOG("failed to start MQTT client\n");
+            return false;
+        }
+        publisher = std::thread(&MqttMount::publishOutbound, this);
+
+        while (!stopRequested.load()) {
+            step();
+            if (network->isIdle()) {
+                waitForInbound(options.idleWaitMicros);
+            }
+        }
+
+        client->stop();
+        outbox.close();
+        publisher.join();
+        return true;
+    }
+
+    // Makes run() return. Can be called from any thread
+    void stop() {
+        stopRequested.store(true);
+        wakeup->wake(true);
+    }
+
+    /* For driving the mount from elsewhere than run(), like MqttTenantHost.
+     * Then nothing publishes in the background, call flushOutbound() after step() */
+
+    // Runs one network tick. Returns true if there is more to do
+    bool step() {
+        processInbound();
+        network->runTick();
+        checkSendDiscovery();
+        return hasWork();
+    }
+
+    bool hasWork() {
+        return !network->isIdle() || !inbound.empty();
+    }
+
+    // Publishes everything queued, on calling thread
+    void flushOutbound() {
+        MqttOutbound out;
+        while (outbox.pop(&out, 0)) {
+            publishOne(out);
+        }
+    }
+
+    // Inbound messages wake @w instead of the mount's own. Set before connect()
+    void setWakeup(MqttWakeup *w) {
+        wakeup = w;
+    }
+
+    // Hand messages received on MQTT thread over to network. Call on network thread.
+    // Limited per tick, so that a burst does not overflow the network message queue
+    void processInbound() {
+        MqttInbound in;
+        for (int i=0; i<MICROFLO_MQTT_INBOUND_PER_TICK && inbound.pop(&in); i++) {
+            if (in.kind == MqttInbound::FromHost) {
+                this->parseBytes(in.bytes, in.length);
+            } else {
+                network->sendMessageTo(in.node, in.port, in.packet);
+            }
+        }
+    }
+
+    // Sleep until a message arrives, or at most @timeoutMicros. Call on network thread
+    void waitForInbound(int timeoutMicros) {
+        wakeup->prepare();
+        if (inbound.empty()) {
+            wakeup->wait(timeoutMicros);
+        }
+        wakeup->done();
+    }
+
+public:
+    // implements MqttClientHandler, called on MQTT thread
+    virtual void mqttConnected() {
+        subscribePorts();
+        subscribeHostTransport();
+        discoveryRequested.store(true);
+    }
+
+    virtual void mqttMessage(const char *topic, const uint8_t *payload, size_t length) {
+        LOG("got MQTT message on topic %s: %.*s\n", topic, (int)length, (const char *)payload);
+
+        MqttInbound in;
+        if (microfloReceiveTopic == topic) {
+            // XXX: does not go via Transport
+            in.kind = MqttInbound::FromHost;
+            // All chunks or none, as a partial command would make the host protocol lose sync
+            const size_t chunks = (length + MICROFLO_MQTT_HOST_CHUNK-1) / MICROFLO_MQTT_HOST_CHUNK;
+            if (chunks > inbound.space()) {
+                inboundDropCount.fetch_add(1);
+                LOG("inbound MQTT queue full, dropped host message\n");
+                wakeup->wake();
+                return;
+            }
+            for (size_t offset=0; offset<length; offset+=MICROFLO_MQTT_HOST_CHUNK) {
+                const size_t remaining = length-offset;
+                in.length = (remaining < MICROFLO_MQTT_HOST_CHUNK) ? remaining : MICROFLO_MQTT_HOST_CHUNK;
+                memcpy(in.bytes, payload+offset, in.length);
+                pushInbound(in);
+            }
+            return;
+        }
+
+        const Port *port = inportRoutes.findByTopic(topic);
+        if (port) {
+            LOG("sending to %d %d \n", port->node, port->port);
+            in.kind = MqttInbound::ToPort;
+            in.node = port->node;
+            in.port = port->port;
+            in.packet = decodePayload(port->format, (const char *)payload, length);
+            pushInbound(in);
+        } else {
+            LOG("Failed to find port for MQTT topic: %s\n", topic);
+        }
+    }
+
+    // implements NetworkNotificationHandler
+    virtual void packetSent(const Message &m, const Component *sender, MicroFlo::PortId senderPort) {
+        HostCommunication::packetSent(m, sender, senderPort);
+
+        const MicroFlo::NodeId senderId = sender->id();
+        //LOG("packet sent %d\n", senderId);
+
+        const Port * port = outportRoutes.findByEdge(senderId, senderPort);
+        if (port) {
+            char data[MICROFLO_PACKET_TEXT_MAX];
+            const size_t length = encodePayload(port->format, m.pkg, data, sizeof(data));
+            if (length == 0) {
+                LOG("no MQTT encoding for packet to %s\n", port->topic.c_str());
+            } else if (outbox.push(port, data, length)) {
+                LOG("queued on MQTT topic %s: %d bytes\n", port->topic.c_str(), (int)length);
+            } else {
+                LOG("outbound MQTT queue full, dropped packet to %s\n", port->topic.c_str());
+            }
+        } else {
+            LOG("no MQTT topic associated\n");
+        }
+    }
+
+    MqttOutboundStats outboundStatistics() {
+        return outbox.statistics();
+    }
+
+    // Messages dropped because the network thread did not keep up
+    unsigned long inboundDropped() const {
+        return inboundDropCount.load();
+    }
+
+    void sendToHost(const uint8_t *buf, uint8_t len) {
+        if (!client->publish(microfloSendTopic.c_str(), buf, len, 0)) {
+            LOG("failed to send microflo command on MQTT\n");
+        }
+    }
+
+private:
+    // Runs on publisher thread until outbox is closed
+    void publishOutbound() {
+        MqttOutbound out;
+        while (outbox.pop(&out)) {
+            publishOne(out);
+        }
+    }
+
+    void publishOne(const MqttOutbound &out) {
+        const bool sent = client->publish(out.port->topic.c_str(), out.data, out.length, out.port->qos);
+        outbox.published(sent);
+        if (!sent) {
+            LOG("failed to publish on MQTT topic %s\n", out.port->topic.c_str());
+        }
+    }
+
+    // Drops when queue is full, so a flood cannot stall the MQTT thread and with it other mounts.
+    // Host messages check for room first, so this only drops them whole
+    void pushInbound(const MqttInbound &in) {
+        if (!inbound.push(in)) {
+            inboundDropCount.fetch_add(1);
+            LOG("inbound MQTT queue full, dropped message\n");
+        }
+        wakeup->wake();
+    }
+
+    // Routes are only read after this, so are safe to use from both threads
+    void setupPorts() {
+        inportRoutes.build(options.info.inports);
+        outportRoutes.build(options.info.outports);
+        for (std::vector<Port>::iterator it = options.info.outports.begin() ; it != options.info.outports.end(); ++it) {
+            const Port &port = *it;
+            network->subscribeToPort(port.node, port.port, true);
+            LOG("setup outport to MQTT topic: %s\n", port.topic.c_str());
+        }
+    }
+
+    void subscribePorts() {
+        for (std::vector<Port>::iterator it = options.info.inports.begin() ; it != options.info.inports.end(); ++it) {
+            const Port &port = *it;
+            const char *pattern = port.topic.c_str();
+            client->subscribe(pattern, port.qos);
+            LOG("subscribed inport to MQTT topic: %s\n", pattern);
+        }
+    }
+
+    void subscribeHostTransport() {
+        const char *pattern = microfloReceiveTopic.c_str();
+        client->subscribe(pattern, 0);
+        LOG("subscribed host to MQTT topic: %s\n", pattern);
+    }
+
+    void checkSendDiscovery() {
+        const float sendInterval = options.discoveryInterval/2.5f;
+        const float secondsSinceLast = difftime(time(NULL), discoveryMessageSent); 
+        if (secondsSinceLast >= sendInterval || discoveryRequested.exchange(false)) {
+            discoveryMessageSent = time(NULL);
+            sendDiscovery();
+            const MqttOutboundStats stats = outbox.statistics();
+            LOG("MQTT outbound: %lu queued, %lu coalesced, %lu dropped, %lu sent, %lu failed. Inbound: %lu dropped\n",
+                stats.queued, stats.coalesced, stats.dropped, stats.sent, stats.failed, inboundDropped());
+            (void)stats;
+        }
+    }
+
+    void sendDiscovery() {
+        const std::string msgfloDiscoveryTopic = "fbp";
+        publish(msgfloDiscoveryTopic, msgfloDiscoveryMessage(&options.info));
+        LOG("sent MsgFlo discovery message\n");
+    }
+
+    void publish(std::string topic, std::string payload) {
+        if (!client->publish(topic.c_str(), payload.c_str(), payload.size(), 0)) {
+            LOG("failed to publish on MQTT topic %s\n", topic.c_str());
+        }
+    }
+
+private:
+    Network *network;
+    MqttOptions options;
+    MqttClient *client;
+    time_t discoveryMessageSent;
+    std::string microfloReceiveTopic;
+    std::string microfloSendTopic;
+    PortRouter inportRoutes;
+    PortRouter outportRoutes;
+    SpscQueue<MqttInbound, MICROFLO_MQTT_INBOUND_QUEUE> inbound;
+    std::atomic<unsigned long> inboundDropCount;
+    MqttWakeup ownWakeup;
+    MqttWakeup *wakeup;
+    std::atomic<bool> discoveryRequested;
+    std::atomic<bool> stopRequested;
+    MqttOutbox outbox;
+    std::thread publisher;
+};
+
+// Apply port settings from options. Call after the ports have been added to options->info
+void mqttConfigurePorts(MqttOptions *options) {
+    ParticipantInfo &info = options->info;
+    if (!options->binaryPorts.empty()) {
+        info.setPayloadFormat(options->binaryPorts.c_str(), PayloadMsgPack);
+    }
+    if (!options->qos1Ports.empty()) {
+        info.setQos(options->qos1Ports.c_str(), 1);
+    }
+    if (!options->qos2Ports.empty()) {
+        info.setQos(options->qos2Ports.c_str(), 2);
+    }
+    if (!options->coalescePorts.empty()) {
+        info.setCoalesce(options->coalescePorts.c_str(), true);
+    }
+}
+
+class LinuxMqttHostTransport : public HostTransport {
+public:
+    LinuxMqttHostTransport() {
+        
+    }
+
+    // implements HostTransport
+    virtual void setup(IO *i, HostCommunication *c) {
+        mount = dynamic_cast<MqttMount *>(c);
+    }
+    virtual void runTick() {
+        // no-op, everything happens event-oriented
+    }
+    virtual void sendCommand(const uint8_t *buf, uint8_t len) {
+        mount->sendToHost(buf, len);
+    }
+
+private:
+    MqttMount *mount;
+};
+
+#endif // MICROFLO_MQTTMOUNT_HPP
@@ -0,0 +1,255 @@
+/* MicroFlo - Flow-Based Programming for microcontrollers
+ * Copyright (c) 2016-2017 Jon Nordby <jononor@gmail.com>
+ * MicroFlo may be freely distributed under the MIT license
+ */
+
+// Queues between the network thread and MQTT client threads. Needs C++11 and threads
+
+#ifndef MICROFLO_MQTTQUEUE_HPP
+#define MICROFLO_MQTTQUEUE_HPP
+
+#include "./mqtt.hpp"
+
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <vector>
+#include <string.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/eventfd.h>
+
+/* Ring buffer between exactly one producer and one consumer thread. Lock-free.
+ * push() fails when full, pop() when empty */
+template <typename T, size_t Size>
+class SpscQueue {
+public:
+    SpscQueue() : head(0), tail(0) {}
+
+    bool push(const T &item) {
+        const size_t t = tail.load(std::memory_order_relaxed);
+        if (t - head.load(std::memory_order_acquire) == Size) {
+            return false;
+        }
+        items[t & (Size-1)] = item;
+        tail.store(t+1, std::memory_order_release);
+        return true;
+    }
+
+    bool pop(T *item) {
+        const size_t h = head.load(std::memory_order_relaxed);
+        if (h == tail.load(std::memory_order_acquire)) {
+            return false;
+        }
+        *item = items[h & (Size-1)];
+        head.store(h+1, std::memory_order_release);
+        return true;
+    }
+
+    bool empty() const {
+        return head.load(std::memory_order_acquire) == tail.load(std::memory_order_acquire);
+    }
+
+    // Free slots. Exact on the producer thread, since the consumer can only make more room
+    size_t space() const {
+        return Size - (tail.load(std::memory_order_relaxed) - head.load(std::memory_order_acquire));
+    }
+
+private:
+    T items[Size];
+    std::atomic<size_t> head;
+    std::atomic<size_t> tail;
+};
+
+
+/* Lets a thread sleep until another has work for it.
+ * Sleeper: prepare(), check for work, wait() only if there is none, then done().
+ * Waker: make work available, then wake(). Only costs a syscall if the other thread is sleeping */
+class MqttWakeup {
+public:
+    MqttWakeup()
+        : fd(eventfd(0, EFD_NONBLOCK))
+        , sleeping(false)
+    {
+    }
+    ~MqttWakeup() {
+        close(fd);
+    }
+
+    void prepare() {
+        sleeping.store(true);
+        std::atomic_thread_fence(std::memory_order_seq_cst); // pairs with wake()
+    }
+
+    void wait(int timeoutMicros) {
+        struct pollfd p = { fd, POLLIN, 0 };
+        const struct timespec timeout = { timeoutMicros/1000000, (long)(timeoutMicros%1000000)*1000 };
+        ppoll(&p, 1, &timeout, NULL);
+    }
+
+    void done() {
+        sleeping.store(false);
+        uint64_t wakeups;
+        const ssize_t cleared = read(fd, &wakeups, sizeof(wakeups));
+        (void)cleared;
+    }
+
+    // @force also wakes if not yet sleeping, so the next wait() returns immediately
+    void wake(bool force=false) {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (force || sleeping.load()) {
+            const uint64_t one = 1;
+            const ssize_t written = write(fd, &one, sizeof(one));
+            (void)written;
+        }
+    }
+
+private:
+    int fd;
+    std::atomic<bool> sleeping;
+};
+
+enum MqttDropPolicy {
+    MqttDropNewest = 0, // keep what is queued, drop the packet being sent
+    MqttDropOldest // make room by dropping the packet that has waited longest
+};
+
+struct MqttOutbound {
+    const Port *port;
+    uint8_t length;
+    char data[MICROFLO_PACKET_TEXT_MAX];
+};
+
+struct MqttOutboundStats {
+    unsigned long queued; // accepted by push()
+    unsigned long coalesced; // replaced a packet already queued for same port
+    unsigned long dropped; // because queue was full
+    unsigned long sent; // published successfully
+    unsigned long failed; // publish returned an error
+};
+
+/* Bounded queue of encoded packets to publish.
+ * The network thread pushes, and never waits. A publisher thread pops, and waits for work.
+ * Ports with Port.coalesce keep at most one packet queued: a new packet replaces the payload of a
+ * queued one instead, so a burst becomes a single publish of the latest value */
+class MqttOutbox {
+public:
+    MqttOutbox(size_t capacity=64, MqttDropPolicy policy=MqttDropOldest)
+        : items(capacity ? capacity : 1)
+        , head(0)
+        , count(0)
+        , policy(policy)
+        , closed(false)
+    {
+        memset(&stats, 0, sizeof(stats));
+    }
+
+    // Returns false if the packet was dropped
+    bool push(const Port *port, const char *data, size_t length) {
+        if (length > MICROFLO_PACKET_TEXT_MAX) {
+            return false;
+        }
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            MqttOutbound *slot = port->coalesce ? findQueued(port) : NULL;
+            if (slot) {
+                stats.coalesced++;
+            } else {
+                if (count == items.size()) {
+                    stats.dropped++;
+                    if (policy == MqttDropNewest) {
+                        return false;
+                    }
+                    head = (head+1) % items.size();
+                    count--;
+                }
+                slot = &items[(head+count) % items.size()];
+                count++;
+            }
+            slot->port = port;
+            slot->length = length;
+            memcpy(slot->data, data, length);
+            stats.queued++;
+        }
+        available.notify_one();
+        return true;
+    }
+
+    // Waits until a packet is available, or the outbox is closed. Returns false if closed and empty
+    bool pop(MqttOutbound *out) {
+        std::unique_lock<std::mutex> lock(mutex);
+        available.wait(lock, [this] { return count > 0 || closed; });
+        return takeLocked(out);
+    }
+
+    // Returns false if nothing became available within @timeoutMicros
+    bool pop(MqttOutbound *out, long timeoutMicros) {
+        std::unique_lock<std::mutex> lock(mutex);
+        available.wait_for(lock, std::chrono::microseconds(timeoutMicros),
+                           [this] { return count > 0 || closed; });
+        return takeLocked(out);
+    }
+
+    // Publisher reports the outcome of each popped packet
+    void published(bool success) {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (success) {
+            stats.sent++;
+        } else {
+            stats.failed++;
+        }
+    }
+
+    // Wakes up the publisher and makes pop() fail once empty
+    void close() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            closed = true;
+        }
+        available.notify_all();
+    }
+
+    size_t size() {
+        std::lock_guard<std::mutex> lock(mutex);
+        return count;
+    }
+
+    MqttOutboundStats statistics() {
+        std::lock_guard<std::mutex> lock(mutex);
+        return stats;
+    }
+
+private:
+    MqttOutbound *findQueued(const Port *port) {
+        for (size_t i=0; i<count; i++) {
+            MqttOutbound *item = &items[(head+i) % items.size()];
+            if (item->port == port) {
+                return item;
+            }
+        }
+        return NULL;
+    }
+
+    bool takeLocked(MqttOutbound *out) {
+        if (count == 0) {
+            return false;
+        }
+        *out = items[head];
+        head = (head+1) % items.size();
+        count--;
+        return true;
+    }
+
+private:
+    std::vector<MqttOutbound> items;
+    size_t head;
+    size_t count;
+    MqttDropPolicy policy;
+    bool closed;
+    MqttOutboundStats stats;
+    std::mutex mutex;
+    std::condition_variable available;
+};
+
+#endif // MICROFLO_MQTTQUEUE_HPP
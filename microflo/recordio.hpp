@@ -0,0 +1,493 @@
+/* MicroFlo - Flow-Based Programming for microcontrollers
+ * Copyright (c) 2013 Jon Nordby <jononor@gmail.com>
+ * MicroFlo may be freely distributed under the MIT license
+ */
+
+#ifndef MICROFLO_RECORDIO_HPP
+#define MICROFLO_RECORDIO_HPP
+
+#include "microflo.h"
+
+#include <stdio.h>
+#include <string.h>
+
+/* IO trace format, used by RecordingIO and ReplayIO
+ *
+ * Header: 'M','F','I','O', version
+ * Then one record per IO call: op, time since previous record in us, op arguments.
+ * Times and values are LEB128 varints, signed values zigzag encoded, pins and devices single bytes.
+ *
+ * Inputs (reads, timer, serial available/read) are what ReplayIO hands back to the graph.
+ * Outputs and configuration are recorded too, so a replay can report where the graph diverged.
+ */
+const uint8_t MICROFLO_IOTRACE_VERSION = 1;
+static const char MICROFLO_IOTRACE_MAGIC[4] = { 'M', 'F', 'I', 'O' };
+const size_t MICROFLO_IOTRACE_HEADER_SIZE = 5;
+const size_t MICROFLO_IOTRACE_MAX_RECORD = 64;
+#ifndef MICROFLO_IOTRACE_MAX_INTERRUPTS
+#define MICROFLO_IOTRACE_MAX_INTERRUPTS 16
+#endif
+
+namespace IoTrace {
+    enum Op {
+        SerialBegin = 1,
+        SerialDataAvailable,
+        SerialRead,
+        SerialWrite,
+        PinSetMode,
+        PinSetPullup,
+        DigitalWrite,
+        DigitalRead,
+        DigitalWriteMany,
+        DigitalReadMany,
+        AnalogRead,
+        PwmWrite,
+        TimerCurrentMs,
+        TimerCurrentMicros,
+        AttachExternalInterrupt,
+        Interrupt, // an interrupt handler was called
+        OpEnd
+    };
+
+    struct Record {
+        uint8_t op;
+        unsigned long delta; // us since previous record
+        uint8_t arg; // pin, serial device or interrupt
+        uint8_t count; // pins in pinList, or mode
+        MicroFlo::PinId pinList[32];
+        long value;
+    };
+
+    inline uint8_t *writeVarint(uint8_t *p, unsigned long v) {
+        while (v >= 0x80) {
+            *p++ = (v & 0x7f) | 0x80;
+            v >>= 7;
+        }
+        *p++ = v;
+        return p;
+    }
+    inline uint8_t *writeSigned(uint8_t *p, long v) {
+        const unsigned long zigzag = (v < 0) ? ~((unsigned long)v << 1) : ((unsigned long)v << 1);
+        return writeVarint(p, zigzag);
+    }
+    // Returns NULL if varint does not end before @end
+    inline const uint8_t *readVarint(const uint8_t *p, const uint8_t *end, unsigned long *v) {
+        unsigned long result = 0;
+        for (uint8_t shift = 0; p < end && shift < 8*sizeof(unsigned long); shift += 7) {
+            const uint8_t b = *p++;
+            result |= (unsigned long)(b & 0x7f) << shift;
+            if (!(b & 0x80)) {
+                *v = result;
+                return p;
+            }
+        }
+        return NULL;
+    }
+    inline const uint8_t *readSigned(const uint8_t *p, const uint8_t *end, long *v) {
+        unsigned long zigzag = 0;
+        p = readVarint(p, end, &zigzag);
+        *v = (zigzag & 1) ? (long)~(zigzag >> 1) : (long)(zigzag >> 1);
+        return p;
+    }
+
+    // Which fields an op carries
+    inline bool hasArg(uint8_t op) {
+        return op != TimerCurrentMs && op != TimerCurrentMicros;
+    }
+    inline bool hasMode(uint8_t op) {
+        return op == PinSetMode || op == PinSetPullup || op == AttachExternalInterrupt;
+    }
+    inline bool hasPinList(uint8_t op) {
+        return op == DigitalWriteMany || op == DigitalReadMany;
+    }
+    inline bool hasValue(uint8_t op) {
+        return !hasMode(op) && op != Interrupt;
+    }
+
+    // @p must have room for MICROFLO_IOTRACE_MAX_RECORD bytes. Returns end of record
+    inline uint8_t *encode(uint8_t *p, const Record &r) {
+        *p++ = r.op;
+        p = writeVarint(p, r.delta);
+        if (hasPinList(r.op)) {
+            *p++ = r.count;
+            for (uint8_t i=0; i<r.count; i++) {
+                *p++ = (uint8_t)r.pinList[i];
+            }
+        } else if (hasArg(r.op)) {
+            *p++ = r.arg;
+        }
+        if (hasMode(r.op)) {
+            *p++ = r.count;
+        }
+        if (hasValue(r.op)) {
+            p = writeSigned(p, r.value);
+        }
+        return p;
+    }
+    // Returns end of record, or NULL if truncated/invalid
+    inline const uint8_t *decode(const uint8_t *p, const uint8_t *end, Record *r) {
+        if (p >= end || *p == 0 || *p >= OpEnd) {
+            return NULL;
+        }
+        r->op = *p++;
+        r->arg = 0;
+        r->count = 0;
+        p = readVarint(p, end, &r->delta);
+        if (p && hasPinList(r->op)) {
+            if (p >= end || *p > 32 || end-p < 1+*p) {
+                return NULL;
+            }
+            r->count = *p++;
+            for (uint8_t i=0; i<r->count; i++) {
+                r->pinList[i] = (MicroFlo::PinId)*p++;
+            }
+        } else if (p && hasArg(r->op)) {
+            if (p >= end) {
+                return NULL;
+            }
+            r->arg = *p++;
+        }
+        if (p && hasMode(r->op)) {
+            if (p >= end) {
+                return NULL;
+            }
+            r->count = *p++;
+        }
+        r->value = 0;
+        if (p && hasValue(r->op)) {
+            p = readSigned(p, end, &r->value);
+        }
+        return p;
+    }
+}
+
+/* Wraps another IO, passing calls through while logging them to @log.
+ * Timestamps come from the wrapped IO, read once per record */
+class RecordingIO : public IO {
+public:
+    RecordingIO(IO *inner, FILE *log)
+        : inner(inner)
+        , log(log)
+        , lastMicros(inner->TimerCurrentMicros())
+        , records(0)
+    {
+        fwrite(MICROFLO_IOTRACE_MAGIC, 1, sizeof(MICROFLO_IOTRACE_MAGIC), log);
+        fputc(MICROFLO_IOTRACE_VERSION, log);
+        memset(interrupts, 0, sizeof(interrupts));
+    }
+    ~RecordingIO() {
+        fflush(log);
+    }
+
+    unsigned long recordCount() const { return records; }
+
+    virtual void setDebugHandler(DebugHandler *handler) {
+        debug = handler;
+        inner->setDebugHandler(handler);
+    }
+
+    // Serial
+    virtual void SerialBegin(uint8_t serialDevice, int baudrate) {
+        inner->SerialBegin(serialDevice, baudrate);
+        record(IoTrace::SerialBegin, serialDevice, baudrate);
+    }
+    virtual long SerialDataAvailable(uint8_t serialDevice) {
+        const long available = inner->SerialDataAvailable(serialDevice);
+        record(IoTrace::SerialDataAvailable, serialDevice, available);
+        return available;
+    }
+    virtual unsigned char SerialRead(uint8_t serialDevice) {
+        const unsigned char b = inner->SerialRead(serialDevice);
+        record(IoTrace::SerialRead, serialDevice, b);
+        return b;
+    }
+    virtual void SerialWrite(uint8_t serialDevice, unsigned char b) {
+        inner->SerialWrite(serialDevice, b);
+        record(IoTrace::SerialWrite, serialDevice, b);
+    }
+
+    // Pin config
+    virtual void PinSetMode(MicroFlo::PinId pin, IO::PinMode mode) {
+        inner->PinSetMode(pin, mode);
+        record(IoTrace::PinSetMode, pin, 0, mode);
+    }
+    virtual void PinSetPullup(MicroFlo::PinId pin, IO::PullupMode mode) {
+        inner->PinSetPullup(pin, mode);
+        record(IoTrace::PinSetPullup, pin, 0, mode);
+    }
+
+    // Digital
+    virtual void DigitalWrite(MicroFlo::PinId pin, bool val) {
+        inner->DigitalWrite(pin, val);
+        record(IoTrace::DigitalWrite, pin, val);
+    }
+    virtual bool DigitalRead(MicroFlo::PinId pin) {
+        const bool val = inner->DigitalRead(pin);
+        record(IoTrace::DigitalRead, pin, val);
+        return val;
+    }
+    virtual void DigitalWriteMany(const MicroFlo::PinId *pins, uint8_t count, uint32_t values) {
+        inner->DigitalWriteMany(pins, count, values);
+        recordMany(IoTrace::DigitalWriteMany, pins, count, values);
+    }
+    virtual uint32_t DigitalReadMany(const MicroFlo::PinId *pins, uint8_t count) {
+        const uint32_t values = inner->DigitalReadMany(pins, count);
+        recordMany(IoTrace::DigitalReadMany, pins, count, values);
+        return values;
+    }
+
+    // Analog
+    virtual long AnalogRead(MicroFlo::PinId pin) {
+        const long val = inner->AnalogRead(pin);
+        record(IoTrace::AnalogRead, pin, val);
+        return val;
+    }
+    virtual void PwmWrite(MicroFlo::PinId pin, long dutyPercent) {
+        inner->PwmWrite(pin, dutyPercent);
+        record(IoTrace::PwmWrite, pin, dutyPercent);
+    }
+
+    // Timer
+    virtual long TimerCurrentMs() {
+        const long ms = inner->TimerCurrentMs();
+        record(IoTrace::TimerCurrentMs, 0, ms);
+        return ms;
+    }
+    virtual long TimerCurrentMicros() {
+        const long us = inner->TimerCurrentMicros();
+        record(IoTrace::TimerCurrentMicros, 0, us);
+        return us;
+    }
+
+    // Interrupts. Handler is wrapped so that each call is logged before it runs
+    virtual void AttachExternalInterrupt(uint8_t interrupt, IO::Interrupt::Mode mode,
+                                         IOInterruptFunction func, void *user) {
+        record(IoTrace::AttachExternalInterrupt, interrupt, 0, func ? mode+1 : 0);
+        if (interrupt >= MICROFLO_IOTRACE_MAX_INTERRUPTS) {
+            MICROFLO_DEBUG(debug, DebugLevelError, DebugIoOperationNotImplemented);
+            inner->AttachExternalInterrupt(interrupt, mode, func, user);
+            return;
+        }
+        Handler &h = interrupts[interrupt];
+        h.io = this;
+        h.interrupt = interrupt;
+        h.func = func;
+        h.user = user;
+        inner->AttachExternalInterrupt(interrupt, mode, func ? interruptTrampoline : NULL, func ? &h : NULL);
+    }
+
+private:
+    struct Handler {
+        RecordingIO *io;
+        uint8_t interrupt;
+        IOInterruptFunction func;
+        void *user;
+    };
+    static void interruptTrampoline(void *user) {
+        Handler *h = static_cast<Handler *>(user);
+        h->io->record(IoTrace::Interrupt, h->interrupt, 0);
+        h->func(h->user);
+    }
+
+    void write(IoTrace::Record &r) {
+        const long now = inner->TimerCurrentMicros();
+        r.delta = (unsigned long)(now - lastMicros);
+        lastMicros = now;
+        uint8_t buffer[MICROFLO_IOTRACE_MAX_RECORD];
+        const uint8_t *end = IoTrace::encode(buffer, r);
+        fwrite(buffer, 1, end-buffer, log);
+        records++;
+    }
+    void record(IoTrace::Op op, uint8_t arg, long value, uint8_t mode=0) {
+        IoTrace::Record r;
+        r.op = op;
+        r.arg = arg;
+        r.count = mode;
+        r.value = value;
+        write(r);
+    }
+    void recordMany(IoTrace::Op op, const MicroFlo::PinId *pins, uint8_t count, uint32_t values) {
+        IoTrace::Record r;
+        r.op = op;
+        r.count = (count > 32) ? 32 : count;
+        memcpy(r.pinList, pins, r.count*sizeof(MicroFlo::PinId));
+        r.value = (long)values;
+        write(r);
+    }
+
+private:
+    IO *inner;
+    FILE *log;
+    long lastMicros;
+    unsigned long records;
+    Handler interrupts[MICROFLO_IOTRACE_MAX_INTERRUPTS];
+};
+
+/* Plays back a trace from RecordingIO, as fast as the graph asks for it.
+ * Each call consumes the next record if it is the same call (op and pin/device), and returns the
+ * recorded value. Calls that do not match are counted as divergences and leave the trace where it is,
+ * so that a graph which makes an extra call does not lose sync. Recorded interrupts are delivered to
+ * attached handlers at the same place in the call sequence as when recording.
+ * @trace must stay valid for the lifetime of the ReplayIO */
+class ReplayIO : public IO {
+public:
+    ReplayIO(const uint8_t *trace, size_t length)
+        : position(trace)
+        , end(trace + length)
+        , micros(0)
+        , divergenceCount(0)
+        , invalid(false)
+    {
+        memset(interrupts, 0, sizeof(interrupts));
+        if (length < MICROFLO_IOTRACE_HEADER_SIZE ||
+            memcmp(trace, MICROFLO_IOTRACE_MAGIC, sizeof(MICROFLO_IOTRACE_MAGIC)) != 0 ||
+            trace[sizeof(MICROFLO_IOTRACE_MAGIC)] != MICROFLO_IOTRACE_VERSION) {
+            position = end;
+            invalid = true;
+        } else {
+            position += MICROFLO_IOTRACE_HEADER_SIZE;
+        }
+    }
+
+    // Whole trace has been consumed. Also true for an invalid trace, check valid()
+    bool finished() const { return position >= end; }
+    bool valid() const { return !invalid; }
+    // Calls which did not match the trace, or outputs which had different values
+    unsigned long divergences() const { return divergenceCount; }
+    // Recording time at the current point of the trace
+    unsigned long traceMicros() const { return micros; }
+    // Bytes of trace not yet consumed. Stops changing if the graph no longer makes the recorded calls
+    size_t remaining() const { return end - position; }
+
+    // Serial
+    virtual void SerialBegin(uint8_t serialDevice, int baudrate) {
+        output(IoTrace::SerialBegin, serialDevice, baudrate);
+    }
+    virtual long SerialDataAvailable(uint8_t serialDevice) {
+        return input(IoTrace::SerialDataAvailable, serialDevice, 0);
+    }
+    virtual unsigned char SerialRead(uint8_t serialDevice) {
+        return input(IoTrace::SerialRead, serialDevice, 0);
+    }
+    virtual void SerialWrite(uint8_t serialDevice, unsigned char b) {
+        output(IoTrace::SerialWrite, serialDevice, b);
+    }
+
+    // Pin config
+    virtual void PinSetMode(MicroFlo::PinId pin, IO::PinMode mode) {
+        output(IoTrace::PinSetMode, pin, 0, mode);
+    }
+    virtual void PinSetPullup(MicroFlo::PinId pin, IO::PullupMode mode) {
+        output(IoTrace::PinSetPullup, pin, 0, mode);
+    }
+
+    // Digital
+    virtual void DigitalWrite(MicroFlo::PinId pin, bool val) {
+        output(IoTrace::DigitalWrite, pin, val);
+    }
+    virtual bool DigitalRead(MicroFlo::PinId pin) {
+        return input(IoTrace::DigitalRead, pin, false);
+    }
+    virtual void DigitalWriteMany(const MicroFlo::PinId *pins, uint8_t count, uint32_t values) {
+        IoTrace::Record r;
+        if (!next(IoTrace::DigitalWriteMany, 0, pins, count, &r)) {
+            return;
+        }
+        if ((uint32_t)r.value != values) {
+            divergenceCount++;
+        }
+    }
+    virtual uint32_t DigitalReadMany(const MicroFlo::PinId *pins, uint8_t count) {
+        IoTrace::Record r;
+        return next(IoTrace::DigitalReadMany, 0, pins, count, &r) ? (uint32_t)r.value : 0;
+    }
+
+    // Analog
+    virtual long AnalogRead(MicroFlo::PinId pin) {
+        return input(IoTrace::AnalogRead, pin, 0);
+    }
+    virtual void PwmWrite(MicroFlo::PinId pin, long dutyPercent) {
+        output(IoTrace::PwmWrite, pin, dutyPercent);
+    }
+
+    // Timer. Calls not in the trace get the recording time at this point
+    virtual long TimerCurrentMs() {
+        return input(IoTrace::TimerCurrentMs, 0, micros/1000);
+    }
+    virtual long TimerCurrentMicros() {
+        return input(IoTrace::TimerCurrentMicros, 0, micros);
+    }
+
+    virtual void AttachExternalInterrupt(uint8_t interrupt, IO::Interrupt::Mode mode,
+                                         IOInterruptFunction func, void *user) {
+        output(IoTrace::AttachExternalInterrupt, interrupt, 0, func ? mode+1 : 0);
+        if (interrupt >= MICROFLO_IOTRACE_MAX_INTERRUPTS) {
+            MICROFLO_DEBUG(debug, DebugLevelError, DebugIoOperationNotImplemented);
+            return;
+        }
+        interrupts[interrupt].func = func;
+        interrupts[interrupt].user = user;
+    }
+
+private:
+    // Delivers interrupts due before the next call, then returns whether next record is @op
+    // If so, record is consumed and stored in @r
+    bool next(uint8_t op, uint8_t arg, const MicroFlo::PinId *pins, uint8_t count, IoTrace::Record *r) {
+        while (position < end) {
+            const uint8_t *after = IoTrace::decode(position, end, r);
+            if (!after) {
+                // Truncated trace, typically recording was killed. Play what we got
+                position = end;
+                invalid = true;
+                break;
+            }
+            if (r->op == IoTrace::Interrupt) {
+                position = after;
+                micros += r->delta;
+                const Handler &h = interrupts[r->arg < MICROFLO_IOTRACE_MAX_INTERRUPTS ? r->arg : 0];
+                if (r->arg < MICROFLO_IOTRACE_MAX_INTERRUPTS && h.func) {
+                    h.func(h.user);
+                }
+                continue;
+            }
+            bool match = (r->op == op);
+            if (match && IoTrace::hasPinList(op)) {
+                match = (r->count == count) && memcmp(r->pinList, pins, count*sizeof(MicroFlo::PinId)) == 0;
+            } else if (match && IoTrace::hasArg(op)) {
+                match = (r->arg == arg);
+            }
+            if (!match) {
+                break;
+            }
+            position = after;
+            micros += r->delta;
+            return true;
+        }
+        divergenceCount++;
+        return false;
+    }
+    long input(IoTrace::Op op, uint8_t arg, long fallback) {
+        IoTrace::Record r;
+        return next(op, arg, NULL, 0, &r) ? r.value : fallback;
+    }
+    void output(IoTrace::Op op, uint8_t arg, long value, uint8_t mode=0) {
+        IoTrace::Record r;
+        if (next(op, arg, NULL, 0, &r) && (r.value != value || r.count != mode)) {
+            divergenceCount++;
+        }
+    }
+
+private:
+    struct Handler {
+        IOInterruptFunction func;
+        void *user;
+    };
+    const uint8_t *position;
+    const uint8_t *end;
+    unsigned long micros;
+    unsigned long divergenceCount;
+    bool invalid;
+    Handler interrupts[MICROFLO_IOTRACE_MAX_INTERRUPTS];
+};
+
+#endif // MICROFLO_RECORDIO_HPP
@@ -0,0 +1,126 @@
+/* MicroFlo - Flow-Based Programming for microcontrollers
+ * Copyright (c) 2013 Jon Nordby <jononor@gmail.com>
+ * MicroFlo may be freely distributed under the MIT license
+ */
+
+#ifndef MICROFLO_VIRTUALTIME_HPP
+#define MICROFLO_VIRTUALTIME_HPP
+
+#include "microflo.h"
+
+/* Wraps another IO, replacing its clock with one that only moves when advanced.
+ * Used with VirtualTimeRunner to run graphs faster than real time, for tests and simulation */
+class VirtualClockIO : public IO {
+public:
+    VirtualClockIO(IO *inner, uint64_t startMicros=0)
+        : inner(inner)
+        , micros(startMicros)
+    {
+    }
+
+    uint64_t currentMicros() const { return micros; }
+    void advance(uint64_t deltaMicros) { micros += deltaMicros; }
+
+    virtual void setDebugHandler(DebugHandler *handler) {
+        debug = handler;
+        inner->setDebugHandler(handler);
+    }
+
+    // Timer
+    virtual long TimerCurrentMs() { return (long)(micros/1000); }
+    virtual long TimerCurrentMicros() { return (long)micros; }
+
+    // Everything else goes to the wrapped IO
+    virtual void setIoValue(const uint8_t *buf, uint8_t len) { inner->setIoValue(buf, len); }
+    virtual void SerialBegin(uint8_t serialDevice, int baudrate) { inner->SerialBegin(serialDevice, baudrate); }
+    virtual long SerialDataAvailable(uint8_t serialDevice) { return inner->SerialDataAvailable(serialDevice); }
+    virtual unsigned char SerialRead(uint8_t serialDevice) { return inner->SerialRead(serialDevice); }
+    virtual void SerialWrite(uint8_t serialDevice, unsigned char b) { inner->SerialWrite(serialDevice, b); }
+    virtual void PinSetMode(MicroFlo::PinId pin, IO::PinMode mode) { inner->PinSetMode(pin, mode); }
+    virtual void PinSetPullup(MicroFlo::PinId pin, IO::PullupMode mode) { inner->PinSetPullup(pin, mode); }
+    virtual void DigitalWrite(MicroFlo::PinId pin, bool val) { inner->DigitalWrite(pin, val); }
+    virtual bool DigitalRead(MicroFlo::PinId pin) { return inner->DigitalRead(pin); }
+    virtual void DigitalWriteMany(const MicroFlo::PinId *pins, uint8_t count, uint32_t values) {
+        inner->DigitalWriteMany(pins, count, values);
+    }
+    virtual uint32_t DigitalReadMany(const MicroFlo::PinId *pins, uint8_t count) {
+        return inner->DigitalReadMany(pins, count);
+    }
+    virtual long AnalogRead(MicroFlo::PinId pin) { return inner->AnalogRead(pin); }
+    virtual void PwmWrite(MicroFlo::PinId pin, long dutyPercent) { inner->PwmWrite(pin, dutyPercent); }
+    virtual void AttachExternalInterrupt(uint8_t interrupt, IO::Interrupt::Mode mode,
+                                         IOInterruptFunction func, void *user) {
+        inner->AttachExternalInterrupt(interrupt, mode, func, user);
+    }
+
+private:
+    IO *inner;
+    uint64_t micros;
+};
+
+/* Runs a Network on a VirtualClockIO, advancing the clock instead of waiting.
+ *
+ * While messages are in flight each tick costs @tickMicros of virtual time.
+ * When the network is idle, the clock jumps to the earliest Network::requestWakeup() deadline.
+ * If no component asked for one, it moves @idleStepMs, which must be small enough for components
+ * that poll the clock without asking for a wakeup. If such components share the graph with
+ * wakeup-aware ones, set @capWakeupJump so that jumps to a wakeup are also at most @idleStepMs. */
+class VirtualTimeRunner {
+public:
+    VirtualTimeRunner(Network *network, VirtualClockIO *clock,
+                      unsigned long idleStepMs=1, unsigned long tickMicros=10, bool capWakeupJump=false)
+        : network(network)
+        , clock(clock)
+        , idleStepMicros(idleStepMs*1000)
+        , tickMicros(tickMicros)
+        , capWakeupJump(capWakeupJump)
+        , ticks(0)
+    {
+    }
+
+    // Runs until @durationMs of virtual time has passed. Returns number of ticks run
+    unsigned long runFor(unsigned long durationMs) {
+        return runUntil(clock->currentMicros() + (uint64_t)durationMs*1000);
+    }
+
+    unsigned long runUntil(uint64_t endMicros) {
+        const unsigned long startTicks = ticks;
+        while (clock->currentMicros() < endMicros) {
+            network->runTick();
+            ticks++;
+            const uint64_t now = clock->currentMicros();
+            uint64_t step = tickMicros;
+            unsigned long wakeupMs = 0;
+            if (network->currentState() != Network::Running) {
+                step = endMicros - now; // nothing will happen
+            } else if (network->isIdle()) {
+                if (network->nextWakeup(&wakeupMs)) {
+                    const long untilWakeup = (long)(wakeupMs - (unsigned long)clock->TimerCurrentMs());
+                    step = (untilWakeup > 0) ? (uint64_t)untilWakeup*1000 - (now % 1000) : tickMicros;
+                    if (capWakeupJump && step > idleStepMicros) {
+                        step = idleStepMicros;
+                    }
+                } else {
+                    step = idleStepMicros;
+                }
+            }
+            if (step == 0) {
+                step = 1;
+            }
+            clock->advance((now + step > endMicros) ? endMicros - now : step);
+        }
+        return ticks - startTicks;
+    }
+
+    unsigned long totalTicks() const { return ticks; }
+
+private:
+    Network *network;
+    VirtualClockIO *clock;
+    uint64_t idleStepMicros;
+    uint64_t tickMicros;
+    bool capWakeupJump;
+    unsigned long ticks;
+};
+
+#endif // MICROFLO_VIRTUALTIME_HPP
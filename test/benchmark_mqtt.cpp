@@ -0,0 +1,161 @@
+/* MicroFlo - Flow-Based Programming for microcontrollers
+ * Copyright (c) 2013 Jon Nordby <jononor@gmail.com>
+ * MicroFlo may be freely distributed under the MIT license
+ */
+
+// MQTT path performance, from inport topic through examples/Repeat.fbp to outport topic.
+// Uses the in-process loopback broker, so needs no network. Run with: make benchmark-mqtt
+
+#include <microflo.h>
+#include "../microflo/mqttmount.hpp"
+#include "../microflo/mqttloopback.hpp"
+#include "../microflo/io.hpp"
+#include "./components/Forward.hpp"
+
+#include <microflo.cpp>
+
+#include <algorithm>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+Component *
+createComponent(unsigned char id) {
+    return NULL;
+}
+
+static double
+nowSeconds() {
+    timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec/1e9;
+}
+
+// Sends sequence numbers to the graph and times when each comes back
+class Peer : public MqttClientHandler {
+public:
+    Peer(PayloadFormat f, long n)
+        : format(f)
+        , received(0)
+        , sentAt(n)
+        , latencies(n)
+    {
+    }
+
+    virtual void mqttConnected() {}
+    virtual void mqttMessage(const char *topic, const uint8_t *payload, size_t length) {
+        const double now = nowSeconds();
+        const long seq = decodePayload(format, (const char *)payload, length).asInteger();
+        std::lock_guard<std::mutex> lock(mutex);
+        if (seq >= 0 && seq < (long)latencies.size()) {
+            latencies[seq] = now - sentAt[seq];
+        }
+        received++;
+        changed.notify_one();
+    }
+
+    void send(MqttClient *client, long seq) {
+        char payload[MICROFLO_PACKET_TEXT_MAX];
+        const size_t length = encodePayload(format, Packet(seq), payload, sizeof(payload));
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            sentAt[seq] = nowSeconds();
+        }
+        client->publish("/repeat/in", payload, length, 0);
+    }
+
+    // Returns false if not all of @count had come back after a second
+    bool waitReceived(long count) {
+        std::unique_lock<std::mutex> lock(mutex);
+        return changed.wait_for(lock, std::chrono::seconds(1), [&] { return received >= count; });
+    }
+
+public:
+    PayloadFormat format;
+    long received;
+    std::vector<double> sentAt;
+    std::vector<double> latencies;
+    std::mutex mutex;
+    std::condition_variable changed;
+};
+
+static double
+percentile(std::vector<double> sorted, double p) {
+    const size_t index = (size_t)(p*(sorted.size()-1));
+    return sorted[index];
+}
+
+// Runs @messages through the graph, with at most @window waiting for a reply
+static bool
+runBenchmark(const char *name, PayloadFormat format, long messages, long window) {
+    FixedMessageQueue queue;
+    NullIO io;
+    Network network(&io, &queue);
+    MicroFlo::NodeId a = 0;
+    MicroFlo::NodeId b = 0;
+    network.addNode(new Forward(), 0, &a);
+    network.addNode(new Forward(), 0, &b);
+    network.connect(a, 0, b, 0);
+    network.start();
+
+    MqttOptions options;
+    mqttDefaultOptions(&options);
+    options.info.role = "repeat";
+    options.info.addInport("in", a, 0)->addOutport("out", b, 0);
+    options.info.setPayloadFormat("*", format);
+    options.outboundQueueLength = window;
+
+    LoopbackMqttBroker broker;
+    LoopbackMqttClient mountClient(&broker);
+    LinuxMqttHostTransport transport;
+    MqttMount mount(&network, &mountClient, options);
+    transport.setup(&io, &mount);
+    mount.setup(&network, &transport);
+    mount.connect();
+    std::thread runner(&MqttMount::run, &mount);
+
+    Peer peer(format, messages);
+    LoopbackMqttClient peerClient(&broker);
+    peerClient.setHandler(&peer);
+    peerClient.start();
+    peerClient.subscribe("/repeat/out", 0);
+    while (broker.subscribers("/repeat/in") == 0) {
+        usleep(100);
+    }
+
+    bool complete = true;
+    const double start = nowSeconds();
+    for (long i=0; i<messages && complete; i++) {
+        if (i >= window) {
+            complete = peer.waitReceived(i-window+1);
+        }
+        peer.send(&peerClient, i);
+    }
+    complete = complete && peer.waitReceived(messages);
+    const double seconds = nowSeconds()-start;
+
+    mount.stop();
+    runner.join();
+    peerClient.stop();
+
+    if (!complete) {
+        printf("%s: only %ld of %ld messages came back\n", name, peer.received, messages);
+        return false;
+    }
+    std::vector<double> sorted = peer.latencies;
+    std::sort(sorted.begin(), sorted.end());
+    printf("%s: %.0f messages/s, latency p50 %.1f us, p99 %.1f us, max %.1f us\n",
+           name, messages/seconds, 1e6*percentile(sorted, 0.50), 1e6*percentile(sorted, 0.99), 1e6*sorted.back());
+    return true;
+}
+
+int
+main(int argc, char *argv[]) {
+    const long messages = (argc > 1) ? atol(argv[1]) : 20000;
+    bool ok = true;
+    ok &= runBenchmark("text, 1 in flight", PayloadText, messages, 1);
+    ok &= runBenchmark("msgpack, 1 in flight", PayloadMsgPack, messages, 1);
+    ok &= runBenchmark("text, 32 in flight", PayloadText, messages, 32);
+    ok &= runBenchmark("msgpack, 32 in flight", PayloadMsgPack, messages, 32);
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,86 @@
+/* MicroFlo - Flow-Based Programming for microcontrollers
+ * Copyright (c) 2013 Jon Nordby <jononor@gmail.com>
+ * MicroFlo may be freely distributed under the MIT license
+ */
+
+// Throughput of the MQTT/MsgFlo packet text and MessagePack codecs. Run with: make benchmark-codec
+
+#include <microflo.h>
+#include "../microflo/mqtt.hpp"
+
+#include <microflo.cpp>
+
+#include <stdio.h>
+#include <time.h>
+
+Component *
+createComponent(unsigned char id) {
+    return NULL;
+}
+
+static double
+nowSeconds() {
+    timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec/1e9;
+}
+
+int
+main(int argc, char *argv[]) {
+    const long iterations = (argc > 1) ? atol(argv[1]) : 1000000;
+    const Packet packets[] = {
+        Packet(), Packet(true), Packet(1234L), Packet(-987654321L), Packet(3.14159f), Packet(-1.5e-7f),
+        Packet(ErrorOperationTimeout), Packet(MsgBracketStart)
+    };
+    const int nPackets = sizeof(packets)/sizeof(packets[0]);
+
+    char buf[MICROFLO_PACKET_TEXT_MAX];
+    size_t bytes = 0;
+    double start = nowSeconds();
+    for (long i=0; i<iterations; i++) {
+        bytes += encodePacket(packets[i % nPackets], buf, sizeof(buf));
+    }
+    const double encodeSeconds = nowSeconds()-start;
+
+    // Decode the encoded text
+    char texts[nPackets][MICROFLO_PACKET_TEXT_MAX];
+    size_t lengths[nPackets];
+    for (int i=0; i<nPackets; i++) {
+        lengths[i] = encodePacket(packets[i], texts[i], sizeof(texts[i]));
+    }
+    int invalid = 0;
+    start = nowSeconds();
+    for (long i=0; i<iterations; i++) {
+        const int n = i % nPackets;
+        invalid += decodePacket(texts[n], lengths[n]).isValid() ? 0 : 1;
+    }
+    const double decodeSeconds = nowSeconds()-start;
+
+    // Same packets as MessagePack
+    uint8_t bin[MICROFLO_PACKET_MSGPACK_MAX];
+    size_t binaryBytes = 0;
+    start = nowSeconds();
+    for (long i=0; i<iterations; i++) {
+        binaryBytes += encodePacketMsgPack(packets[i % nPackets], bin, sizeof(bin));
+    }
+    const double binaryEncodeSeconds = nowSeconds()-start;
+
+    uint8_t binaries[nPackets][MICROFLO_PACKET_MSGPACK_MAX];
+    size_t binaryLengths[nPackets];
+    for (int i=0; i<nPackets; i++) {
+        binaryLengths[i] = encodePacketMsgPack(packets[i], binaries[i], sizeof(binaries[i]));
+    }
+    start = nowSeconds();
+    for (long i=0; i<iterations; i++) {
+        const int n = i % nPackets;
+        invalid += decodePacketMsgPack(binaries[n], binaryLengths[n]).isValid() ? 0 : 1;
+    }
+    const double binaryDecodeSeconds = nowSeconds()-start;
+
+    printf("text encode: %.1f ns/packet, %.1f MB/s\n", 1e9*encodeSeconds/iterations, bytes/encodeSeconds/1e6);
+    printf("text decode: %.1f ns/packet, %.1f MB/s\n", 1e9*decodeSeconds/iterations, bytes/decodeSeconds/1e6);
+    printf("msgpack encode: %.1f ns/packet, %.1f bytes/packet\n",
+           1e9*binaryEncodeSeconds/iterations, (double)binaryBytes/iterations);
+    printf("msgpack decode: %.1f ns/packet\n", 1e9*binaryDecodeSeconds/iterations);
+    return invalid ? 1 : 0;
+}
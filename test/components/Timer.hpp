@@ -30,6 +30,7 @@ public:
                 previousMillis = currentMillis;
                 send(Packet());
             }
+            network->requestWakeup(previousMillis + interval);
         } else if (port == InPorts::interval && in.isData()) {
             interval = in.asInteger();
         } else if (port == InPorts::reset && in.isData()) {
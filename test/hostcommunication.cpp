@@ -13,17 +13,20 @@ printb(const uint8_t *buf, uint8_t length) {
 
 class FakeTransport : public HostTransport {
 public:
+    FakeTransport() : responseLength(0), sent(0) {}
 
     // implements HostTransport
     virtual void setup(IO *i, HostCommunication *c) { controller = c; }
     virtual void runTick() {}
     virtual void sendCommand(const uint8_t *buf, uint8_t len) {
-        memset(response, 0, MICROFLO_CMD_SIZE);
-        if (len > MICROFLO_CMD_SIZE) {
+        memset(response, 0, sizeof(response));
+        if (len > sizeof(response)) {
             fprintf(stderr, "ERROR\n");
             return; 
         }
         memcpy(response, buf, len);
+        responseLength = len;
+        sent++;
     }
 
 public:
@@ -34,7 +37,9 @@ public:
     }
    
 public:
-    uint8_t response[MICROFLO_CMD_SIZE];
+    uint8_t response[MICROFLO_FRAME_MAXSIZE+3];
+    uint8_t responseLength;
+    int sent;
 
 private:
     HostCommunication *controller;
@@ -42,6 +47,52 @@ private:
 
 
 
+// Sends 1,2,3... on every packet received
+class TestBurst : public SingleOutputComponent {
+public:
+    TestBurst(int n) : count(n) {}
+    virtual void process(Packet in, MicroFlo::PortId port) {
+        if (in.isData()) {
+            for (long i=1; i<=count; i++) {
+                send(Packet(i), 0);
+            }
+        }
+    }
+private:
+    int count;
+};
+
+// Serial port with a small receive buffer, like on microcontrollers
+class FakeSerialIO : public NullIO {
+public:
+    FakeSerialIO() : inputLength(0), inputRead(0), outputLength(0) {}
+
+    virtual void SerialBegin(uint8_t serialDevice, int baudrate) {}
+    virtual long SerialDataAvailable(uint8_t serialDevice) { return inputLength-inputRead; }
+    virtual unsigned char SerialRead(uint8_t serialDevice) { return input[inputRead++]; }
+    virtual void SerialWrite(uint8_t serialDevice, unsigned char b) {
+        if (outputLength < sizeof(output)) {
+            output[outputLength++] = b;
+        }
+    }
+
+    bool receive(const uint8_t *buf, int len) {
+        if (inputLength-inputRead+len > 64) {
+            return false; // would overflow
+        }
+        for (int i=0; i<len; i++) {
+            input[inputLength++] = buf[i];
+        }
+        return true;
+    }
+public:
+    uint8_t input[1000];
+    int inputLength;
+    int inputRead;
+    uint8_t output[1000];
+    size_t outputLength;
+};
+
 bool checkResponse(const uint8_t *actual, const uint8_t *expected) {
 
     const bool same = memcmp(actual, expected, MICROFLO_CMD_SIZE) == 0;
@@ -55,6 +106,41 @@ bool checkResponse(const uint8_t *actual, const uint8_t *expected) {
     return same;
 }
 
+uint8_t
+crc8(const uint8_t *buf, uint8_t length) {
+    uint8_t crc = 0;
+    for (int i=0; i<length; i++) {
+        crc ^= buf[i];
+        for (int bit=0; bit<8; bit++) {
+            crc = (crc & 0x80) ? (crc << 1) ^ 0x07 : (crc << 1);
+        }
+    }
+    return crc;
+}
+
+// Wrap @cmd in a protocol version 2 frame, returns the frame length
+uint8_t
+makeFrame(uint8_t *frame, const uint8_t *cmd, uint8_t length) {
+    frame[0] = MICROFLO_FRAME_START;
+    frame[1] = length;
+    memcpy(frame+2, cmd, length);
+    frame[2+length] = crc8(frame+1, length+1);
+    return length+3;
+}
+
+bool checkFrame(const FakeTransport &d, const uint8_t *expectedCmd, uint8_t length) {
+    uint8_t expected[MICROFLO_FRAME_MAXSIZE+3];
+    const uint8_t frameLength = makeFrame(expected, expectedCmd, length);
+    const bool same = d.responseLength == frameLength && memcmp(d.response, expected, frameLength) == 0;
+    if (!same) {
+        printb(d.response, d.responseLength);
+        printf(" != ");
+        printb(expected, frameLength);
+        printf("\n");
+    }
+    return same;
+}
+
 int
 test_host_communication() {
 
@@ -87,7 +173,9 @@ test_host_communication() {
 
     // Sending magic should open communication
     d.request(openComm, MICROFLO_CMD_SIZE);
-    const uint8_t openCommResponse[] = { 2, GraphCmdCommunicationOpen, 0, 0, 0, 0, 0, 0, 0, 0 };
+    const uint8_t openCommResponse[] = { 2, GraphCmdCommunicationOpen,
+                                         MICROFLO_PROTOCOL_VERSION, MICROFLO_HOST_WINDOW,
+                                         MICROFLO_FEATURE_GRAPH_IMAGE, 0, 0, 0, 0, 0 };
     MICROFLO_RETURN_VAL_IF_FAIL(checkResponse(d.response, openCommResponse), -3);
 
     // Valid ping request should get a response
@@ -100,6 +188,251 @@ test_host_communication() {
     d.request(invalidSendPacket, MICROFLO_CMD_SIZE);
     MICROFLO_RETURN_VAL_IF_FAIL(checkResponse(d.response, invalidSendResponse), -5);
 
+    // Switching to protocol version 2 is acknowledged in version 1
+    const uint8_t setVersion[MICROFLO_CMD_SIZE] = { 4, GraphCmdSetProtocolVersion, 2, 0, 0, 0, 0, 0, 0, 0 };
+    const uint8_t setVersionResponse[MICROFLO_CMD_SIZE] = { 4, GraphCmdProtocolVersionChanged, 2, 0, 0, 0, 0, 0, 0, 0 };
+    d.request(setVersion, MICROFLO_CMD_SIZE);
+    MICROFLO_RETURN_VAL_IF_FAIL(checkResponse(d.response, setVersionResponse), -6);
+
+    // Framed request gets framed response, without padding
+    uint8_t frame[MICROFLO_FRAME_MAXSIZE+3];
+    d.request(frame, makeFrame(frame, pingRequest, sizeof(pingRequest)));
+    MICROFLO_RETURN_VAL_IF_FAIL(checkFrame(d, pingResponse, sizeof(pingResponse)), -7);
+
+    // Trailing zeros of a command can be left out
+    const uint8_t shortSubscribe[] = { 5, GraphCmdSubscribeToPort, 10 };
+    const uint8_t shortSubscribeResponse[] = { 5, GraphCmdError, DebugSubscribePortInvalidNode };
+    d.request(frame, makeFrame(frame, shortSubscribe, sizeof(shortSubscribe)));
+    MICROFLO_RETURN_VAL_IF_FAIL(checkFrame(d, shortSubscribeResponse, sizeof(shortSubscribeResponse)), -8);
+
+    // Frame with invalid checksum is dropped. Only a debug message may be sent
+    memset(d.response, 0, sizeof(d.response));
+    const uint8_t frameLength = makeFrame(frame, pingRequest, sizeof(pingRequest));
+    frame[frameLength-1] ^= 0xFF;
+    d.request(frame, frameLength);
+    MICROFLO_RETURN_VAL_IF_FAIL(d.response[3] != GraphCmdPong, -9);
+
+    // Next frame is still understood
+    d.request(frame, makeFrame(frame, pingRequest, sizeof(pingRequest)));
+    MICROFLO_RETURN_VAL_IF_FAIL(checkFrame(d, pingResponse, sizeof(pingResponse)), -10);
+
+    // PacketSent notifications are batched per tick, flushing early when batch is full
+    MicroFlo::NodeId burstId = 0;
+    const int recordsPerBatch = (MICROFLO_FRAME_MAXSIZE-4)/7; // Integer records
+    TestBurst *burst = new TestBurst(recordsPerBatch+1);
+    network.addNode(burst, 0, &burstId);
+    network.subscribeToPort(burstId, 0, true);
+    network.start();
+    network.sendMessageTo(burstId, 0, Packet(true));
+    network.runTick();
+    d.sent = 0;
+    network.runTick();
+    MICROFLO_RETURN_VAL_IF_FAIL(d.sent == 2, -13);
+    const uint8_t lastBatch[] = { 0, GraphCmdPacketsSent, 1, 1,
+                                  burstId, 0, MsgInteger, (uint8_t)(recordsPerBatch+1), 0, 0, 0 };
+    MICROFLO_RETURN_VAL_IF_FAIL(checkFrame(d, lastBatch, sizeof(lastBatch)), -14);
+    network.stop();
+
+    // Host reconnecting gets back to version 1, and a pending batch is dropped
+    Message pending;
+    pending.pkg = Packet((long)1);
+    pending.targetReferred = false;
+    controller.packetSent(pending, burst, 0);
+    d.request(openComm, MICROFLO_CMD_SIZE);
+    MICROFLO_RETURN_VAL_IF_FAIL(checkResponse(d.response, openCommResponse), -11);
+    d.sent = 0;
+    controller.messagesProcessed();
+    MICROFLO_RETURN_VAL_IF_FAIL(d.sent == 0, -15);
+    d.request(pingRequest, sizeof(pingRequest));
+    MICROFLO_RETURN_VAL_IF_FAIL(checkResponse(d.response, pingResponse), -12);
+
+
+    return 0;
+}
+
+int
+test_host_window() {
+    FixedMessageQueue queue;
+    FakeSerialIO io;
+    SerialHostTransport transport(0, 9600);
+    Network network(&io, &queue);
+    HostCommunication controller;
+    transport.setup(&io, &controller);
+    controller.setup(&network, &transport);
+
+    uint8_t openComm[MICROFLO_CMD_SIZE];
+    memcpy(openComm, MICROFLO_GRAPH_MAGIC, sizeof(MICROFLO_GRAPH_MAGIC));
+    openComm[MICROFLO_CMD_SIZE-1] = 1;
+    MICROFLO_RETURN_VAL_IF_FAIL(io.receive(openComm, MICROFLO_CMD_SIZE), -1);
+    transport.runTick();
+    transport.runTick();
+    MICROFLO_RETURN_VAL_IF_FAIL(io.outputLength == MICROFLO_CMD_SIZE, -2);
+
+    // Host sends a full window of requests without waiting
+    for (int round=0; round<3; round++) {
+        for (uint8_t requestId=10; requestId<10+MICROFLO_HOST_WINDOW; requestId++) {
+            const uint8_t ping[] = { requestId, GraphCmdPing, 1, 2, 3, 4, 5, 6, 7, 8 };
+            MICROFLO_RETURN_VAL_IF_FAIL(io.receive(ping, sizeof(ping)), -3);
+        }
+        // Serial driver buffer is emptied right away, and whole window parsed in one tick
+        const size_t before = io.outputLength;
+        transport.runTick();
+        MICROFLO_RETURN_VAL_IF_FAIL(io.SerialDataAvailable(0) == 0, -4);
+        MICROFLO_RETURN_VAL_IF_FAIL(io.outputLength == before + MICROFLO_HOST_WINDOW*MICROFLO_CMD_SIZE, -7);
+        for (int i=0; i<2*MICROFLO_HOST_WINDOW; i++) {
+            transport.runTick();
+        }
+    }
+
+    // Each request answered, in order
+    MICROFLO_RETURN_VAL_IF_FAIL(io.outputLength == (1+3*MICROFLO_HOST_WINDOW)*MICROFLO_CMD_SIZE, -5);
+    const uint8_t *last = io.output + io.outputLength - MICROFLO_CMD_SIZE;
+    MICROFLO_RETURN_VAL_IF_FAIL(last[0] == 10+MICROFLO_HOST_WINDOW-1 && last[1] == GraphCmdPong, -6);
+
+    return 0;
+}
+
+int
+test_graph_image() {
+    FixedMessageQueue queue;
+    NullIO io;
+    FakeTransport transport;
+    Network network(&io, &queue);
+    HostCommunication controller;
+    transport.setup(&io, &controller);
+    controller.setup(&network, &transport);
+    FakeTransport &d = transport;
+
+    // Two bursts in a chain, first one triggered by an IIP. Component 1 is a TestBurst
+    uint8_t image[] = { 'M', 'G', MICROFLO_GRAPH_IMAGE_VERSION, MICROFLO_GRAPH_IMAGE_START, 2, 1, 1, 0,
+                        1, 0, 1, 1,
+                        1, 0, 1, 1,
+                        1, 2, 0, 0,
+                        1, 0, MsgBoolean, 1, 0, 0, 0 };
+    image[7] = crc8(image+MICROFLO_GRAPH_IMAGE_HEADER_SIZE, sizeof(image)-MICROFLO_GRAPH_IMAGE_HEADER_SIZE);
+    MICROFLO_RETURN_VAL_IF_FAIL(controller.loadGraphImage(image, sizeof(image)) == MICROFLO_OK, -1);
+    MICROFLO_RETURN_VAL_IF_FAIL(network.currentState() == Network::Running, -2);
+
+    // Packet goes through both nodes
+    MICROFLO_RETURN_VAL_IF_FAIL(network.subscribeToPort(2, 0, true) == MICROFLO_OK, -3);
+    d.sent = 0;
+    for (int i=0; i<3; i++) {
+        network.runTick();
+    }
+    MICROFLO_RETURN_VAL_IF_FAIL(d.sent == 1 && d.response[0] == 0 && d.response[1] == GraphCmdPacketSent, -4);
+
+    // Corrupt or inconsistent images are rejected without touching current graph
+    image[MICROFLO_GRAPH_IMAGE_HEADER_SIZE] ^= 0xFF;
+    MICROFLO_RETURN_VAL_IF_FAIL(controller.loadGraphImage(image, sizeof(image)) == DebugGraphImageChecksumMismatch, -5);
+    image[MICROFLO_GRAPH_IMAGE_HEADER_SIZE] ^= 0xFF;
+    MICROFLO_RETURN_VAL_IF_FAIL(controller.loadGraphImage(image, sizeof(image)-1) == DebugGraphImageInvalid, -6);
+    uint8_t dangling[sizeof(image)];
+    memcpy(dangling, image, sizeof(image));
+    dangling[17] = 3; // edge target
+    dangling[7] = crc8(dangling+MICROFLO_GRAPH_IMAGE_HEADER_SIZE, sizeof(image)-MICROFLO_GRAPH_IMAGE_HEADER_SIZE);
+    MICROFLO_RETURN_VAL_IF_FAIL(controller.loadGraphImage(dangling, sizeof(dangling)) == DebugGraphImageInvalid, -7);
+    MICROFLO_RETURN_VAL_IF_FAIL(network.currentState() == Network::Running, -8);
+    uint8_t unknown[sizeof(image)];
+    memcpy(unknown, image, sizeof(image));
+    unknown[12] = 99; // component of second node
+    unknown[7] = crc8(unknown+MICROFLO_GRAPH_IMAGE_HEADER_SIZE, sizeof(image)-MICROFLO_GRAPH_IMAGE_HEADER_SIZE);
+    MICROFLO_RETURN_VAL_IF_FAIL(controller.loadGraphImage(unknown, sizeof(unknown)) == DebugGraphImageInvalid, -15);
+    memcpy(unknown, image, sizeof(image));
+    unknown[18] = 1; // edge source port, TestBurst has only one
+    unknown[7] = crc8(unknown+MICROFLO_GRAPH_IMAGE_HEADER_SIZE, sizeof(image)-MICROFLO_GRAPH_IMAGE_HEADER_SIZE);
+    MICROFLO_RETURN_VAL_IF_FAIL(controller.loadGraphImage(unknown, sizeof(unknown)) == DebugGraphImageInvalid, -16);
+    MICROFLO_RETURN_VAL_IF_FAIL(network.currentState() == Network::Running, -17);
+    network.stop();
+
+    // Over the host link the image follows the command as raw bytes
+    uint8_t openComm[MICROFLO_CMD_SIZE];
+    memcpy(openComm, MICROFLO_GRAPH_MAGIC, sizeof(MICROFLO_GRAPH_MAGIC));
+    openComm[MICROFLO_CMD_SIZE-1] = 1;
+    d.request(openComm, MICROFLO_CMD_SIZE);
+    MICROFLO_RETURN_VAL_IF_FAIL(d.response[1] == GraphCmdCommunicationOpen &&
+                                (d.response[4] & MICROFLO_FEATURE_GRAPH_IMAGE), -9);
+    const uint8_t load[MICROFLO_CMD_SIZE] = { 2, GraphCmdLoadGraphImage, sizeof(image), 0, 0, 0, 0, 0, 0, 0 };
+    d.request(load, sizeof(load));
+    d.request(image, sizeof(image));
+    const uint8_t loaded[MICROFLO_CMD_SIZE] = { 2, GraphCmdGraphImageLoaded, 2, 1, 1, 0, 0, 0, 0, 0 };
+    MICROFLO_RETURN_VAL_IF_FAIL(checkResponse(d.response, loaded), -10);
+    MICROFLO_RETURN_VAL_IF_FAIL(network.currentState() == Network::Running, -11);
+
+    // Rejected image is still consumed, so following commands are understood
+    const uint8_t loadDangling[MICROFLO_CMD_SIZE] = { 3, GraphCmdLoadGraphImage, sizeof(dangling), 0, 0, 0, 0, 0, 0, 0 };
+    d.request(loadDangling, sizeof(loadDangling));
+    d.request(dangling, sizeof(dangling));
+    const uint8_t rejected[MICROFLO_CMD_SIZE] = { 3, GraphCmdError, DebugGraphImageInvalid, 0, 0, 0, 0, 0, 0, 0 };
+    MICROFLO_RETURN_VAL_IF_FAIL(checkResponse(d.response, rejected), -12);
+    const uint8_t pingRequest[] =   { 4, GraphCmdPing, 3, 4, 5, 6, 7, 8, 9, 10 };
+    const uint8_t pingResponse[] =  { 4, GraphCmdPong, 3, 4, 5, 6, 7, 8, 9, 10 };
+    d.request(pingRequest, sizeof(pingRequest));
+    MICROFLO_RETURN_VAL_IF_FAIL(checkResponse(d.response, pingResponse), -13);
+
+    // Command, image and next command in one chunk
+    uint8_t chunk[2*MICROFLO_CMD_SIZE+sizeof(image)];
+    memcpy(chunk, load, MICROFLO_CMD_SIZE);
+    memcpy(chunk+MICROFLO_CMD_SIZE, image, sizeof(image));
+    memcpy(chunk+MICROFLO_CMD_SIZE+sizeof(image), pingRequest, MICROFLO_CMD_SIZE);
+    d.sent = 0;
+    controller.parseBytes(chunk, sizeof(chunk));
+    MICROFLO_RETURN_VAL_IF_FAIL(d.sent == 2 && checkResponse(d.response, pingResponse), -14);
+
+    return 0;
+}
+
+// Stands in for reading program memory
+static uint8_t readInverted(const uint8_t *address) {
+    return ~(*address);
+}
+
+int
+test_graph_stream() {
+    FixedMessageQueue queue;
+    NullIO io;
+    FakeTransport transport;
+    Network network(&io, &queue);
+    HostCommunication controller;
+    transport.setup(&io, &controller);
+    controller.setup(&network, &transport);
+    FakeTransport &d = transport;
+
+    uint8_t stream[] = { 'm','i','c','r','o','f','l','o','1', 1,
+                         2, GraphCmdStopNetwork, 0, 0, 0, 0, 0, 0, 0, 0,
+                         3, GraphCmdClearNodes, 0, 0, 0, 0, 0, 0, 0, 0,
+                         4, GraphCmdConfigureDebug, DebugLevelError, 0, 0, 0, 0, 0, 0, 0,
+                         5, GraphCmdCreateComponent, 1, 0, 1, 1, 0, 0, 0, 0,
+                         6, GraphCmdCreateComponent, 1, 0, 1, 1, 0, 0, 0, 0,
+                         7, GraphCmdConnectNodes, 1, 2, 0, 0, 0, 0, 0, 0,
+                         8, GraphCmdSendPacket, 1, 0, MsgBoolean, 1, 0, 0, 0, 0,
+                         9, GraphCmdStartNetwork, 0, 0, 0, 0, 0, 0, 0, 0,
+                         10, GraphCmdEnd, 0, 0, 0, 0, 0, 0, 0, 0 };
+
+    // Network is built without anything being sent to host
+    MICROFLO_RETURN_VAL_IF_FAIL(controller.loadGraphStream(stream, sizeof(stream)) == MICROFLO_OK, -1);
+    MICROFLO_RETURN_VAL_IF_FAIL(d.sent == 0, -2);
+    MICROFLO_RETURN_VAL_IF_FAIL(network.currentState() == Network::Running, -3);
+    MICROFLO_RETURN_VAL_IF_FAIL(network.subscribeToPort(2, 0, true) == MICROFLO_OK, -4);
+
+    // Host can open communication afterwards
+    uint8_t openComm[MICROFLO_CMD_SIZE];
+    memcpy(openComm, MICROFLO_GRAPH_MAGIC, sizeof(MICROFLO_GRAPH_MAGIC));
+    openComm[MICROFLO_CMD_SIZE-1] = 1;
+    d.request(openComm, MICROFLO_CMD_SIZE);
+    MICROFLO_RETURN_VAL_IF_FAIL(d.sent == 1 && d.response[1] == GraphCmdCommunicationOpen, -5);
+
+    // Custom read function, as used for program memory
+    uint8_t inverted[sizeof(stream)];
+    for (size_t i=0; i<sizeof(stream); i++) {
+        inverted[i] = ~stream[i];
+    }
+    MICROFLO_RETURN_VAL_IF_FAIL(controller.loadGraphStream(inverted, sizeof(inverted), readInverted) == MICROFLO_OK, -6);
+    MICROFLO_RETURN_VAL_IF_FAIL(network.subscribeToPort(2, 0, true) == MICROFLO_OK, -7);
+
+    // First error is returned, still silently
+    stream[6*MICROFLO_CMD_SIZE+3] = 3; // connect to non-existing node
+    MICROFLO_RETURN_VAL_IF_FAIL(controller.loadGraphStream(stream, sizeof(stream)) == DebugNetworkConnectInvalidNodes, -8);
+    MICROFLO_RETURN_VAL_IF_FAIL(d.sent == 1, -9);
 
     return 0;
 }
@@ -0,0 +1,51 @@
+
+#include <microflo.h>
+#include "../microflo/io.hpp"
+
+// Pin states in memory. Only has single-pin operations, so batches use the IO fallback
+class PinStateIO : public NullIO {
+public:
+    PinStateIO() : writes(0), reads(0) {
+        for (int i=0; i<64; i++) {
+            state[i] = false;
+        }
+    }
+    virtual void DigitalWrite(MicroFlo::PinId pin, bool val) { state[pin] = val; writes++; }
+    virtual bool DigitalRead(MicroFlo::PinId pin) { reads++; return state[pin]; }
+public:
+    bool state[64];
+    int writes;
+    int reads;
+};
+
+int
+test_digital_many() {
+    PinStateIO io;
+    IO &generic = io;
+
+    // Bit i goes to pins[i], in any pin order
+    const MicroFlo::PinId pins[] = { 9, 2, 40, 3 };
+    generic.DigitalWriteMany(pins, 4, 0x5); // 0101
+    MICROFLO_RETURN_VAL_IF_FAIL(io.writes == 4, -1);
+    MICROFLO_RETURN_VAL_IF_FAIL(io.state[9] && !io.state[2] && io.state[40] && !io.state[3], -2);
+    MICROFLO_RETURN_VAL_IF_FAIL(generic.DigitalReadMany(pins, 4) == 0x5, -3);
+    MICROFLO_RETURN_VAL_IF_FAIL(io.reads == 4, -4);
+
+    // Bits above @count are ignored
+    generic.DigitalWriteMany(pins, 2, 0xE); // 1110
+    MICROFLO_RETURN_VAL_IF_FAIL(!io.state[9] && io.state[2] && io.state[40] && !io.state[3], -5);
+    MICROFLO_RETURN_VAL_IF_FAIL(generic.DigitalReadMany(pins, 2) == 0x2, -6);
+
+    // At most 32 pins, one per bit
+    MicroFlo::PinId many[40];
+    for (int i=0; i<40; i++) {
+        many[i] = i;
+    }
+    io.writes = 0;
+    generic.DigitalWriteMany(many, 40, 0x80000001);
+    MICROFLO_RETURN_VAL_IF_FAIL(io.writes == 32 && io.state[0] && io.state[31] && !io.state[32], -7);
+    io.reads = 0;
+    MICROFLO_RETURN_VAL_IF_FAIL(generic.DigitalReadMany(many, 40) == 0x80000001 && io.reads == 32, -8);
+
+    return 0;
+}
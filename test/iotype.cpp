@@ -0,0 +1,94 @@
+/* MicroFlo - Flow-Based Programming for microcontrollers
+ * Copyright (c) 2013 Jon Nordby <jononor@gmail.com>
+ * MicroFlo may be freely distributed under the MIT license
+ */
+
+// Runtime built with the IO backend fixed at compile time, like `microflo generate --io-type`.
+// Separate program from ./runtime.cpp, since MICROFLO_IO_TYPE applies to the whole build
+
+#define MICROFLO_IO_TYPE PinIO
+
+#include <microflo.h>
+#include "../microflo/io.hpp"
+
+#include <stdio.h>
+
+class PinIO MICROFLO_IO_FINAL : public NullIO {
+public:
+    PinIO() : writes(0) {
+        for (int i=0; i<8; i++) {
+            state[i] = false;
+        }
+    }
+    virtual void DigitalWrite(MicroFlo::PinId pin, bool val) { state[pin] = val; writes++; }
+    virtual bool DigitalRead(MicroFlo::PinId pin) { return state[pin]; }
+public:
+    bool state[8];
+    int writes;
+};
+
+// Writes incoming booleans to pin 3, and sends back what the pin reads
+class TestPinWrite : public SingleOutputComponent {
+public:
+    virtual void process(Packet in, MicroFlo::PortId port) {
+        if (in.isData()) {
+            io->DigitalWrite(3, in.asBool());
+            send(Packet(io->DigitalRead(3)), 0);
+        }
+    }
+};
+
+#include "./testcomponents.hpp"
+
+#include <microflo.cpp>
+
+Component *
+createComponent(unsigned char id) {
+    return NULL;
+}
+
+int
+test_io_type() {
+    PinIO io;
+    FixedMessageQueue queue;
+    Network network(&io, &queue);
+
+    MicroFlo::NodeId writer = 0;
+    MicroFlo::NodeId capture = 0;
+    TestCapture *captured = new TestCapture();
+    network.addNode(new TestPinWrite(), 0, &writer);
+    network.addNode(captured, 0, &capture);
+    network.connect(writer, 0, capture, 0);
+    network.start();
+
+    // Components reach the backend through the fixed IO type
+    network.sendMessageTo(writer, 0, Packet(true));
+    network.runTick();
+    network.runTick();
+    MICROFLO_RETURN_VAL_IF_FAIL(io.writes == 1 && io.state[3], -1);
+    MICROFLO_RETURN_VAL_IF_FAIL(captured->received == 1 && captured->last.asBool(), -2);
+
+    network.sendMessageTo(writer, 0, Packet(false));
+    network.runTick();
+    network.runTick();
+    MICROFLO_RETURN_VAL_IF_FAIL(io.writes == 2 && !io.state[3], -3);
+    MICROFLO_RETURN_VAL_IF_FAIL(captured->received == 2 && !captured->last.asBool(), -4);
+
+    return 0;
+}
+
+int
+main(int argc, char *argv[]) {
+
+    fprintf(stderr, "test_io_type():\n");
+    const int io_type_fails = test_io_type();
+
+    if (io_type_fails != 0) {
+        fprintf(stderr, "\tfailed at %d\n", io_type_fails);
+        return 1;
+    } else {
+        fprintf(stderr, "\tPASS\n");
+    }
+
+    return 0;
+}
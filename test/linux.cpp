@@ -0,0 +1,322 @@
+
+#include <microflo.h>
+#include "../microflo/io.hpp"
+#include "../microflo/linux.hpp"
+
+#include <sys/stat.h>
+
+// Reads what is currently available on @fd, without waiting
+static ssize_t
+readAvailable(int fd, uint8_t *buf, size_t length) {
+    const ssize_t n = read(fd, buf, length);
+    return (n < 0) ? 0 : n;
+}
+
+static std::string
+readFile(const std::string &path) {
+    std::ifstream file(path.c_str());
+    std::string content;
+    std::getline(file, content);
+    return content;
+}
+
+static void
+writeFile(const std::string &path, const std::string &content) {
+    std::ofstream file(path.c_str());
+    file << content;
+}
+
+// Stand-in for sysfs GPIO, with value and direction files for @pins
+static std::string
+createGpioDir(char *dir, const int *pins, int count) {
+    if (!mkdtemp(dir)) {
+        return "";
+    }
+    const std::string root = std::string(dir) + "/";
+    for (int i=0; i<count; i++) {
+        const std::string pin = root + "gpio" + std::to_string(pins[i]);
+        mkdir(pin.c_str(), 0700);
+        writeFile(pin + "/direction", "in");
+        writeFile(pin + "/value", "0");
+    }
+    return root;
+}
+
+static void
+removeGpioDir(const std::string &root, const int *pins, int count) {
+    for (int i=0; i<count; i++) {
+        const std::string pin = root + "gpio" + std::to_string(pins[i]);
+        unlink((pin + "/direction").c_str());
+        unlink((pin + "/value").c_str());
+        unlink((pin + "/edge").c_str());
+        rmdir(pin.c_str());
+    }
+    unlink((root + "export").c_str());
+    rmdir(root.c_str());
+}
+
+int
+test_linux_gpio() {
+    char dir[] = "/tmp/microflo-test-gpio-XXXXXX";
+    const int pins[] = { 5, 6 };
+    const std::string root = createGpioDir(dir, pins, 2);
+    MICROFLO_RETURN_VAL_IF_FAIL(!root.empty(), -1);
+    LinuxIO io(root);
+
+    // Mode goes to export and direction
+    io.PinSetMode(5, IO::OutputPin);
+    io.PinSetMode(6, IO::InputPin);
+    MICROFLO_RETURN_VAL_IF_FAIL(readFile(root+"export") == "6", -2);
+    MICROFLO_RETURN_VAL_IF_FAIL(readFile(root+"gpio5/direction") == "out", -3);
+    MICROFLO_RETURN_VAL_IF_FAIL(readFile(root+"gpio6/direction") == "in", -4);
+
+    // Value file is kept open, and written and read in place
+    io.DigitalWrite(5, true);
+    MICROFLO_RETURN_VAL_IF_FAIL(readFile(root+"gpio5/value") == "1", -5);
+    io.DigitalWrite(5, false);
+    MICROFLO_RETURN_VAL_IF_FAIL(readFile(root+"gpio5/value") == "0", -6);
+    MICROFLO_RETURN_VAL_IF_FAIL(!io.DigitalRead(6), -7);
+    writeFile(root+"gpio6/value", "1");
+    MICROFLO_RETURN_VAL_IF_FAIL(io.DigitalRead(6), -8);
+
+    removeGpioDir(root, pins, 2);
+    return 0;
+}
+
+static void countEdge(void *user) {
+    (*static_cast<int *>(user))++;
+}
+
+class CountingDebugHandler : public DebugHandler {
+public:
+    CountingDebugHandler() : failures(0) {}
+    virtual void emitDebug(DebugLevel level, DebugId id) {
+        failures += (id == DebugIoFailure) ? 1 : 0;
+    }
+public:
+    int failures;
+};
+
+int
+test_linux_interrupts() {
+    char dir[] = "/tmp/microflo-test-gpio-XXXXXX";
+    const int pins[] = { 7, 8 };
+    const std::string root = createGpioDir(dir, pins, 2);
+    MICROFLO_RETURN_VAL_IF_FAIL(!root.empty(), -1);
+    LinuxIO io(root);
+    CountingDebugHandler debug;
+    io.setDebugHandler(&debug);
+    int edges = 0;
+
+    // Edge is configured, and the handler called for edges on the pin
+    io.PinSetMode(7, IO::InputPin);
+    io.AttachExternalInterrupt(7, IO::Interrupt::OnRisingEdge, countEdge, &edges);
+    MICROFLO_RETURN_VAL_IF_FAIL(readFile(root+"gpio7/edge") == "rising", -2);
+    MICROFLO_RETURN_VAL_IF_FAIL(io.handleEdge(7) && edges == 1, -3);
+
+    // Plain files never signal an edge
+    MICROFLO_RETURN_VAL_IF_FAIL(io.pollInterrupts(1000) == 0 && edges == 1, -4);
+
+    // Detaching turns edge detection off
+    io.AttachExternalInterrupt(7, IO::Interrupt::OnRisingEdge, NULL, NULL);
+    MICROFLO_RETURN_VAL_IF_FAIL(readFile(root+"gpio7/edge") == "none", -5);
+    MICROFLO_RETURN_VAL_IF_FAIL(!io.handleEdge(7) && edges == 1, -6);
+    MICROFLO_RETURN_VAL_IF_FAIL(debug.failures == 0, -7);
+
+    // Value which cannot be read is reported, and no handler attached
+    const std::string fifo = root+"gpio8/value";
+    unlink(fifo.c_str());
+    mkfifo(fifo.c_str(), 0600);
+    io.PinSetMode(8, IO::InputPin);
+    io.AttachExternalInterrupt(8, IO::Interrupt::OnChange, countEdge, &edges);
+    MICROFLO_RETURN_VAL_IF_FAIL(debug.failures == 1, -8);
+    MICROFLO_RETURN_VAL_IF_FAIL(!io.handleEdge(8) && debug.failures == 2, -9);
+
+    removeGpioDir(root, pins, 2);
+    return 0;
+}
+
+int
+test_linux_serial_transport() {
+    FixedMessageQueue queue;
+    NullIO io;
+    Network network(&io, &queue);
+    HostCommunication controller;
+    const long latency = 200*1000;
+    char path[] = "/tmp/microflo-test-serial-XXXXXX";
+    const int tmp = mkstemp(path);
+    MICROFLO_RETURN_VAL_IF_FAIL(tmp >= 0, -1);
+    close(tmp);
+    LinuxSerialTransport transport(path, latency);
+    transport.setup(&io, &controller);
+    controller.setup(&network, &transport);
+
+    const int host = open(path, O_RDWR | O_NOCTTY | O_NONBLOCK);
+    unlink(path);
+    MICROFLO_RETURN_VAL_IF_FAIL(host >= 0, -2);
+    struct termios tty;
+    tcgetattr(host, &tty);
+    cfmakeraw(&tty);
+    tcsetattr(host, TCSANOW, &tty);
+
+    // Commands are held back until @latency has passed since the first
+    const uint8_t first[] = { 1, 2, 3 };
+    const uint8_t second[] = { 4, 5 };
+    transport.sendCommand(first, sizeof(first));
+    transport.sendCommand(second, sizeof(second));
+    transport.runTick();
+    uint8_t received[64];
+    MICROFLO_RETURN_VAL_IF_FAIL(readAvailable(host, received, sizeof(received)) == 0, -3);
+
+    // Then written out together
+    usleep(latency);
+    transport.runTick();
+    usleep(10*1000);
+    const uint8_t expected[] = { 1, 2, 3, 4, 5 };
+    const ssize_t n = readAvailable(host, received, sizeof(received));
+    MICROFLO_RETURN_VAL_IF_FAIL(n == sizeof(expected) && memcmp(received, expected, n) == 0, -4);
+
+    // Nothing queued, nothing written
+    usleep(latency);
+    transport.runTick();
+    usleep(10*1000);
+    MICROFLO_RETURN_VAL_IF_FAIL(readAvailable(host, received, sizeof(received)) == 0, -5);
+
+    close(host);
+    return 0;
+}
+
+static int
+connectUnix(const char *path) {
+    const int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    struct sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    strncpy(address.sun_path, path, sizeof(address.sun_path)-1);
+    if (connect(fd, (struct sockaddr *)&address, sizeof(address)) != 0) {
+        close(fd);
+        return -1;
+    }
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+    return fd;
+}
+
+// Runs @transport until @length bytes have come back on @fd, or it gives up
+static bool
+receiveReply(LinuxSocketTransport &transport, int fd, uint8_t *buf, size_t length) {
+    size_t received = 0;
+    for (int i=0; i<100 && received < length; i++) {
+        transport.runTick();
+        received += readAvailable(fd, buf+received, length-received);
+    }
+    return received == length;
+}
+
+int
+test_linux_socket_transport() {
+    FixedMessageQueue queue;
+    NullIO io;
+    Network network(&io, &queue);
+    HostCommunication controller;
+    char dir[] = "/tmp/microflo-test-socket-XXXXXX";
+    MICROFLO_RETURN_VAL_IF_FAIL(mkdtemp(dir), -1);
+    const std::string path = std::string(dir) + "/runtime.sock";
+    LinuxSocketTransport transport(path);
+    transport.setup(&io, &controller);
+    controller.setup(&network, &transport);
+
+    const int a = connectUnix(path.c_str());
+    const int b = connectUnix(path.c_str());
+    for (int i=0; i<100 && transport.clientCount() < 2; i++) {
+        transport.runTick();
+    }
+    MICROFLO_RETURN_VAL_IF_FAIL(a >= 0 && b >= 0 && transport.clientCount() == 2, -2);
+
+    uint8_t openComm[MICROFLO_CMD_SIZE];
+    memcpy(openComm, MICROFLO_GRAPH_MAGIC, sizeof(MICROFLO_GRAPH_MAGIC));
+    openComm[MICROFLO_CMD_SIZE-1] = 1;
+    const uint8_t ping[MICROFLO_CMD_SIZE] = { 2, GraphCmdPing, 0, 0, 0, 0, 0, 0, 0, 0 };
+    const uint8_t pong[MICROFLO_CMD_SIZE] = { 2, GraphCmdPong, 0, 0, 0, 0, 0, 0, 0, 0 };
+    uint8_t reply[MICROFLO_CMD_SIZE];
+
+    // Communication is opened per client, only @a gets an answer
+    MICROFLO_RETURN_VAL_IF_FAIL(write(a, openComm, sizeof(openComm)) == sizeof(openComm), -3);
+    MICROFLO_RETURN_VAL_IF_FAIL(receiveReply(transport, a, reply, sizeof(reply)), -4);
+    MICROFLO_RETURN_VAL_IF_FAIL(reply[1] == GraphCmdCommunicationOpen, -5);
+    MICROFLO_RETURN_VAL_IF_FAIL(write(b, ping, sizeof(ping)) == sizeof(ping), -6);
+    MICROFLO_RETURN_VAL_IF_FAIL(!receiveReply(transport, b, reply, 1), -7);
+    MICROFLO_RETURN_VAL_IF_FAIL(readAvailable(a, reply, sizeof(reply)) == 0, -8);
+
+    // Half a command from @a does not hold up @b
+    MICROFLO_RETURN_VAL_IF_FAIL(write(a, ping, 4) == 4, -9);
+    MICROFLO_RETURN_VAL_IF_FAIL(write(b, openComm, sizeof(openComm)) == sizeof(openComm), -10);
+    MICROFLO_RETURN_VAL_IF_FAIL(receiveReply(transport, b, reply, sizeof(reply)), -11);
+    MICROFLO_RETURN_VAL_IF_FAIL(write(b, ping, sizeof(ping)) == sizeof(ping), -12);
+    MICROFLO_RETURN_VAL_IF_FAIL(receiveReply(transport, b, reply, sizeof(reply)), -13);
+    MICROFLO_RETURN_VAL_IF_FAIL(memcmp(reply, pong, sizeof(pong)) == 0, -14);
+    MICROFLO_RETURN_VAL_IF_FAIL(write(a, ping+4, sizeof(ping)-4) == sizeof(ping)-4, -15);
+    MICROFLO_RETURN_VAL_IF_FAIL(receiveReply(transport, a, reply, sizeof(reply)), -16);
+    MICROFLO_RETURN_VAL_IF_FAIL(memcmp(reply, pong, sizeof(pong)) == 0, -17);
+
+    // Protocol version is per client, @b stays in version 1
+    const uint8_t setVersion[MICROFLO_CMD_SIZE] = { 3, GraphCmdSetProtocolVersion, 2, 0, 0, 0, 0, 0, 0, 0 };
+    MICROFLO_RETURN_VAL_IF_FAIL(write(a, setVersion, sizeof(setVersion)) == sizeof(setVersion), -18);
+    MICROFLO_RETURN_VAL_IF_FAIL(receiveReply(transport, a, reply, sizeof(reply)), -19);
+    MICROFLO_RETURN_VAL_IF_FAIL(reply[1] == GraphCmdProtocolVersionChanged, -20);
+    MICROFLO_RETURN_VAL_IF_FAIL(write(b, ping, sizeof(ping)) == sizeof(ping), -21);
+    MICROFLO_RETURN_VAL_IF_FAIL(receiveReply(transport, b, reply, sizeof(reply)), -22);
+    MICROFLO_RETURN_VAL_IF_FAIL(memcmp(reply, pong, sizeof(pong)) == 0, -23);
+    MICROFLO_RETURN_VAL_IF_FAIL(readAvailable(a, reply, sizeof(reply)) == 0, -24);
+
+    // Disconnected client is removed
+    close(a);
+    for (int i=0; i<100 && transport.clientCount() > 1; i++) {
+        transport.runTick();
+    }
+    MICROFLO_RETURN_VAL_IF_FAIL(transport.clientCount() == 1, -25);
+
+    // Packets only go to the clients subscribed to that edge
+    MicroFlo::NodeId source = 0;
+    MicroFlo::NodeId target = 0;
+    network.addNode(new TestForward(), 0, &source);
+    network.addNode(new TestForward(), 0, &target);
+    network.connect(source, 0, target, 0);
+    network.start();
+    const int c = connectUnix(path.c_str());
+    for (int i=0; i<100 && transport.clientCount() < 2; i++) {
+        transport.runTick();
+    }
+    MICROFLO_RETURN_VAL_IF_FAIL(c >= 0 && transport.clientCount() == 2, -26);
+    MICROFLO_RETURN_VAL_IF_FAIL(write(c, openComm, sizeof(openComm)) == sizeof(openComm), -27);
+    MICROFLO_RETURN_VAL_IF_FAIL(receiveReply(transport, c, reply, sizeof(reply)), -28);
+
+    const uint8_t subscribe[MICROFLO_CMD_SIZE] = { 4, GraphCmdSubscribeToPort, source, 0, 1, 0, 0, 0, 0, 0 };
+    const uint8_t unsubscribe[MICROFLO_CMD_SIZE] = { 5, GraphCmdSubscribeToPort, source, 0, 0, 0, 0, 0, 0, 0 };
+    MICROFLO_RETURN_VAL_IF_FAIL(write(b, subscribe, sizeof(subscribe)) == sizeof(subscribe), -29);
+    MICROFLO_RETURN_VAL_IF_FAIL(receiveReply(transport, b, reply, sizeof(reply)), -30);
+    MICROFLO_RETURN_VAL_IF_FAIL(reply[1] == GraphCmdPortSubscriptionChanged, -31);
+    network.sendMessageTo(source, 0, Packet((long)1));
+    network.runTick();
+    network.runTick();
+    MICROFLO_RETURN_VAL_IF_FAIL(receiveReply(transport, b, reply, sizeof(reply)), -32);
+    MICROFLO_RETURN_VAL_IF_FAIL(reply[1] == GraphCmdPacketSent && reply[2] == source, -33);
+    MICROFLO_RETURN_VAL_IF_FAIL(readAvailable(c, reply, sizeof(reply)) == 0, -34);
+
+    // Unsubscribing one client keeps the edge subscribed for the other
+    MICROFLO_RETURN_VAL_IF_FAIL(write(c, subscribe, sizeof(subscribe)) == sizeof(subscribe), -35);
+    MICROFLO_RETURN_VAL_IF_FAIL(receiveReply(transport, c, reply, sizeof(reply)), -36);
+    MICROFLO_RETURN_VAL_IF_FAIL(write(b, unsubscribe, sizeof(unsubscribe)) == sizeof(unsubscribe), -37);
+    MICROFLO_RETURN_VAL_IF_FAIL(receiveReply(transport, b, reply, sizeof(reply)), -38);
+    network.sendMessageTo(source, 0, Packet((long)2));
+    network.runTick();
+    network.runTick();
+    MICROFLO_RETURN_VAL_IF_FAIL(receiveReply(transport, c, reply, sizeof(reply)), -39);
+    MICROFLO_RETURN_VAL_IF_FAIL(reply[1] == GraphCmdPacketSent && reply[2] == source, -40);
+    MICROFLO_RETURN_VAL_IF_FAIL(readAvailable(b, reply, sizeof(reply)) == 0, -41);
+
+    close(c);
+    close(b);
+    unlink(path.c_str());
+    rmdir(dir);
+    return 0;
+}
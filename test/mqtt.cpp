@@ -0,0 +1,488 @@
+
+#include <microflo.h>
+#include "../microflo/io.hpp"
+#include "../microflo/mqtt.hpp"
+#include "../microflo/mqttqueue.hpp"
+#include "../microflo/mqttmount.hpp"
+#include "../microflo/mqttloopback.hpp"
+#include "../microflo/mqtthost.hpp"
+#include "./testcomponents.hpp"
+
+// Other end of the MQTT connection, collects what the mount publishes
+class TestMqttPeer : public MqttClientHandler {
+public:
+    virtual void mqttConnected() {}
+    virtual void mqttMessage(const char *topic, const uint8_t *payload, size_t length) {
+        std::lock_guard<std::mutex> lock(mutex);
+        topics.push_back(topic);
+        packets.push_back(decodePayload(PayloadMsgPack, (const char *)payload, length));
+    }
+    size_t received() {
+        std::lock_guard<std::mutex> lock(mutex);
+        return packets.size();
+    }
+public:
+    std::mutex mutex;
+    std::vector<std::string> topics;
+    std::vector<Packet> packets;
+};
+
+// Host end of the MicroFlo protocol over MQTT, keeps the last message
+class TestHostPeer : public MqttClientHandler {
+public:
+    TestHostPeer() : count(0) {}
+    virtual void mqttConnected() {}
+    virtual void mqttMessage(const char *topic, const uint8_t *payload, size_t length) {
+        std::lock_guard<std::mutex> lock(mutex);
+        last.assign(payload, payload+length);
+        count++;
+    }
+    size_t received() {
+        std::lock_guard<std::mutex> lock(mutex);
+        return count;
+    }
+public:
+    std::mutex mutex;
+    std::vector<uint8_t> last;
+    size_t count;
+};
+
+// Runs a mount on a thread of its own, stopped when going out of scope
+class TestMountRunner {
+public:
+    TestMountRunner(MqttMount *m) : mount(m), thread(&MqttMount::run, m) {}
+    ~TestMountRunner() {
+        mount->stop();
+        thread.join();
+    }
+private:
+    MqttMount *mount;
+    std::thread thread;
+};
+
+// Runs a tenant host on a thread of its own, stopped when going out of scope
+class TestHostRunner {
+public:
+    TestHostRunner(MqttTenantHost *h) : host(h), thread(&MqttTenantHost::run, h) {}
+    ~TestHostRunner() {
+        host->stop();
+        thread.join();
+    }
+private:
+    MqttTenantHost *host;
+    std::thread thread;
+};
+
+// Repeat graph instance, for multi-tenant test
+struct TestTenant {
+    TestTenant(MqttClient *client, const std::string &role)
+        : network(&io, &queue)
+        , mount(NULL)
+    {
+        MicroFlo::NodeId a = 0;
+        MicroFlo::NodeId b = 0;
+        network.addNode(new TestForward(), 0, &a);
+        network.addNode(new TestForward(), 0, &b);
+        network.connect(a, 0, b, 0);
+        network.start();
+
+        MqttOptions options;
+        mqttDefaultOptions(&options);
+        options.info.role = role;
+        options.info.addInport("in", a, 0)->addOutport("out", b, 0);
+        options.info.setPayloadFormat("*", PayloadMsgPack);
+        mount = new MqttMount(&network, client, options);
+        transport.setup(&io, mount);
+        mount->setup(&network, &transport);
+    }
+    ~TestTenant() {
+        delete mount;
+    }
+
+    NullIO io;
+    FixedMessageQueue queue;
+    Network network;
+    LinuxMqttHostTransport transport;
+    MqttMount *mount;
+};
+
+// Polls @condition for up to two seconds
+template <typename Condition>
+static bool
+waitFor(Condition condition) {
+    for (int i=0; i<2000 && !condition(); i++) {
+        usleep(1000);
+    }
+    return condition();
+}
+
+int
+test_mqtt() {
+    // Routing
+    ParticipantInfo info;
+    info.role = "gateway";
+    char name[20];
+    for (int i=0; i<40; i++) {
+        snprintf(name, sizeof(name), "port%d", i);
+        info.addInport(name, i/4+1, i%4);
+    }
+    PortRouter router;
+    MICROFLO_RETURN_VAL_IF_FAIL(router.findByTopic("/gateway/port1") == NULL, -1);
+    router.build(info.inports);
+    for (int i=0; i<40; i++) {
+        snprintf(name, sizeof(name), "/gateway/port%d", i);
+        const Port *byTopic = router.findByTopic(name);
+        MICROFLO_RETURN_VAL_IF_FAIL(byTopic == &info.inports[i], -2);
+        const Port *byEdge = router.findByEdge(i/4+1, i%4);
+        MICROFLO_RETURN_VAL_IF_FAIL(byEdge == &info.inports[i], -3);
+    }
+    MICROFLO_RETURN_VAL_IF_FAIL(router.findByTopic("/gateway/port40") == NULL, -4);
+    MICROFLO_RETURN_VAL_IF_FAIL(router.findByTopic("/gateway/port") == NULL, -5);
+    MICROFLO_RETURN_VAL_IF_FAIL(router.findByTopic("/gateway/port1x", 14) == &info.inports[1], -6);
+    MICROFLO_RETURN_VAL_IF_FAIL(router.findByEdge(1, 4) == NULL, -7);
+    MICROFLO_RETURN_VAL_IF_FAIL(router.findByEdge(20, 0) == NULL, -8);
+
+    // Decoding straight from a payload buffer, not 0-terminated
+    const char payload[] = { '1', '2', '3', '4' };
+    MICROFLO_RETURN_VAL_IF_FAIL(decodePacket(payload, 3).asInteger() == 123, -9);
+    MICROFLO_RETURN_VAL_IF_FAIL(decodePacket("-42", 3).asInteger() == -42, -10);
+    MICROFLO_RETURN_VAL_IF_FAIL(decodePacket("truex", 4).asBool() == true, -11);
+    MICROFLO_RETURN_VAL_IF_FAIL(decodePacket("false", 5).type() == MsgBoolean, -12);
+    MICROFLO_RETURN_VAL_IF_FAIL(decodePacket("null", 4).isVoid(), -13);
+    MICROFLO_RETURN_VAL_IF_FAIL(decodePacket("0", 1).type() == MsgInteger, -14);
+    MICROFLO_RETURN_VAL_IF_FAIL(decodePacket("[", 1).type() == MsgBracketStart, -15);
+    MICROFLO_RETURN_VAL_IF_FAIL(decodePacket("00", 2).asInteger() == 0, -16);
+    MICROFLO_RETURN_VAL_IF_FAIL(decodePacket("abc", 3).type() == MsgInvalid, -17);
+    MICROFLO_RETURN_VAL_IF_FAIL(decodePacket("", 0).type() == MsgInvalid, -18);
+    MICROFLO_RETURN_VAL_IF_FAIL(decodePacket(" 7\r\n", 4).asInteger() == 7, -19);
+    MICROFLO_RETURN_VAL_IF_FAIL(decodePacket("7 apples", 8).type() == MsgInvalid, -20);
+    MICROFLO_RETURN_VAL_IF_FAIL(decodePacket("1.5", 3).asFloat() == 1.5f, -21);
+    MICROFLO_RETURN_VAL_IF_FAIL(decodePacket("-2e3", 4).asFloat() == -2000.0f, -22);
+    MICROFLO_RETURN_VAL_IF_FAIL(decodePacket("1.2.3", 5).type() == MsgInvalid, -23);
+    MICROFLO_RETURN_VAL_IF_FAIL(decodePacket("1e", 2).type() == MsgInvalid, -24);
+    MICROFLO_RETURN_VAL_IF_FAIL(decodePacket("Error: OperationTimeout", 23).asError() == ErrorOperationTimeout, -25);
+    MICROFLO_RETURN_VAL_IF_FAIL(decodePacket("Error: Nope", 11).type() == MsgInvalid, -26);
+
+    // Encoding into a buffer, and back
+    const Packet packets[] = {
+        Packet(), Packet(true), Packet(false), Packet((long)0), Packet((long)-2147483647-1), Packet(123456789L),
+        Packet(2.0f), Packet(-0.125f), Packet(3.14159f), Packet(1e20f), Packet(1.5e-7f),
+        Packet(ErrorComponentBug), Packet(MsgBracketStart), Packet(MsgBracketEnd)
+    };
+    char buf[MICROFLO_PACKET_TEXT_MAX];
+    for (size_t i=0; i<sizeof(packets)/sizeof(packets[0]); i++) {
+        const size_t length = encodePacket(packets[i], buf, sizeof(buf));
+        MICROFLO_RETURN_VAL_IF_FAIL(length > 0 && length == strlen(buf), -27);
+        const Packet decoded = decodePacket(buf, length);
+        MICROFLO_RETURN_VAL_IF_FAIL(decoded.type() == packets[i].type(), -28);
+        const bool sameValue = (decoded.isFloat() && decoded.asFloat() == packets[i].asFloat())
+                || (decoded.isInteger() && decoded.asInteger() == packets[i].asInteger())
+                || (decoded.isBool() && decoded.asBool() == packets[i].asBool())
+                || (decoded.isError() && decoded.asError() == packets[i].asError())
+                || decoded.isVoid() || decoded.isStartBracket() || decoded.isEndBracket();
+        MICROFLO_RETURN_VAL_IF_FAIL(sameValue, -29);
+    }
+    MICROFLO_RETURN_VAL_IF_FAIL(encodePacket(Packet(2.0f), buf, sizeof(buf)) == 3 && strcmp(buf, "2.0") == 0, -30);
+    MICROFLO_RETURN_VAL_IF_FAIL(encodePacket(Packet(-42L), buf, sizeof(buf)) == 3 && strcmp(buf, "-42") == 0, -31);
+    MICROFLO_RETURN_VAL_IF_FAIL(encodePacket(Packet((unsigned char)7), buf, sizeof(buf)) == 1, -32);
+    MICROFLO_RETURN_VAL_IF_FAIL(encodePacket(Packet(ErrorInvalidInput), buf, sizeof(buf)) > 0
+                                && strcmp(buf, "Error: InvalidInput") == 0, -33);
+    // Does not write past @size
+    memset(buf, 'x', sizeof(buf));
+    MICROFLO_RETURN_VAL_IF_FAIL(encodePacket(Packet(12345L), buf, 5) == 0 && buf[5] == 'x', -34);
+    MICROFLO_RETURN_VAL_IF_FAIL(encodePacket(Packet(1234L), buf, 5) == 4, -35);
+    // No JSON for infinity and NaN, nor numbers which do not fit the packet
+    const float zero = 0.0f;
+    MICROFLO_RETURN_VAL_IF_FAIL(encodePacket(Packet(1.0f/zero), buf, sizeof(buf)) == 0, -70);
+    MICROFLO_RETURN_VAL_IF_FAIL(encodePacket(Packet(-1.0f/zero), buf, sizeof(buf)) == 0, -71);
+    MICROFLO_RETURN_VAL_IF_FAIL(encodePacket(Packet(zero/zero), buf, sizeof(buf)) == 0, -72);
+    MICROFLO_RETURN_VAL_IF_FAIL(decodePacket("inf", 3).type() == MsgInvalid, -73);
+    MICROFLO_RETURN_VAL_IF_FAIL(decodePacket("1e39", 4).type() == MsgInvalid, -74);
+    MICROFLO_RETURN_VAL_IF_FAIL(decodePacket("-1e999", 6).type() == MsgInvalid, -75);
+    char number[MICROFLO_PACKET_TEXT_MAX];
+    const int maxLength = snprintf(number, sizeof(number), "%ld", LONG_MAX);
+    MICROFLO_RETURN_VAL_IF_FAIL(decodePacket(number, maxLength).asInteger() == LONG_MAX, -76);
+    number[maxLength-1]++; // LONG_MAX+1
+    MICROFLO_RETURN_VAL_IF_FAIL(decodePacket(number, maxLength).type() == MsgInvalid, -77);
+    const int minLength = snprintf(number, sizeof(number), "%ld", LONG_MIN);
+    MICROFLO_RETURN_VAL_IF_FAIL(decodePacket(number, minLength).asInteger() == LONG_MIN, -78);
+    number[minLength-1]++; // LONG_MIN-1
+    MICROFLO_RETURN_VAL_IF_FAIL(decodePacket(number, minLength).type() == MsgInvalid, -79);
+    MICROFLO_RETURN_VAL_IF_FAIL(decodePacket("99999999999999999999999", 23).type() == MsgInvalid, -80);
+
+    // MessagePack, keeps exact type and value
+    const Packet binaryPackets[] = {
+        Packet(), Packet(true), Packet(false), Packet(0L), Packet(127L), Packet(-32L), Packet(-33L), Packet(200L),
+        Packet(-40000L), Packet(70000L), Packet((long)-2147483647-1), Packet(3.14159f), Packet(1.5e-7f),
+        Packet((unsigned char)200), Packet(ErrorComponentBug), Packet(MsgBracketStart), Packet(MsgBracketEnd)
+    };
+    uint8_t bin[MICROFLO_PACKET_MSGPACK_MAX];
+    for (size_t i=0; i<sizeof(binaryPackets)/sizeof(binaryPackets[0]); i++) {
+        const Packet &p = binaryPackets[i];
+        const size_t length = encodePacketMsgPack(p, bin, sizeof(bin));
+        MICROFLO_RETURN_VAL_IF_FAIL(length > 0, -36);
+        const Packet decoded = decodePacketMsgPack(bin, length);
+        MICROFLO_RETURN_VAL_IF_FAIL(decoded.type() == p.type(), -37);
+        const bool sameValue = (p.isFloat() && decoded.asFloat() == p.asFloat())
+                || (p.isInteger() && decoded.asInteger() == p.asInteger())
+                || (p.isByte() && decoded.asByte() == p.asByte())
+                || (p.isBool() && decoded.asBool() == p.asBool())
+                || (p.isError() && decoded.asError() == p.asError())
+                || p.isVoid() || p.isStartBracket() || p.isEndBracket();
+        MICROFLO_RETURN_VAL_IF_FAIL(sameValue, -38);
+        MICROFLO_RETURN_VAL_IF_FAIL(decodePacketMsgPack(bin, length-1).type() == MsgInvalid || length == 1, -39);
+    }
+    // Standard encodings, as another MessagePack implementation would write them
+    MICROFLO_RETURN_VAL_IF_FAIL(encodePacketMsgPack(Packet(5L), bin, sizeof(bin)) == 1 && bin[0] == 0x05, -40);
+    MICROFLO_RETURN_VAL_IF_FAIL(encodePacketMsgPack(Packet(-1L), bin, sizeof(bin)) == 1 && bin[0] == 0xff, -41);
+    MICROFLO_RETURN_VAL_IF_FAIL(encodePacketMsgPack(Packet(1000L), bin, sizeof(bin)) == 3
+                                && bin[0] == 0xd1 && bin[1] == 0x03 && bin[2] == 0xe8, -42);
+    MICROFLO_RETURN_VAL_IF_FAIL(encodePacketMsgPack(Packet(1.0f), bin, sizeof(bin)) == 5
+                                && bin[0] == 0xca && bin[1] == 0x3f && bin[2] == 0x80 && bin[4] == 0, -43);
+    const uint8_t uint16[] = { 0xcd, 0x12, 0x34 };
+    MICROFLO_RETURN_VAL_IF_FAIL(decodePacketMsgPack(uint16, 3).asInteger() == 0x1234, -44);
+    const uint8_t float64[] = { 0xcb, 0x3f, 0xf8, 0, 0, 0, 0, 0, 0 };
+    MICROFLO_RETURN_VAL_IF_FAIL(decodePacketMsgPack(float64, 9).asFloat() == 1.5f, -45);
+    const uint8_t str[] = { 0xa1, 'x' };
+    MICROFLO_RETURN_VAL_IF_FAIL(decodePacketMsgPack(str, 2).type() == MsgInvalid, -46);
+    MICROFLO_RETURN_VAL_IF_FAIL(encodePacketMsgPack(Packet(5L), bin, 0) == 0, -47);
+    MICROFLO_RETURN_VAL_IF_FAIL(encodePacketMsgPack(Packet(1.0f), bin, 4) == 0, -48);
+
+    // Payload format is chosen per port, and advertised
+    ParticipantInfo sensor;
+    sensor.role = "sensor";
+    sensor.addInport("in", 1, 0)->addInport("config", 1, 1)->addOutport("out", 2, 0);
+    MICROFLO_RETURN_VAL_IF_FAIL(sensor.setPayloadFormat("out,in", PayloadMsgPack) == 2, -49);
+    MICROFLO_RETURN_VAL_IF_FAIL(sensor.inports[0].format == PayloadMsgPack
+                                && sensor.inports[1].format == PayloadText, -50);
+    const std::string discovery = msgfloDiscoveryMessage(&sensor);
+    MICROFLO_RETURN_VAL_IF_FAIL(discovery.find("\"encoding\": \"msgpack\"") != std::string::npos, -51);
+    MICROFLO_RETURN_VAL_IF_FAIL(discovery.find("\"queue\": \"/sensor/config\"") != std::string::npos, -52);
+    MICROFLO_RETURN_VAL_IF_FAIL(sensor.setPayloadFormat("*", PayloadText) == 3, -53);
+    const size_t textLength = encodePayload(sensor.outports[0].format, Packet(42L), buf, sizeof(buf));
+    MICROFLO_RETURN_VAL_IF_FAIL(decodePayload(PayloadText, buf, textLength).asInteger() == 42, -54);
+
+    // Outbound queue: bounded, drop policy, coalescing and counters
+    {
+        const Port &out = sensor.outports[0];
+        MqttOutbox newest(2, MqttDropNewest);
+        MICROFLO_RETURN_VAL_IF_FAIL(newest.push(&out, "1", 1) && newest.push(&out, "2", 1), -55);
+        MICROFLO_RETURN_VAL_IF_FAIL(!newest.push(&out, "3", 1), -56);
+        MqttOutbound popped;
+        MICROFLO_RETURN_VAL_IF_FAIL(newest.pop(&popped, 0) && popped.data[0] == '1' && popped.port == &out, -57);
+        newest.published(true);
+        MICROFLO_RETURN_VAL_IF_FAIL(newest.pop(&popped, 0) && popped.data[0] == '2', -58);
+        newest.published(false);
+        MICROFLO_RETURN_VAL_IF_FAIL(!newest.pop(&popped, 10), -59);
+        MqttOutboundStats stats = newest.statistics();
+        MICROFLO_RETURN_VAL_IF_FAIL(stats.queued == 2 && stats.dropped == 1 && stats.sent == 1 && stats.failed == 1, -60);
+
+        MqttOutbox oldest(2, MqttDropOldest);
+        oldest.push(&out, "1", 1);
+        oldest.push(&out, "2", 1);
+        MICROFLO_RETURN_VAL_IF_FAIL(oldest.push(&out, "3", 1) && oldest.size() == 2, -61);
+        MICROFLO_RETURN_VAL_IF_FAIL(oldest.pop(&popped, 0) && popped.data[0] == '2', -62);
+        MICROFLO_RETURN_VAL_IF_FAIL(oldest.statistics().dropped == 1, -63);
+
+        // A burst on a coalescing port is one publish of the latest value, other ports unaffected
+        Port &in = sensor.inports[0];
+        sensor.setCoalesce("out", true);
+        MqttOutbox coalescing(8);
+        coalescing.push(&out, "10", 2);
+        coalescing.push(&in, "a", 1);
+        coalescing.push(&out, "11", 2);
+        coalescing.push(&out, "123", 3);
+        MICROFLO_RETURN_VAL_IF_FAIL(coalescing.size() == 2 && coalescing.statistics().coalesced == 2, -64);
+        MICROFLO_RETURN_VAL_IF_FAIL(coalescing.pop(&popped, 0) && popped.length == 3
+                                    && memcmp(popped.data, "123", 3) == 0, -65);
+        MICROFLO_RETURN_VAL_IF_FAIL(coalescing.pop(&popped, 0) && popped.port == &in, -66);
+
+        // Closing wakes up publisher
+        coalescing.close();
+        MICROFLO_RETURN_VAL_IF_FAIL(!coalescing.pop(&popped), -67);
+        MICROFLO_RETURN_VAL_IF_FAIL(!coalescing.push(&out, buf, MICROFLO_PACKET_TEXT_MAX+1), -68);
+        MICROFLO_RETURN_VAL_IF_FAIL(sensor.setQos("in,out", 1) == 2 && out.qos == 1 && sensor.inports[1].qos == 0, -69);
+    }
+
+    // Inbound queue drops when the network does not keep up, instead of blocking the MQTT thread
+    {
+        FixedMessageQueue queue;
+        NullIO io;
+        Network network(&io, &queue);
+        MqttOptions options;
+        mqttDefaultOptions(&options);
+        options.info.role = "flood";
+        options.info.addInport("in", 1, 0);
+        network.addNode(new TestForward(), 0, NULL);
+        network.start();
+        LoopbackMqttBroker broker;
+        LoopbackMqttClient client(&broker);
+        LinuxMqttHostTransport transport;
+        MqttMount mount(&network, &client, options);
+        transport.setup(&io, &mount);
+        mount.setup(&network, &transport);
+        MICROFLO_RETURN_VAL_IF_FAIL(mount.connect(), -81);
+        TestHostPeer host;
+        LoopbackMqttClient hostClient(&broker);
+        hostClient.setHandler(&host);
+        hostClient.start();
+        hostClient.subscribe("flood/microflo/send", 0);
+        MICROFLO_RETURN_VAL_IF_FAIL(waitFor([&] { return broker.subscribers("flood/microflo/send") == 1; }), -82);
+
+        const uint8_t one[] = { '1' };
+        for (int i=0; i<MICROFLO_MQTT_INBOUND_QUEUE+3; i++) {
+            mount.mqttMessage("/flood/in", one, sizeof(one));
+        }
+        MICROFLO_RETURN_VAL_IF_FAIL(mount.inboundDropped() == 3 && mount.hasWork(), -83);
+        while (mount.step()) {}
+
+        // Host message spanning two chunks is dropped whole when only one slot is free
+        uint8_t commands[5*MICROFLO_CMD_SIZE] = { 0 };
+        memcpy(commands, MICROFLO_GRAPH_MAGIC, sizeof(MICROFLO_GRAPH_MAGIC));
+        commands[MICROFLO_CMD_SIZE-1] = 1;
+        for (int i=1; i<5; i++) {
+            commands[i*MICROFLO_CMD_SIZE] = i; // request id
+            commands[i*MICROFLO_CMD_SIZE+1] = GraphCmdPing;
+        }
+        for (int i=0; i<MICROFLO_MQTT_INBOUND_QUEUE-1; i++) {
+            mount.mqttMessage("/flood/in", one, sizeof(one));
+        }
+        mount.mqttMessage("flood/microflo/receive", commands, sizeof(commands));
+        MICROFLO_RETURN_VAL_IF_FAIL(mount.inboundDropped() == 4, -84);
+        while (mount.step()) {}
+
+        // So the next host message still parses. Opening the protocol and the ping are answered
+        commands[MICROFLO_CMD_SIZE] = 9;
+        mount.mqttMessage("flood/microflo/receive", commands, 2*MICROFLO_CMD_SIZE);
+        while (mount.step()) {}
+        MICROFLO_RETURN_VAL_IF_FAIL(waitFor([&] { return host.received() == 2; }), -85);
+        MICROFLO_RETURN_VAL_IF_FAIL(host.last[0] == 9 && host.last[1] == GraphCmdPong, -86);
+        hostClient.stop();
+    }
+
+    return 0;
+}
+
+int
+test_mqtt_loopback() {
+    // Repeat graph, exported as MsgFlo participant over a loopback broker
+    FixedMessageQueue queue;
+    NullIO io;
+    Network network(&io, &queue);
+    MicroFlo::NodeId a = 0;
+    MicroFlo::NodeId b = 0;
+    network.addNode(new TestForward(), 0, &a);
+    network.addNode(new TestForward(), 0, &b);
+    network.connect(a, 0, b, 0);
+    network.start();
+
+    MqttOptions options;
+    mqttDefaultOptions(&options);
+    options.info.role = "repeat";
+    options.info.addInport("in", a, 0)->addOutport("out", b, 0);
+    options.info.setPayloadFormat("*", PayloadMsgPack);
+    options.outboundQueueLength = 128; // the whole burst, so nothing is dropped
+
+    LoopbackMqttBroker broker;
+    LoopbackMqttClient mountClient(&broker);
+    LinuxMqttHostTransport transport;
+    MqttMount mount(&network, &mountClient, options);
+    transport.setup(&io, &mount);
+    mount.setup(&network, &transport);
+    MICROFLO_RETURN_VAL_IF_FAIL(mount.connect(), -1);
+    TestMqttPeer peer;
+    LoopbackMqttClient peerClient(&broker);
+    TestMountRunner runner(&mount);
+    peerClient.setHandler(&peer);
+    peerClient.start();
+    peerClient.subscribe("/repeat/out", 0);
+    MICROFLO_RETURN_VAL_IF_FAIL(waitFor([&] { return broker.subscribers("/repeat/in") == 1; }), -2);
+
+    // Packets come back in order, with exact types
+    uint8_t payload[MICROFLO_PACKET_MSGPACK_MAX];
+    const int messages = 100;
+    for (long i=0; i<messages; i++) {
+        const Packet pkg = (i % 2) ? Packet(i*1000L) : Packet(i/4.0f);
+        const size_t length = encodePacketMsgPack(pkg, payload, sizeof(payload));
+        peerClient.publish("/repeat/in", payload, length, 0);
+    }
+    MICROFLO_RETURN_VAL_IF_FAIL(waitFor([&] { return peer.received() == (size_t)messages; }), -3);
+    for (long i=0; i<messages; i++) {
+        const Packet &p = peer.packets[i];
+        MICROFLO_RETURN_VAL_IF_FAIL(peer.topics[i] == "/repeat/out", -4);
+        MICROFLO_RETURN_VAL_IF_FAIL((i % 2) ? p.asInteger() == i*1000L : p.asFloat() == i/4.0f, -5);
+    }
+    const MqttOutboundStats stats = mount.outboundStatistics();
+    MICROFLO_RETURN_VAL_IF_FAIL(stats.sent == (unsigned long)messages && stats.dropped == 0, -6);
+
+    // Every message crossed the broker twice, discovery went to nobody
+    MICROFLO_RETURN_VAL_IF_FAIL(broker.delivered() == (unsigned long)messages*2, -7);
+    return 0;
+}
+
+int
+test_mqtt_host() {
+    // Several Repeat graphs over one connection, on fewer worker threads
+    LoopbackMqttBroker broker;
+    LoopbackMqttClient shared(&broker);
+    MqttClientMux mux(&shared);
+    MqttTenantHost host(2);
+    const int tenants = 5;
+    std::vector<TestTenant *> instances;
+    for (int i=0; i<tenants; i++) {
+        TestTenant *t = new TestTenant(mux.createChannel(), "repeat" + std::to_string(i));
+        host.add(t->mount);
+        t->mount->connect();
+        instances.push_back(t);
+    }
+    MICROFLO_RETURN_VAL_IF_FAIL(host.size() == (size_t)tenants, -1);
+
+    int result = 0;
+    {
+        TestMqttPeer peer;
+        LoopbackMqttClient peerClient(&broker);
+        peerClient.setHandler(&peer);
+        peerClient.start();
+        for (int i=0; i<tenants; i++) {
+            peerClient.subscribe(("/repeat" + std::to_string(i) + "/out").c_str(), 0);
+        }
+        TestHostRunner runner(&host);
+        mux.connect();
+        mux.start();
+        if (!waitFor([&] { return broker.subscribers("/repeat4/in") == 1; })) {
+            result = -2;
+        }
+
+        // Each instance answers on its own topic, with its own state
+        uint8_t payload[MICROFLO_PACKET_MSGPACK_MAX];
+        const int rounds = 20;
+        for (int r=0; r<rounds && result == 0; r++) {
+            for (int i=0; i<tenants; i++) {
+                const size_t length = encodePacketMsgPack(Packet((long)(i*1000+r)), payload, sizeof(payload));
+                peerClient.publish(("/repeat" + std::to_string(i) + "/in").c_str(), payload, length, 0);
+            }
+        }
+        if (result == 0 && !waitFor([&] { return peer.received() == (size_t)(rounds*tenants); })) {
+            result = -3;
+        }
+        int nextRound[tenants] = { 0 };
+        for (size_t m=0; m<peer.packets.size() && result == 0; m++) {
+            const long value = peer.packets[m].asInteger();
+            const int instance = value / 1000;
+            if (peer.topics[m] != "/repeat" + std::to_string(instance) + "/out") {
+                result = -4;
+            } else if (value % 1000 != nextRound[instance]++) {
+                result = -5; // order kept per instance
+            }
+        }
+        if (result == 0 && instances[3]->mount->outboundStatistics().sent != (unsigned long)rounds) {
+            result = -6;
+        }
+        peerClient.stop();
+    }
+    mux.stop();
+    for (int i=0; i<tenants; i++) {
+        delete instances[i];
+    }
+    return result;
+}
@@ -0,0 +1,126 @@
+
+#include <microflo.h>
+#include "../microflo/recordio.hpp"
+
+// Inputs change on every call, so a replay can only get them right from the trace
+class CountingIO : public NullIO {
+public:
+    CountingIO() : now(1000), reads(0), written(-1), interrupt(NULL), interruptUser(NULL) {}
+    virtual long TimerCurrentMs() { return now/1000; }
+    virtual long TimerCurrentMicros() { now += 7; return now; }
+    virtual bool DigitalRead(MicroFlo::PinId pin) { return (++reads + pin) % 2; }
+    virtual long AnalogRead(MicroFlo::PinId pin) { return -100 * (++reads); }
+    virtual long SerialDataAvailable(uint8_t) { return 3; }
+    virtual unsigned char SerialRead(uint8_t) { return 0x80 + (++reads); }
+    virtual void DigitalWrite(MicroFlo::PinId pin, bool val) { written = val; }
+    virtual void PwmWrite(MicroFlo::PinId pin, long dutyPercent) { written = dutyPercent; }
+    virtual void AttachExternalInterrupt(uint8_t, IO::Interrupt::Mode, IOInterruptFunction func, void *user) {
+        interrupt = func;
+        interruptUser = user;
+    }
+public:
+    long now;
+    int reads;
+    long written;
+    IOInterruptFunction interrupt;
+    void *interruptUser;
+};
+
+static void countInterrupt(void *user) {
+    (*static_cast<int *>(user))++;
+}
+
+// Makes the same calls against @io each time. Returns a checksum of what it read
+// Unsigned, so that it may wrap around
+static unsigned long
+exerciseIO(IO &io, int *interrupts, CountingIO *hardware) {
+    const MicroFlo::PinId pins[3] = { 2, 3, 4 };
+    unsigned long sum = 0;
+    io.AttachExternalInterrupt(1, IO::Interrupt::OnRisingEdge, countInterrupt, interrupts);
+    io.PinSetMode(5, IO::OutputPin);
+    for (int i=0; i<10; i++) {
+        sum += io.DigitalRead(i);
+        sum = sum*3 + io.AnalogRead(1);
+        sum = sum*3 + io.TimerCurrentMicros();
+        if (hardware && i == 4) {
+            hardware->interrupt(hardware->interruptUser);
+        }
+        sum = sum*3 + io.SerialDataAvailable(0);
+        sum = sum*3 + io.SerialRead(0);
+        sum = sum*3 + io.DigitalReadMany(pins, 3);
+        io.DigitalWrite(5, i % 2);
+        io.PwmWrite(6, i*10);
+    }
+    sum += io.TimerCurrentMs();
+    return sum;
+}
+
+int
+test_recordio() {
+    CountingIO hardware;
+    FILE *log = tmpfile();
+    MICROFLO_RETURN_VAL_IF_FAIL(log, -1);
+
+    // Record
+    int recordedInterrupts = 0;
+    unsigned long recordedSum = 0;
+    unsigned long records = 0;
+    {
+        RecordingIO recorder(&hardware, log);
+        recordedSum = exerciseIO(recorder, &recordedInterrupts, &hardware);
+        records = recorder.recordCount();
+    }
+    MICROFLO_RETURN_VAL_IF_FAIL(recordedInterrupts == 1, -2);
+    MICROFLO_RETURN_VAL_IF_FAIL(records == 2 + 10*8 + 1 + 1, -3);
+
+    uint8_t trace[4096];
+    const long traceLength = ftell(log);
+    MICROFLO_RETURN_VAL_IF_FAIL(traceLength > 0 && traceLength < (long)sizeof(trace), -4);
+    rewind(log);
+    MICROFLO_RETURN_VAL_IF_FAIL(fread(trace, 1, traceLength, log) == (size_t)traceLength, -5);
+    fclose(log);
+    // Compact: about 4 bytes per call
+    MICROFLO_RETURN_VAL_IF_FAIL(traceLength < (long)(records*5), -6);
+
+    // Replay gives back exactly what was read, including interrupt at same point
+    {
+        ReplayIO replay(trace, traceLength);
+        int replayedInterrupts = 0;
+        MICROFLO_RETURN_VAL_IF_FAIL(replay.valid() &&
+                                    replay.remaining() == (size_t)traceLength-MICROFLO_IOTRACE_HEADER_SIZE, -7);
+        MICROFLO_RETURN_VAL_IF_FAIL(exerciseIO(replay, &replayedInterrupts, NULL) == recordedSum, -8);
+        MICROFLO_RETURN_VAL_IF_FAIL(replayedInterrupts == 1, -9);
+        MICROFLO_RETURN_VAL_IF_FAIL(replay.divergences() == 0, -10);
+        MICROFLO_RETURN_VAL_IF_FAIL(replay.finished() && replay.remaining() == 0, -11);
+        MICROFLO_RETURN_VAL_IF_FAIL(replay.traceMicros() == (unsigned long)(hardware.now - 1007), -12);
+    }
+
+    // Different output value, and a call not in the trace, are divergences
+    {
+        ReplayIO replay(trace, traceLength);
+        int replayedInterrupts = 0;
+        replay.AttachExternalInterrupt(1, IO::Interrupt::OnRisingEdge, countInterrupt, &replayedInterrupts);
+        replay.PinSetMode(5, IO::InputPin);
+        MICROFLO_RETURN_VAL_IF_FAIL(replay.divergences() == 1, -13);
+        MICROFLO_RETURN_VAL_IF_FAIL(replay.AnalogRead(1) == 0, -14);
+        MICROFLO_RETURN_VAL_IF_FAIL(replay.divergences() == 2, -15);
+        // still in sync
+        MICROFLO_RETURN_VAL_IF_FAIL(replay.DigitalRead(0) == true, -16);
+        MICROFLO_RETURN_VAL_IF_FAIL(replay.AnalogRead(1) == -200, -17);
+        MICROFLO_RETURN_VAL_IF_FAIL(replay.divergences() == 2, -18);
+    }
+
+    // Truncated or foreign traces
+    {
+        ReplayIO replay(trace, traceLength-1);
+        int replayedInterrupts = 0;
+        exerciseIO(replay, &replayedInterrupts, NULL);
+        MICROFLO_RETURN_VAL_IF_FAIL(!replay.valid() && replay.finished(), -19);
+        trace[0] = 'X';
+        ReplayIO foreign(trace, traceLength);
+        MICROFLO_RETURN_VAL_IF_FAIL(!foreign.valid() && foreign.finished(), -20);
+        MICROFLO_RETURN_VAL_IF_FAIL(foreign.DigitalRead(1) == false, -21);
+    }
+
+    return 0;
+}
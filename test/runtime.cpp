@@ -1,16 +1,25 @@
 
 #include "./pointertypes.cpp"
 #include "./errors.cpp"
+#include "./io.cpp"
 #include "./hostcommunication.cpp"
+#include "./subgraph.cpp"
+#include "./subscription.cpp"
+#include "./recordio.cpp"
+#include "./virtualtime.cpp"
+#include "./tickstatistics.cpp"
+#include "./mqtt.cpp"
+#include "./linux.cpp"
 
 #include <microflo.cpp>
 
 #include <stdio.h>
 
 // XXX: Hack, generated component factory is currently needed
+// Component 1 is used when loading graph images
 Component *
-createComponent(unsigned char) {
-    return NULL;
+createComponent(unsigned char id) {
+    return (id == 1) ? new TestBurst(1) : NULL;
 }
 
 int
@@ -36,6 +45,16 @@ main(int argc, char *argv[]) {
         fprintf(stderr, "\tPASS\n");
     }
 
+    fprintf(stderr, "test_digital_many():\n");
+    const int test_digital_many_fails = test_digital_many();
+
+    if (test_digital_many_fails != 0) {
+        fprintf(stderr, "\tfailed at %d\n", test_digital_many_fails);
+        return 1;
+    } else {
+        fprintf(stderr, "\tPASS\n");
+    }
+
     fprintf(stderr, "test_host_communication():\n");
     const int test_host_fails = test_host_communication();
 
@@ -46,5 +65,155 @@ main(int argc, char *argv[]) {
         fprintf(stderr, "\tPASS\n");
     }
 
+    fprintf(stderr, "test_host_window():\n");
+    const int test_host_window_fails = test_host_window();
+
+    if (test_host_window_fails != 0) {
+        fprintf(stderr, "\tfailed at %d\n", test_host_window_fails);
+        return 1;
+    } else {
+        fprintf(stderr, "\tPASS\n");
+    }
+
+    fprintf(stderr, "test_graph_image():\n");
+    const int test_graph_image_fails = test_graph_image();
+
+    if (test_graph_image_fails != 0) {
+        fprintf(stderr, "\tfailed at %d\n", test_graph_image_fails);
+        return 1;
+    } else {
+        fprintf(stderr, "\tPASS\n");
+    }
+
+    fprintf(stderr, "test_graph_stream():\n");
+    const int test_graph_stream_fails = test_graph_stream();
+
+    if (test_graph_stream_fails != 0) {
+        fprintf(stderr, "\tfailed at %d\n", test_graph_stream_fails);
+        return 1;
+    } else {
+        fprintf(stderr, "\tPASS\n");
+    }
+
+    fprintf(stderr, "test_subgraph():\n");
+    const int test_subgraph_fails = test_subgraph();
+
+    if (test_subgraph_fails != 0) {
+        fprintf(stderr, "\tfailed at %d\n", test_subgraph_fails);
+        return 1;
+    } else {
+        fprintf(stderr, "\tPASS\n");
+    }
+
+    fprintf(stderr, "test_subscription():\n");
+    const int test_subscription_fails = test_subscription();
+
+    if (test_subscription_fails != 0) {
+        fprintf(stderr, "\tfailed at %d\n", test_subscription_fails);
+        return 1;
+    } else {
+        fprintf(stderr, "\tPASS\n");
+    }
+
+    fprintf(stderr, "test_recordio():\n");
+    const int test_recordio_fails = test_recordio();
+
+    if (test_recordio_fails != 0) {
+        fprintf(stderr, "\tfailed at %d\n", test_recordio_fails);
+        return 1;
+    } else {
+        fprintf(stderr, "\tPASS\n");
+    }
+
+    fprintf(stderr, "test_virtual_time():\n");
+    const int test_virtual_time_fails = test_virtual_time();
+
+    if (test_virtual_time_fails != 0) {
+        fprintf(stderr, "\tfailed at %d\n", test_virtual_time_fails);
+        return 1;
+    } else {
+        fprintf(stderr, "\tPASS\n");
+    }
+
+    fprintf(stderr, "test_tick_statistics():\n");
+    const int test_tick_statistics_fails = test_tick_statistics();
+
+    if (test_tick_statistics_fails != 0) {
+        fprintf(stderr, "\tfailed at %d\n", test_tick_statistics_fails);
+        return 1;
+    } else {
+        fprintf(stderr, "\tPASS\n");
+    }
+
+    fprintf(stderr, "test_mqtt():\n");
+    const int test_mqtt_fails = test_mqtt();
+
+    if (test_mqtt_fails != 0) {
+        fprintf(stderr, "\tfailed at %d\n", test_mqtt_fails);
+        return 1;
+    } else {
+        fprintf(stderr, "\tPASS\n");
+    }
+
+    fprintf(stderr, "test_mqtt_loopback():\n");
+    const int test_mqtt_loopback_fails = test_mqtt_loopback();
+
+    if (test_mqtt_loopback_fails != 0) {
+        fprintf(stderr, "\tfailed at %d\n", test_mqtt_loopback_fails);
+        return 1;
+    } else {
+        fprintf(stderr, "\tPASS\n");
+    }
+
+    fprintf(stderr, "test_mqtt_host():\n");
+    const int test_mqtt_host_fails = test_mqtt_host();
+
+    if (test_mqtt_host_fails != 0) {
+        fprintf(stderr, "\tfailed at %d\n", test_mqtt_host_fails);
+        return 1;
+    } else {
+        fprintf(stderr, "\tPASS\n");
+    }
+
+    fprintf(stderr, "test_linux_gpio():\n");
+    const int test_linux_gpio_fails = test_linux_gpio();
+
+    if (test_linux_gpio_fails != 0) {
+        fprintf(stderr, "\tfailed at %d\n", test_linux_gpio_fails);
+        return 1;
+    } else {
+        fprintf(stderr, "\tPASS\n");
+    }
+
+    fprintf(stderr, "test_linux_interrupts():\n");
+    const int test_linux_interrupts_fails = test_linux_interrupts();
+
+    if (test_linux_interrupts_fails != 0) {
+        fprintf(stderr, "\tfailed at %d\n", test_linux_interrupts_fails);
+        return 1;
+    } else {
+        fprintf(stderr, "\tPASS\n");
+    }
+
+    fprintf(stderr, "test_linux_serial_transport():\n");
+    const int test_linux_serial_transport_fails = test_linux_serial_transport();
+
+    if (test_linux_serial_transport_fails != 0) {
+        fprintf(stderr, "\tfailed at %d\n", test_linux_serial_transport_fails);
+        return 1;
+    } else {
+        fprintf(stderr, "\tPASS\n");
+    }
+
+    fprintf(stderr, "test_linux_socket_transport():\n");
+    const int test_linux_socket_transport_fails = test_linux_socket_transport();
+
+    if (test_linux_socket_transport_fails != 0) {
+        fprintf(stderr, "\tfailed at %d\n", test_linux_socket_transport_fails);
+        return 1;
+    } else {
+        fprintf(stderr, "\tPASS\n");
+    }
+
     return 0;
 }
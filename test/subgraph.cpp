@@ -0,0 +1,95 @@
+
+#include <microflo.h>
+#include "../microflo/io.hpp"
+#include "./testcomponents.hpp"
+
+static SubGraph *
+createTestSubGraph() {
+    SubGraph *s = new SubGraph();
+    s->setComponentId(MicroFlo::IdSubGraph);
+    return s;
+}
+
+// Sends each packet to all of its outports, which are allocated when added to the network
+class TestFanOut : public Component {
+public:
+    TestFanOut() : Component(NULL, 3) {}
+    virtual void process(Packet in, MicroFlo::PortId port) {
+        if (in.isData()) {
+            for (MicroFlo::PortId out=0; out<3; out++) {
+                send(in, out);
+            }
+        }
+    }
+};
+
+int
+test_subgraph() {
+#ifdef MICROFLO_ENABLE_SUBGRAPHS
+    FixedMessageQueue queue;
+    NullIO io;
+    Network network(&io, &queue);
+
+    // outer(SubGraph) contains inner(SubGraph) contains forward
+    MicroFlo::NodeId outer, inner, forward, capture;
+    TestCapture *captured = new TestCapture();
+    network.addNode(createTestSubGraph(), 0, &outer);
+    network.addNode(createTestSubGraph(), outer, &inner, 1, 1); // port tables sized for one in, one out
+    network.addNode(new TestForward(), inner, &forward);
+    network.addNode(captured, 0, &capture);
+
+    // Edge from the outer outport is made before the ports are exported
+    if (network.connect(outer, 0, capture, 0) != MICROFLO_OK) {
+        return -1;
+    }
+    if (network.connectSubgraph(false, inner, 0, forward, 0) != MICROFLO_OK) {
+        return -2;
+    }
+    if (network.connectSubgraph(true, inner, 0, forward, 0) != MICROFLO_OK) {
+        return -3;
+    }
+    if (network.connectSubgraph(false, outer, 0, inner, 0) != MICROFLO_OK) {
+        return -4;
+    }
+    if (network.connectSubgraph(true, outer, 0, inner, 0) != MICROFLO_OK) {
+        return -5;
+    }
+    network.start();
+
+    // Ports outside of what was allocated cannot be used
+    if (network.connect(inner, 1, capture, 0) != DebugNetworkConnectInvalidPort) {
+        return -10;
+    }
+
+    // Packet sent to outer inport should pass both levels, in and out
+    network.sendMessageTo(outer, 0, Packet((long)42));
+    network.runTick(); // delivered to forward
+    network.runTick(); // delivered to capture
+    if (captured->received != 1 || captured->last.asInteger() != 42) {
+        return -6;
+    }
+
+    // Removing the edge from subgraph outport should stop delivery
+    network.disconnect(outer, 0, capture, 0);
+    network.sendMessageTo(outer, 0, Packet((long)43));
+    network.runTick();
+    network.runTick();
+    if (captured->received != 1) {
+        return -7;
+    }
+
+    // A component gets all its ports even if fewer were asked for, so edges can be added while running
+    MicroFlo::NodeId fanout;
+    network.addNode(new TestFanOut(), 0, &fanout, 0, 1);
+    if (network.connect(fanout, 2, capture, 0) != MICROFLO_OK) {
+        return -8;
+    }
+    network.sendMessageTo(fanout, 0, Packet((long)7));
+    network.runTick();
+    network.runTick();
+    if (captured->received != 2 || captured->last.asInteger() != 7) {
+        return -9;
+    }
+#endif
+    return 0;
+}
@@ -0,0 +1,124 @@
+
+#include <microflo.h>
+#include "../microflo/io.hpp"
+#include "./testcomponents.hpp"
+
+class TestClockIO : public NullIO {
+public:
+    TestClockIO() : now(0) {}
+    virtual long TimerCurrentMs() { return now; }
+public:
+    long now;
+};
+
+class CountingNotificationHandler : public NetworkNotificationHandler {
+public:
+    CountingNotificationHandler() : notified(0) {}
+    virtual void packetSent(const Message &m, const Component *sender, MicroFlo::PortId senderPort) {
+        last = m.pkg;
+        notified++;
+    }
+    virtual void emitDebug(DebugLevel level, DebugId id) {}
+public:
+    Packet last;
+    int notified;
+};
+
+// Send each of @values through @source, returns number of notifications
+static int
+sendThrough(Network &network, MicroFlo::NodeId source, CountingNotificationHandler &handler,
+            const long *values, int n) {
+    handler.notified = 0;
+    for (int i=0; i<n; i++) {
+        network.sendMessageTo(source, 0, Packet(values[i]));
+        network.runTick();
+        network.runTick();
+    }
+    return handler.notified;
+}
+
+static int
+sendThrough(Network &network, MicroFlo::NodeId source, CountingNotificationHandler &handler,
+            const float *values, int n) {
+    handler.notified = 0;
+    for (int i=0; i<n; i++) {
+        network.sendMessageTo(source, 0, Packet(values[i]));
+        network.runTick();
+        network.runTick();
+    }
+    return handler.notified;
+}
+
+int
+test_subscription() {
+    FixedMessageQueue queue;
+    TestClockIO io;
+    Network network(&io, &queue);
+    CountingNotificationHandler handler;
+    network.setNotificationHandler(&handler);
+
+    MicroFlo::NodeId forward = 0;
+    MicroFlo::NodeId capture = 0;
+    TestCapture *c = new TestCapture();
+    network.addNode(new TestForward(), 0, &forward);
+    network.addNode(c, 0, &capture);
+    network.connect(forward, 0, capture, 0);
+    network.start();
+
+    const long values[] = { 10, 11, 12, 20, 20, 21, 30, 0 };
+    const int nValues = sizeof(values)/sizeof(values[0]);
+
+    // Default is to notify every packet
+    network.subscribeToPort(forward, 0, true);
+    MICROFLO_RETURN_VAL_IF_FAIL(sendThrough(network, forward, handler, values, nValues) == nValues, -1);
+
+    // Every 3rd packet
+    network.subscribeToPort(forward, 0, true, SubscriptionModeEveryNth, 3);
+    MICROFLO_RETURN_VAL_IF_FAIL(sendThrough(network, forward, handler, values, nValues) == 2, -2);
+
+    // On change, with deadband of 2
+    network.subscribeToPort(forward, 0, true, SubscriptionModeOnChange, 2*MICROFLO_DEADBAND_ONE);
+    MICROFLO_RETURN_VAL_IF_FAIL(sendThrough(network, forward, handler, values, nValues) == 4, -3);
+    MICROFLO_RETURN_VAL_IF_FAIL(handler.last == Packet(0L), -4);
+
+    // At most once per 100 ms
+    network.subscribeToPort(forward, 0, true, SubscriptionModeMaxRate, 100);
+    MICROFLO_RETURN_VAL_IF_FAIL(sendThrough(network, forward, handler, values, 3) == 1, -5);
+    io.now += 100;
+    MICROFLO_RETURN_VAL_IF_FAIL(sendThrough(network, forward, handler, values, 3) == 1, -6);
+
+    // Filtered notifications do not affect delivery
+    MICROFLO_RETURN_VAL_IF_FAIL(c->received == 3*nValues+6, -7);
+
+    // Unsubscribing removes filter
+    network.subscribeToPort(forward, 0, false, SubscriptionModeEveryNth, 3);
+    network.subscribeToPort(forward, 0, true);
+    MICROFLO_RETURN_VAL_IF_FAIL(sendThrough(network, forward, handler, values, nValues) == nValues, -8);
+
+    // Invalid mode is rejected
+    const MicroFlo::Error err = network.subscribeToPort(forward, 0, true, SubscriptionModeInvalid, 0);
+    MICROFLO_RETURN_VAL_IF_FAIL(err == DebugSubscribePortInvalidMode, -9);
+
+    // Deadband can have fractions. Integers must change by more than 1.5, so by 2
+    network.subscribeToPort(forward, 0, true, SubscriptionModeOnChange, MICROFLO_DEADBAND_ONE*3/2);
+    MICROFLO_RETURN_VAL_IF_FAIL(sendThrough(network, forward, handler, values, nValues) == 5, -10);
+
+    // On change of a float, with deadband of 0.5
+    const float floats[] = { 20.0f, 20.2f, 20.4f, 20.7f, 20.7f, 21.0f, 19.9f };
+    const int nFloats = sizeof(floats)/sizeof(floats[0]);
+    network.subscribeToPort(forward, 0, true, SubscriptionModeOnChange, MICROFLO_DEADBAND_ONE/2);
+    MICROFLO_RETURN_VAL_IF_FAIL(sendThrough(network, forward, handler, floats, nFloats) == 3, -11);
+    MICROFLO_RETURN_VAL_IF_FAIL(handler.last.asFloat() == 19.9f, -12);
+
+    // Disconnecting a port removes its filter, so the slot can be reused
+    for (int i=0; i<MICROFLO_MAX_SUBSCRIPTION_FILTERS+1; i++) {
+        MicroFlo::NodeId source = 0;
+        network.addNode(new TestForward(), 0, &source);
+        network.connect(source, 0, capture, 0);
+        const MicroFlo::Error subscribed = network.subscribeToPort(source, 0, true, SubscriptionModeEveryNth, 3);
+        MICROFLO_RETURN_VAL_IF_FAIL(subscribed == MICROFLO_OK, -13);
+        network.disconnect(source, 0, capture, 0);
+    }
+
+    return 0;
+}
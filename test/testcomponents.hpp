@@ -0,0 +1,32 @@
+
+// Components shared by the runtime tests
+
+#ifndef MICROFLO_TEST_TESTCOMPONENTS_HPP
+#define MICROFLO_TEST_TESTCOMPONENTS_HPP
+
+#include <microflo.h>
+
+class TestForward : public SingleOutputComponent {
+public:
+    virtual void process(Packet in, MicroFlo::PortId port) {
+        if (in.isData()) {
+            send(in, 0);
+        }
+    }
+};
+
+class TestCapture : public SingleOutputComponent {
+public:
+    TestCapture() : received(0) {}
+    virtual void process(Packet in, MicroFlo::PortId port) {
+        if (in.isData()) {
+            last = in;
+            received++;
+        }
+    }
+public:
+    Packet last;
+    int received;
+};
+
+#endif // MICROFLO_TEST_TESTCOMPONENTS_HPP
@@ -0,0 +1,102 @@
+
+#include <microflo.h>
+#include "../microflo/io.hpp"
+#include "../microflo/virtualtime.hpp"
+
+// Takes @busyMicros of every tick, and every 100th tick @slowMicros
+class TestBusy : public SingleOutputComponent {
+public:
+    TestBusy(VirtualClockIO *clock, long busyMicros, long slowMicros)
+        : clock(clock), busyMicros(busyMicros), slowMicros(slowMicros), ticks(0) {}
+    virtual void process(Packet in, MicroFlo::PortId port) {
+        if (in.isTick()) {
+            clock->advance((++ticks % 100) == 0 ? slowMicros : busyMicros);
+        }
+    }
+private:
+    VirtualClockIO *clock;
+    long busyMicros;
+    long slowMicros;
+    long ticks;
+};
+
+static uint32_t
+readStatistic(const FakeTransport &d) {
+    return d.response[4] | (d.response[5] << 8) | (d.response[6] << 16) | ((uint32_t)d.response[7] << 24);
+}
+
+int
+test_tick_statistics() {
+#ifdef MICROFLO_ENABLE_TICK_STATISTICS
+    // Histogram
+    TimeHistogram h;
+    MICROFLO_RETURN_VAL_IF_FAIL(h.statistic(TickStatisticMin) == 0 && h.percentile(99) == 0, -1);
+    for (uint32_t i=1; i<=1000; i++) {
+        h.add(i);
+    }
+    MICROFLO_RETURN_VAL_IF_FAIL(h.statistic(TickStatisticCount) == 1000, -2);
+    MICROFLO_RETURN_VAL_IF_FAIL(h.statistic(TickStatisticMin) == 1, -3);
+    MICROFLO_RETURN_VAL_IF_FAIL(h.statistic(TickStatisticMax) == 1000, -4);
+    MICROFLO_RETURN_VAL_IF_FAIL(h.statistic(TickStatisticAverage) == 500, -5);
+    const uint32_t p99 = h.statistic(TickStatisticPercentile99);
+    MICROFLO_RETURN_VAL_IF_FAIL(p99 >= 990 && p99 <= 990*1125/1000, -6);
+    MICROFLO_RETURN_VAL_IF_FAIL(h.percentile(50) >= 500 && h.percentile(50) <= 500*1125/1000, -7);
+    h.add(0xFFFFFFFF); // past last bucket
+    MICROFLO_RETURN_VAL_IF_FAIL(h.percentile(100) == 0xFFFFFFFF, -8);
+#endif
+
+    // Network at 1 kHz, ticks take 200 us, every 100th 900 us
+    FixedMessageQueue queue;
+    NullIO hardware;
+    VirtualClockIO clock(&hardware);
+    Network network(&clock, &queue);
+    FakeTransport transport;
+    HostCommunication controller;
+    transport.setup(&clock, &controller);
+    controller.setup(&network, &transport);
+
+    network.addNode(new TestBusy(&clock, 200, 900), 0, NULL);
+    network.start();
+
+    // Not enabled, or compiled out
+    uint8_t openComm[MICROFLO_CMD_SIZE];
+    memcpy(openComm, MICROFLO_GRAPH_MAGIC, sizeof(MICROFLO_GRAPH_MAGIC));
+    openComm[MICROFLO_CMD_SIZE-1] = 1;
+    transport.request(openComm, MICROFLO_CMD_SIZE);
+    const uint8_t getMax[MICROFLO_CMD_SIZE] = { 2, GraphCmdGetTickStatistics, 1, TickStatisticMax, 0 }; // series: Duration
+    transport.request(getMax, MICROFLO_CMD_SIZE);
+    MICROFLO_RETURN_VAL_IF_FAIL(transport.response[1] == GraphCmdError, -9);
+    MICROFLO_RETURN_VAL_IF_FAIL(transport.response[2] == DebugTickStatisticsUnavailable, -10);
+
+#ifdef MICROFLO_ENABLE_TICK_STATISTICS
+    TickStatistics stats;
+    network.setTickStatistics(&stats);
+    for (int i=0; i<1000; i++) {
+        const uint64_t start = clock.currentMicros();
+        network.runTick();
+        clock.advance(1000 - (clock.currentMicros() - start));
+    }
+    MICROFLO_RETURN_VAL_IF_FAIL(stats.interval.count == 999, -11);
+    MICROFLO_RETURN_VAL_IF_FAIL(stats.interval.min == 1000 && stats.interval.max == 1000, -12);
+    MICROFLO_RETURN_VAL_IF_FAIL(stats.duration.statistic(TickStatisticAverage) == 207, -13);
+    MICROFLO_RETURN_VAL_IF_FAIL(stats.duration.percentile(98) < 225, -14);
+    MICROFLO_RETURN_VAL_IF_FAIL(stats.duration.percentile(99) == 207, -15); // bucket 192-207
+    MICROFLO_RETURN_VAL_IF_FAIL(stats.duration.percentile(100) == 900, -16);
+
+    // Over host protocol
+    transport.request(getMax, MICROFLO_CMD_SIZE);
+    MICROFLO_RETURN_VAL_IF_FAIL(transport.response[1] == GraphCmdTickStatistics, -17);
+    MICROFLO_RETURN_VAL_IF_FAIL(transport.response[2] == TickStatistics::Duration, -18);
+    MICROFLO_RETURN_VAL_IF_FAIL(transport.response[3] == TickStatisticMax, -19);
+    MICROFLO_RETURN_VAL_IF_FAIL(readStatistic(transport) == 900, -20);
+    const uint8_t getCountAndReset[MICROFLO_CMD_SIZE] = { 3, GraphCmdGetTickStatistics, TickStatistics::Interval, TickStatisticCount, 1 };
+    transport.request(getCountAndReset, MICROFLO_CMD_SIZE);
+    MICROFLO_RETURN_VAL_IF_FAIL(readStatistic(transport) == 999, -21);
+    MICROFLO_RETURN_VAL_IF_FAIL(stats.interval.count == 0 && stats.duration.count == 0, -22);
+    const uint8_t getInvalid[MICROFLO_CMD_SIZE] = { 4, GraphCmdGetTickStatistics, 2, TickStatisticCount, 0 };
+    transport.request(getInvalid, MICROFLO_CMD_SIZE);
+    MICROFLO_RETURN_VAL_IF_FAIL(transport.response[1] == GraphCmdError, -23);
+#endif
+
+    return 0;
+}
@@ -0,0 +1,137 @@
+
+#include <microflo.h>
+#include "../microflo/io.hpp"
+#include "../microflo/virtualtime.hpp"
+#include "./testcomponents.hpp"
+
+// Like the Timer component, optionally telling network when it next needs to run
+class TestTimer : public SingleOutputComponent {
+public:
+    TestTimer(unsigned long interval, bool wakeups)
+        : previousMillis(0), interval(interval), wakeups(wakeups), ticks(0) {}
+    virtual void process(Packet in, MicroFlo::PortId port) {
+        if (in.isTick()) {
+            ticks++;
+            const unsigned long currentMillis = io->TimerCurrentMs();
+            if (currentMillis - previousMillis >= interval) {
+                previousMillis = currentMillis;
+                send(Packet((long)currentMillis));
+            }
+            if (wakeups) {
+                network->requestWakeup(previousMillis + interval);
+            }
+        }
+    }
+public:
+    unsigned long previousMillis;
+    unsigned long interval;
+    bool wakeups;
+    unsigned long ticks;
+};
+
+int
+test_virtual_time() {
+    const unsigned long hour = 60*60*1000;
+
+    // Wakeup-aware components, an hour takes one tick per firing plus the message hops
+    {
+        FixedMessageQueue queue;
+        NullIO hardware;
+        VirtualClockIO clock(&hardware);
+        Network network(&clock, &queue);
+        MicroFlo::NodeId timer = 0;
+        MicroFlo::NodeId capture = 0;
+        TestCapture *c = new TestCapture();
+        network.addNode(new TestTimer(1000, true), 0, &timer);
+        network.addNode(c, 0, &capture);
+        network.connect(timer, 0, capture, 0);
+        network.start();
+
+        // Runs up to, not including, the end time
+        VirtualTimeRunner runner(&network, &clock, 1000);
+        const unsigned long ticks = runner.runFor(hour);
+        MICROFLO_RETURN_VAL_IF_FAIL(clock.TimerCurrentMs() == (long)hour, -1);
+        MICROFLO_RETURN_VAL_IF_FAIL(c->received == 3599, -2);
+        MICROFLO_RETURN_VAL_IF_FAIL(ticks < 4*3600, -3);
+        // Fired exactly on deadline
+        MICROFLO_RETURN_VAL_IF_FAIL(c->last.asInteger() == (long)hour-1000, -4);
+
+        // Continues where it was
+        runner.runFor(10*1000);
+        MICROFLO_RETURN_VAL_IF_FAIL(c->received == 3609, -5);
+    }
+
+    // Component which does not ask for wakeup still sees every idle step
+    {
+        FixedMessageQueue queue;
+        NullIO hardware;
+        VirtualClockIO clock(&hardware);
+        Network network(&clock, &queue);
+        MicroFlo::NodeId timer = 0;
+        MicroFlo::NodeId capture = 0;
+        TestCapture *c = new TestCapture();
+        TestTimer *t = new TestTimer(7, false);
+        network.addNode(t, 0, &timer);
+        network.addNode(c, 0, &capture);
+        network.connect(timer, 0, capture, 0);
+        network.start();
+
+        VirtualTimeRunner runner(&network, &clock);
+        runner.runFor(7000);
+        MICROFLO_RETURN_VAL_IF_FAIL(c->received == 999, -6);
+        MICROFLO_RETURN_VAL_IF_FAIL(t->ticks >= 7000, -7);
+    }
+
+    // Opting in, a wakeup elsewhere in the graph does not make a polling component miss idle steps
+    {
+        FixedMessageQueue queue;
+        NullIO hardware;
+        VirtualClockIO clock(&hardware);
+        Network network(&clock, &queue);
+        MicroFlo::NodeId waker = 0;
+        MicroFlo::NodeId poller = 0;
+        MicroFlo::NodeId capture = 0;
+        TestCapture *c = new TestCapture();
+        network.addNode(new TestTimer(1000, true), 0, &waker);
+        network.addNode(new TestTimer(7, false), 0, &poller);
+        network.addNode(c, 0, &capture);
+        network.connect(poller, 0, capture, 0);
+        network.start();
+
+        VirtualTimeRunner runner(&network, &clock, 1, 10, true);
+        runner.runFor(7000);
+        MICROFLO_RETURN_VAL_IF_FAIL(c->received == 999, -10);
+    }
+
+    // By default idle time goes straight to the wakeup, about 2 ticks per Timer period
+    {
+        FixedMessageQueue queue;
+        NullIO hardware;
+        VirtualClockIO clock(&hardware);
+        Network network(&clock, &queue);
+        MicroFlo::NodeId timer = 0;
+        MicroFlo::NodeId capture = 0;
+        TestCapture *c = new TestCapture();
+        network.addNode(new TestTimer(1000, true), 0, &timer);
+        network.addNode(c, 0, &capture);
+        network.connect(timer, 0, capture, 0);
+        network.start();
+
+        VirtualTimeRunner runner(&network, &clock);
+        const unsigned long ticks = runner.runFor(hour);
+        MICROFLO_RETURN_VAL_IF_FAIL(c->received == 3599 && ticks <= 2*3600+2, -11);
+    }
+
+    // Stopped network does not spin
+    {
+        FixedMessageQueue queue;
+        NullIO hardware;
+        VirtualClockIO clock(&hardware, 5000);
+        Network network(&clock, &queue);
+        VirtualTimeRunner runner(&network, &clock);
+        MICROFLO_RETURN_VAL_IF_FAIL(runner.runFor(hour) == 1, -8);
+        MICROFLO_RETURN_VAL_IF_FAIL(clock.TimerCurrentMs() == (long)hour + 5, -9);
+    }
+
+    return 0;
+}